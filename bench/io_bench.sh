@@ -0,0 +1,82 @@
+#!/bin/sh
+# epoll vs io_uring: throughput and syscalls per request for both backends.
+# mock origin <- caching-proxy --io-backend <backend> <- load generator.
+# Results are appended as JSON lines to bench/results/<time>-<sha>-io.json:
+# the load-gen lines of the plain runs, then per backend and workload one
+# {"label":"<backend>-<workload>-syscalls","requests":..,"syscalls":..,"per_request":..}
+# line from a second run under bin/syscount(ptrace, too slow for throughput).
+#
+# Knobs(environment): DURATION, CONNECTIONS, BODY_SIZE, ORIGIN_PORT, PROXY_PORT
+set -e
+
+cd "$(dirname "$0")/.."
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-16}
+BODY_SIZE=${BODY_SIZE:-4096}
+ORIGIN_PORT=${ORIGIN_PORT:-18082}
+PROXY_PORT=${PROXY_PORT:-18083}
+
+SHA=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p bench/results
+OUT=bench/results/$(date -u +%Y%m%dT%H%M%SZ)-$SHA-io.json
+TMP=$(mktemp -d)
+
+bin/mock-origin --port $ORIGIN_PORT --body-size $BODY_SIZE > /dev/null &
+ORIGIN_PID=$!
+PROXY_PID=
+trap 'kill $PROXY_PID $ORIGIN_PID 2>/dev/null; wait 2>/dev/null; rm -rf $TMP' EXIT INT TERM
+
+# Proxy ports differ per run, a closed listener lingers in TIME_WAIT
+PORT=$PROXY_PORT
+
+start_proxy() {
+    PORT=$((PORT + 1))
+    $1 bin/caching-proxy --port $PORT --origin http://127.0.0.1:$ORIGIN_PORT \
+        --keep-alive 600 --access-log off --io-backend $2 > /dev/null &
+    PROXY_PID=$!
+    sleep 1
+}
+
+stop_proxy() {
+    kill -INT $PROXY_PID 2>/dev/null || true
+    wait $PROXY_PID 2>/dev/null || true
+    PROXY_PID=
+}
+
+json_field() {
+    sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p" $1 | tail -1
+}
+
+for BACKEND in epoll uring; do
+    LOAD="bin/load-gen --duration $DURATION --connections $CONNECTIONS"
+
+    # Throughput
+    start_proxy "" $BACKEND
+    $LOAD --target 127.0.0.1:$PORT --workload hit --keys 100 --label $BACKEND-hit --json $OUT || true
+    $LOAD --target 127.0.0.1:$PORT --workload miss --label $BACKEND-miss --json $OUT || true
+    stop_proxy
+
+    # Syscalls per request, counted from after warm-up to the end of the load
+    for WORKLOAD in hit miss; do
+        rm -f $TMP/sys.json $TMP/load.json
+        start_proxy "bin/syscount --json $TMP/sys.json --" $BACKEND
+        bin/load-gen --target 127.0.0.1:$PORT --workload hit --keys 100 --duration 0.1 --connections 1 > /dev/null || true
+        kill -USR1 $PROXY_PID
+        sleep 0.5
+        $LOAD --target 127.0.0.1:$PORT --workload $WORKLOAD --keys 100 --json $TMP/load.json > /dev/null || true
+        kill -USR2 $PROXY_PID
+        # Seen at the next syscall of the proxy, at most one idle wakeup away
+        for i in 1 2 3 4 5 6 7 8 9 10; do
+            [ -s $TMP/sys.json ] && break
+            sleep 0.5
+        done
+        stop_proxy
+        REQUESTS=$(json_field $TMP/load.json requests)
+        SYSCALLS=$(json_field $TMP/sys.json syscalls)
+        awk -v b=$BACKEND -v w=$WORKLOAD -v r=${REQUESTS:-0} -v s=${SYSCALLS:-0} 'BEGIN {
+            printf("{\"label\":\"%s-%s-syscalls\",\"requests\":%d,\"syscalls\":%d,\"per_request\":%.2f}\n",
+                b, w, r, s, r > 0 ? s / r : 0) }' | tee -a $OUT
+    done
+done
+
+echo "Results written to $OUT"
@@ -0,0 +1,282 @@
+/*
+ * Load generator for caching-proxy.
+ *
+ * load-gen --target 127.0.0.1:18081 --workload hit|miss|mixed
+ *          [--duration 10] [--connections 16] [--rate 0]
+ *          [--keys 1000] [--zipf 0.99] [--label name] [--json results.jsonl]
+ *
+ * --rate 0 runs closed loop: every connection sends its next request once
+ * the previous one is done. --rate > 0 runs open loop: requests are
+ * scheduled at a fixed arrival rate and latency is taken from the scheduled
+ * time, so a stalled server can't hide its queueing(coordinated omission).
+ *
+ * Workloads:
+ *   hit   - zipf over a small key set warmed up front, nearly all hits
+ *   miss  - every url is unique, every request goes to origin
+ *   mixed - zipf over --keys keys, cold start
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct option longopts[] = {
+    {"target", required_argument, 0, 0},
+    {"workload", required_argument, 0, 1},
+    {"duration", required_argument, 0, 2},
+    {"connections", required_argument, 0, 3},
+    {"rate", required_argument, 0, 4},
+    {"keys", required_argument, 0, 5},
+    {"zipf", required_argument, 0, 6},
+    {"label", required_argument, 0, 7},
+    {"json", required_argument, 0, 8},
+    {0, 0, 0, 0}};
+
+struct LoadConfig {
+    std::string host = "127.0.0.1";
+    int port = 18081;
+    std::string workload = "mixed";
+    double duration = 10;
+    int connections = 16;
+    double rate = 0;
+    size_t keys = 1000;
+    double zipf = 0.99;
+    std::string label;
+    std::string json;
+};
+
+struct ThreadResult {
+    std::vector<uint32_t> latency_us;
+    uint64_t errors = 0;
+    uint64_t hits = 0;
+};
+
+static LoadConfig config;
+
+class Zipf {
+public:
+    Zipf(size_t n, double s) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for (auto& v : cdf_) {
+            v /= sum;
+        }
+    }
+
+    size_t Next(std::mt19937_64& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+// One request per connection, the proxy closes after every response
+static bool Fetch(const std::string& url, bool& hit) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return false;
+    }
+    struct timeval tv;
+    tv.tv_sec = 10;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr))) {
+        close(sock);
+        return false;
+    }
+    std::string req = "GET " + url + " HTTP/1.1\r\nHost: " + config.host + "\r\nAccept: */*\r\n\r\n";
+    if (write(sock, req.data(), req.size()) != static_cast<ssize_t>(req.size())) {
+        close(sock);
+        return false;
+    }
+    char buffer[16384];
+    std::string head;
+    ssize_t n;
+    while ((n = read(sock, buffer, sizeof(buffer))) > 0) {
+        // Only the header block matters, the rest is drained
+        if (head.size() < 4096) {
+            head.append(buffer, std::min<size_t>(n, 4096 - head.size()));
+        }
+    }
+    close(sock);
+    hit = head.find("X-Cache: HIT") != std::string::npos;
+    return n == 0 && head.compare(0, 12, "HTTP/1.1 200") == 0;
+}
+
+static std::string MakeUrl(int tid, uint64_t seq, Zipf* zipf, std::mt19937_64& rng) {
+    char buffer[128];
+    if (config.workload == "miss") {
+        snprintf(buffer, sizeof(buffer), "/bench/miss/%d-%llu-%llu", tid, (unsigned long long)seq,
+            (unsigned long long)Clock::now().time_since_epoch().count());
+    } else {
+        snprintf(buffer, sizeof(buffer), "/bench/%s/%zu", config.workload.c_str(), zipf->Next(rng));
+    }
+    return buffer;
+}
+
+static void Run(int tid, Zipf* zipf, Clock::time_point start, Clock::time_point stop, ThreadResult& result) {
+    std::mt19937_64 rng(tid * 7919 + 1);
+    uint64_t seq = 0;
+    // Open loop: this thread owns every `connections`-th arrival slot
+    std::chrono::nanoseconds interval(0);
+    if (config.rate > 0) {
+        interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * config.connections / config.rate));
+    }
+    Clock::time_point next = start + interval * tid / config.connections;
+    while (true) {
+        Clock::time_point begin;
+        if (config.rate > 0) {
+            if (next >= stop) {
+                break;
+            }
+            std::this_thread::sleep_until(next);
+            begin = next;
+            next += interval;
+        } else {
+            begin = Clock::now();
+            if (begin >= stop) {
+                break;
+            }
+        }
+        bool hit = false;
+        if (!Fetch(MakeUrl(tid, seq++, zipf, rng), hit)) {
+            result.errors++;
+            continue;
+        }
+        result.hits += hit ? 1 : 0;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count();
+        result.latency_us.push_back(static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX)));
+    }
+}
+
+static uint32_t Percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()));
+    return sorted[idx];
+}
+
+int main(int argc, char *const argv[])
+{
+    int c = 0;
+    std::string target;
+    while ((c = getopt_long(argc, argv, "", longopts, 0)) != -1) {
+        switch (c)
+        {
+        case 0: target = optarg; break;
+        case 1: config.workload = optarg; break;
+        case 2: config.duration = atof(optarg); break;
+        case 3: config.connections = std::max(1, atoi(optarg)); break;
+        case 4: config.rate = atof(optarg); break;
+        case 5: config.keys = std::max<size_t>(1, strtoull(optarg, 0, 10)); break;
+        case 6: config.zipf = atof(optarg); break;
+        case 7: config.label = optarg; break;
+        case 8: config.json = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s --target host:port --workload hit|miss|mixed [--duration s] "
+                "[--connections n] [--rate r] [--keys n] [--zipf s] [--label name] [--json file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!target.empty()) {
+        size_t colon = target.rfind(':');
+        config.host = target.substr(0, colon);
+        if (colon != std::string::npos) {
+            config.port = atoi(target.c_str() + colon + 1);
+        }
+    }
+    if (config.workload != "hit" && config.workload != "miss" && config.workload != "mixed") {
+        fprintf(stderr, "Unknown workload [%s].\n", config.workload.c_str());
+        return EXIT_FAILURE;
+    }
+    if (config.label.empty()) {
+        config.label = config.workload;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Zipf zipf(config.keys, config.zipf);
+    if (config.workload == "hit") {
+        // Every key cached before measuring
+        bool hit;
+        for (size_t k = 0; k < config.keys; ++k) {
+            Fetch("/bench/hit/" + std::to_string(k), hit);
+        }
+    }
+
+    std::vector<ThreadResult> results(config.connections);
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    auto stop = start + std::chrono::microseconds(static_cast<int64_t>(config.duration * 1e6));
+    for (int i = 0; i < config.connections; ++i) {
+        workers.emplace_back(Run, i, &zipf, start, stop, std::ref(results[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<uint32_t> latency;
+    uint64_t errors = 0, hits = 0;
+    for (auto& r : results) {
+        latency.insert(latency.end(), r.latency_us.begin(), r.latency_us.end());
+        errors += r.errors;
+        hits += r.hits;
+    }
+    std::sort(latency.begin(), latency.end());
+    double mean = 0;
+    for (auto v : latency) {
+        mean += v;
+    }
+    mean = latency.empty() ? 0 : mean / latency.size();
+
+    char line[1024];
+    snprintf(line, sizeof(line),
+        "{\"label\":\"%s\",\"workload\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"rate\":%.1f,"
+        "\"keys\":%zu,\"zipf\":%.2f,\"duration_s\":%.3f,\"requests\":%zu,\"errors\":%llu,"
+        "\"throughput_rps\":%.1f,\"hit_ratio\":%.4f,"
+        "\"latency_us\":{\"mean\":%.1f,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}",
+        config.label.c_str(), config.workload.c_str(), config.rate > 0 ? "open" : "closed",
+        config.connections, config.rate, config.keys, config.zipf, elapsed, latency.size(),
+        (unsigned long long)errors, latency.size() / elapsed,
+        latency.empty() ? 0.0 : static_cast<double>(hits) / latency.size(),
+        mean, Percentile(latency, 0.5), Percentile(latency, 0.99), Percentile(latency, 0.999),
+        latency.empty() ? 0 : latency.back());
+    fprintf(stdout, "%s\n", line);
+    if (!config.json.empty()) {
+        FILE* out = fopen(config.json.c_str(), "a");
+        if (!out) {
+            fprintf(stderr, "Open [%s] failed.\n", config.json.c_str());
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "%s\n", line);
+        fclose(out);
+    }
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,182 @@
+#ifndef MICRO_BENCH_HPP
+#define MICRO_BENCH_HPP
+
+/*
+ * Minimal Google-Benchmark-style harness, no dependency beyond the standard
+ * library so it builds wherever the proxy builds.
+ *
+ *   static void BM_Foo(BenchState& state) {
+ *       std::string s(state.range(0), 'x');
+ *       while (state.KeepRunning()) {
+ *           ...
+ *       }
+ *       state.SetBytesProcessed(state.iterations() * s.size());
+ *   }
+ *   MICRO_BENCH(BM_Foo)->RangeMultiplier(10)->Range(1000, 1000000)->ThreadRange(1, 64);
+ *
+ * Iterations are calibrated until a run takes at least --min-time seconds.
+ * Multi-threaded runs start every thread at once and report the wall clock
+ * time per iteration of one thread, as Google Benchmark does.
+ */
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "net_cache_server_util.hpp"
+
+/// @brief Reaches the private hot paths under test, befriended by each class.
+struct MicroBench {
+    static void ParseHttpRequest(const std::string& req, HttpRequest& http_req) {
+        NetCacheServerUtil::GetInstance().parseHttpRequest(req, http_req);
+    }
+
+    static void ConstructHttpResponse(const HttpResponse& resp_origin, std::string& resp) {
+        NetCacheServerUtil::GetInstance().constructHttpResponse(resp_origin, resp);
+    }
+
+    static void ExtendHeader(HttpResponse& resp, const char* extend) {
+        NetCacheServerUtil::GetInstance().extendHeader(resp, extend);
+    }
+
+    static void ParseHttpResponse(const std::string& resp, HttpResponse& http_resp) {
+        NetClientUtil::GetInstance().parseHttpResponse(resp, http_resp);
+    }
+
+    static void CheckInactiveCache() {
+        CacheTimer::GetInstance().checkInactiveCache();
+    }
+};
+
+class BenchState {
+public:
+    BenchState(const std::vector<int64_t>& args, int threads, int thread_index, int64_t max_iterations)
+        : args_(args), threads_(threads), thread_index_(thread_index),
+          max_iterations_(max_iterations), iterations_(0), started_(false),
+          paused_ns_(0), items_(0), bytes_(0) {}
+
+    bool KeepRunning() {
+        if (!started_) {
+            started_ = true;
+            start_ = std::chrono::steady_clock::now();
+        }
+        if (iterations_ < max_iterations_) {
+            ++iterations_;
+            return true;
+        }
+        stop_ = std::chrono::steady_clock::now();
+        return false;
+    }
+
+    /// @brief Exclude setup inside the loop from the measurement.
+    void PauseTiming() { pause_ = std::chrono::steady_clock::now(); }
+
+    void ResumeTiming() {
+        paused_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - pause_).count();
+    }
+
+    int64_t range(size_t i = 0) const { return i < args_.size() ? args_[i] : 0; }
+
+    int threads() const { return threads_; }
+
+    int thread_index() const { return thread_index_; }
+
+    int64_t iterations() const { return iterations_; }
+
+    void SetItemsProcessed(int64_t items) { items_ = items; }
+
+    void SetBytesProcessed(int64_t bytes) { bytes_ = bytes; }
+
+    int64_t ElapsedNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(stop_ - start_).count() - paused_ns_;
+    }
+
+    int64_t items() const { return items_; }
+
+    int64_t bytes() const { return bytes_; }
+
+private:
+    std::vector<int64_t> args_;
+    int threads_;
+    int thread_index_;
+    int64_t max_iterations_;
+    int64_t iterations_;
+    bool started_;
+    std::chrono::steady_clock::time_point start_, stop_, pause_;
+    int64_t paused_ns_;
+    int64_t items_;
+    int64_t bytes_;
+};
+
+typedef void (*BenchFunction)(BenchState&);
+
+class Benchmark {
+public:
+    Benchmark(const char* name, BenchFunction fn)
+        : name_(name), fn_(fn), setup_(nullptr), teardown_(nullptr), multiplier_(8) {}
+
+    Benchmark* Arg(int64_t arg) {
+        args_.push_back(arg);
+        return this;
+    }
+
+    Benchmark* RangeMultiplier(int multiplier) {
+        multiplier_ = multiplier;
+        return this;
+    }
+
+    /// @brief Arguments lo, lo*m, lo*m^2, ... and hi.
+    Benchmark* Range(int64_t lo, int64_t hi) {
+        for (int64_t v = lo; v < hi; v *= multiplier_) {
+            args_.push_back(v);
+        }
+        args_.push_back(hi);
+        return this;
+    }
+
+    /// @brief Thread counts lo, lo*2, ... and hi.
+    Benchmark* ThreadRange(int lo, int hi) {
+        for (int t = lo; t < hi; t *= 2) {
+            threads_.push_back(t);
+        }
+        threads_.push_back(hi);
+        return this;
+    }
+
+    /// @brief Called once per argument before any timed run, e.g. to fill a cache.
+    Benchmark* Setup(BenchFunction fn) {
+        setup_ = fn;
+        return this;
+    }
+
+    Benchmark* Teardown(BenchFunction fn) {
+        teardown_ = fn;
+        return this;
+    }
+
+private:
+    friend struct BenchRunner;
+
+    std::string name_;
+    BenchFunction fn_;
+    BenchFunction setup_;
+    BenchFunction teardown_;
+    int multiplier_;
+    std::vector<int64_t> args_;
+    std::vector<int> threads_;
+};
+
+Benchmark* RegisterBenchmark(const char* name, BenchFunction fn);
+
+#define MICRO_BENCH_CONCAT2(a, b) a##b
+#define MICRO_BENCH_CONCAT(a, b) MICRO_BENCH_CONCAT2(a, b)
+#define MICRO_BENCH(fn) \
+    static Benchmark* MICRO_BENCH_CONCAT(micro_bench_, __LINE__) = RegisterBenchmark(#fn, fn)
+
+/// @brief Keep the compiler from dropping a computed value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif // MICRO_BENCH_HPP
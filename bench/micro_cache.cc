@@ -0,0 +1,93 @@
+/*
+ * CacheTimer under contention: lookups, refreshes and replacements over a
+ * pre-filled store of 1K..10M entries from 1..64 threads, plus the expiry
+ * sweep of the timer thread.
+ */
+#include <string>
+#include <vector>
+#include <random>
+#include <climits>
+#include "micro_bench.hpp"
+
+static std::vector<std::string> keys;
+
+static void FillCache(int64_t n) {
+    CacheTimer& cache_timer = CacheTimer::GetInstance();
+    while (static_cast<int64_t>(keys.size()) < n) {
+        keys.push_back("/products/" + std::to_string(keys.size()) + "?select=title,price");
+    }
+    TMDBCache cache{};
+    cache.status_code = "200";
+    cache.status_msg = "OK";
+    cache.header_origin = "Content-Type: application/json\r\n";
+    cache.cache_content.assign(64, 'x');
+    for (int64_t i = 0; i < n; ++i) {
+        cache_timer.KeepCacheAlive(keys[i], cache);
+    }
+}
+
+static void SetupCache(BenchState& state) {
+    CacheTimer::GetInstance().ClearCache();
+    CacheTimer::GetInstance().SetMaxBytes(0);
+    CacheTimer::GetInstance().SetExpires(INT_MAX);
+    FillCache(state.range(0));
+}
+
+static void TeardownCache(BenchState& state) {
+    CacheTimer::GetInstance().ClearCache();
+}
+
+static void BM_CacheGet(BenchState& state) {
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::uniform_int_distribution<int64_t> pick(0, state.range(0) - 1);
+    CacheTimer& cache_timer = CacheTimer::GetInstance();
+    TMDBCache cache;
+    while (state.KeepRunning()) {
+        DoNotOptimize(cache_timer.GetCache(keys[pick(rng)], cache));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+MICRO_BENCH(BM_CacheGet)->RangeMultiplier(10)->Range(1000, 10000000)->ThreadRange(1, 64)
+    ->Setup(SetupCache)->Teardown(TeardownCache);
+
+static void BM_CacheKeepAlive(BenchState& state) {
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::uniform_int_distribution<int64_t> pick(0, state.range(0) - 1);
+    CacheTimer& cache_timer = CacheTimer::GetInstance();
+    while (state.KeepRunning()) {
+        cache_timer.TouchCache(keys[pick(rng)]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+MICRO_BENCH(BM_CacheKeepAlive)->RangeMultiplier(10)->Range(1000, 10000000)->ThreadRange(1, 64)
+    ->Setup(SetupCache)->Teardown(TeardownCache);
+
+static void BM_CacheReplace(BenchState& state) {
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::uniform_int_distribution<int64_t> pick(0, state.range(0) - 1);
+    CacheTimer& cache_timer = CacheTimer::GetInstance();
+    TMDBCache cache{};
+    cache.status_code = "200";
+    cache.status_msg = "OK";
+    cache.cache_content.assign(64, 'y');
+    while (state.KeepRunning()) {
+        cache_timer.KeepCacheAlive(keys[pick(rng)], cache);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+MICRO_BENCH(BM_CacheReplace)->RangeMultiplier(10)->Range(1000, 10000000)->ThreadRange(1, 64)
+    ->Setup(SetupCache)->Teardown(TeardownCache);
+
+// One sweep expiring every entry, the refill is not timed
+static void BM_CacheCheckInactive(BenchState& state) {
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        SetupCache(state);
+        CacheTimer::GetInstance().SetExpires(0);
+        state.ResumeTiming();
+        MicroBench::CheckInactiveCache();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+MICRO_BENCH(BM_CacheCheckInactive)->RangeMultiplier(10)->Range(1000, 10000000)
+    ->Teardown(TeardownCache);
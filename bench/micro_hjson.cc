@@ -0,0 +1,289 @@
+/*
+ * HJson parse and write on payloads shaped like a typical REST origin
+ * (dummyjson /products), from a handful of objects up to a few MB.
+ */
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "micro_bench.hpp"
+#include "hjson.hpp"
+
+// {"products":[{...}, ...],"total":n,"skip":0,"limit":n}
+static std::string MakeProducts(int64_t n) {
+    std::string json = "{\"products\":[";
+    char buffer[1024];
+    for (int64_t i = 0; i < n; ++i) {
+        snprintf(buffer, sizeof(buffer),
+            "%s{\"id\":%lld,\"title\":\"Product %lld\",\"description\":\"An apple mobile which is nothing like "
+            "apple, with a sleek design and a long lasting battery\",\"price\":%lld,"
+            "\"discountPercentage\":12.96,\"rating\":4.69,\"stock\":%lld,\"brand\":\"Apple\","
+            "\"category\":\"smartphones\",\"available\":true,\"warranty\":null,"
+            "\"thumbnail\":\"https://cdn.dummyjson.com/product-images/%lld/thumbnail.jpg\","
+            "\"images\":[\"https://cdn.dummyjson.com/product-images/%lld/1.jpg\","
+            "\"https://cdn.dummyjson.com/product-images/%lld/2.jpg\"]}",
+            i ? "," : "", (long long)i, (long long)i, (long long)(100 + i % 900), (long long)(i % 97),
+            (long long)i, (long long)i, (long long)i);
+        json += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "],\"total\":%lld,\"skip\":0,\"limit\":%lld}", (long long)n, (long long)n);
+    json += buffer;
+    return json;
+}
+
+// The same, indented the way origins with pretty printing on send it
+static std::string MakePrettyProducts(int64_t n) {
+    std::string compact = MakeProducts(n);
+    std::string json;
+    int depth = 0;
+    bool in_string = false;
+    for (size_t i = 0; i < compact.size(); ++i) {
+        char c = compact[i];
+        if (in_string) {
+            json += c;
+            if (c == '\\') {
+                json += compact[++i];
+            } else if (c == '\"') {
+                in_string = false;
+            }
+            continue;
+        }
+        switch (c)
+        {
+        case '\"': in_string = true; json += c; break;
+        case '{': case '[': json += c; json += '\n'; json.append(4 * ++depth, ' '); break;
+        case '}': case ']': json += '\n'; json.append(4 * --depth, ' '); json += c; break;
+        case ',': json += ",\n"; json.append(4 * depth, ' '); break;
+        case ':': json += ": "; break;
+        default: json += c; break;
+        }
+    }
+    return json;
+}
+
+static void BM_HJsonParse(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    while (state.KeepRunning()) {
+        HJson* root = HJson_parse(json.c_str());
+        DoNotOptimize(root);
+        HJson_delete(root);
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParse)->Range(1, 4096);
+
+// One arena per document, as a request would use it
+static void BM_HJsonParseArena(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    while (state.KeepRunning()) {
+        HJson_arena* arena = HJson_arenaNew();
+        HJson* root = HJson_parseArena(json.c_str(), arena);
+        DoNotOptimize(root);
+        HJson_arenaDelete(arena);
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParseArena)->Range(1, 4096);
+
+// One arena reused across documents, a worker keeping its own
+static void BM_HJsonParseArenaReuse(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    HJson_arena* arena = HJson_arenaNew();
+    while (state.KeepRunning()) {
+        HJson* root = HJson_parseArena(json.c_str(), arena);
+        DoNotOptimize(root);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParseArenaReuse)->Range(1, 4096);
+
+static void BM_HJsonParsePretty(BenchState& state) {
+    std::string json = MakePrettyProducts(state.range(0));
+    HJson_arena* arena = HJson_arenaNew();
+    while (state.KeepRunning()) {
+        HJson* root = HJson_parseArena(json.c_str(), arena);
+        DoNotOptimize(root);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParsePretty)->Range(1, 4096);
+
+// In place over a receive buffer: no terminator, strings left where they are
+static void BM_HJsonParseInsitu(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    std::string buffer = json;
+    HJson_arena* arena = HJson_arenaNew();
+    while (state.KeepRunning()) {
+        // The closing quotes were overwritten by the last run
+        state.PauseTiming();
+        memcpy(&buffer[0], json.data(), json.size());
+        state.ResumeTiming();
+        HJson* root = HJson_parseInsitu(&buffer[0], buffer.size(), arena);
+        DoNotOptimize(root);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParseInsitu)->Range(1, 4096);
+
+// Independent documents on every thread, each with its own context and
+// arena: nothing is shared, throughput should grow with the cores
+static void BM_HJsonParseParallel(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    HJson_arena* arena = HJson_arenaNew();
+    HJson_reader ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.arena = arena;
+    while (state.KeepRunning()) {
+        HJson* root = HJson_parseContext(json.data(), json.size(), &ctx);
+        DoNotOptimize(root);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParseParallel)->Range(64, 4096)->ThreadRange(1, 64);
+
+// Telemetry-style arrays: 64-bit ids, prices, coordinates
+static void BM_HJsonParseNumbers(BenchState& state) {
+    std::string json = "[";
+    char buffer[128];
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        snprintf(buffer, sizeof(buffer), "%s[%lld,%lld.%02lld,%.6f,%.6f,%lldE-3]", i ? "," : "",
+            (long long)(1700000000000000000LL + i * 7919), (long long)(i % 1000), (long long)(i % 100),
+            48.856613 + i * 1e-6, 2.352222 - i * 1e-6, (long long)i);
+        json += buffer;
+    }
+    json += "]";
+    HJson_arena* arena = HJson_arenaNew();
+    while (state.KeepRunning()) {
+        HJson* root = HJson_parseArena(json.c_str(), arena);
+        DoNotOptimize(root);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonParseNumbers)->Range(1, 4096);
+
+// Pull one field per product in 16KB chunks, as a body would arrive
+static void BM_HJsonPull(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    const size_t chunk = 16 * 1024;
+    while (state.KeepRunning()) {
+        HJson_pull pull;
+        HJson_pullInit(&pull);
+        int64_t ids = 0;
+        bool id = false;
+        for (size_t pos = 0; pos < json.size(); pos += chunk) {
+            size_t n = std::min(chunk, json.size() - pos);
+            HJson_pullFeed(&pull, json.data() + pos, n, pos + n == json.size());
+            PullEvent ev;
+            while ((ev = HJson_pullNext(&pull)) != PullEvent::kNeedMore && ev != PullEvent::kEnd) {
+                if (ev == PullEvent::kKey) {
+                    id = pull.depth == 3 && pull.sv_len == 2 && !memcmp(pull.sv, "id", 2);
+                } else if (ev == PullEvent::kValue && id) {
+                    ids += pull.lv;
+                    id = false;
+                }
+            }
+        }
+        DoNotOptimize(ids);
+        HJson_pullFree(&pull);
+    }
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+MICRO_BENCH(BM_HJsonPull)->Range(1, 4096);
+
+// {"k0":0,"k1":1,...}, every key looked up once per iteration
+static void BM_HJsonGetWide(BenchState& state) {
+    int64_t n = state.range(0);
+    std::string json = "{";
+    std::vector<std::string> keys;
+    for (int64_t i = 0; i < n; ++i) {
+        keys.push_back("k" + std::to_string(i));
+        json += (i ? ",\"" : "\"") + keys.back() + "\":" + std::to_string(i);
+    }
+    json += "}";
+    HJson* root = HJson_parse(json.c_str());
+    while (state.KeepRunning()) {
+        for (const std::string& key : keys) {
+            DoNotOptimize(root->get(key.c_str()));
+        }
+    }
+    HJson_delete(root);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+MICRO_BENCH(BM_HJsonGetWide)->Range(1, 4096);
+
+// [0,1,...], walked by index
+static void BM_HJsonAtArray(BenchState& state) {
+    int64_t n = state.range(0);
+    std::string json = "[";
+    for (int64_t i = 0; i < n; ++i) {
+        json += (i ? "," : "") + std::to_string(i);
+    }
+    json += "]";
+    HJson* root = HJson_parse(json.c_str());
+    while (state.KeepRunning()) {
+        for (int i = 0; i < n; ++i) {
+            DoNotOptimize(root->at(i));
+        }
+    }
+    HJson_delete(root);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+MICRO_BENCH(BM_HJsonAtArray)->Range(1, 4096);
+
+static void BM_HJsonWrite(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    HJson* root = HJson_parse(json.c_str());
+    int length = 0;
+    while (state.KeepRunning()) {
+        const char* out = HJson_write(root, length);
+        DoNotOptimize(out);
+        free((void*)out);
+    }
+    HJson_delete(root);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+MICRO_BENCH(BM_HJsonWrite)->Range(1, 4096);
+
+// Into one caller buffer sized once, the steady state of a worker
+static void BM_HJsonWriteTo(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    HJson* root = HJson_parse(json.c_str());
+    std::vector<char> out(HJson_measure(root) + 1);
+    int length = 0;
+    while (state.KeepRunning()) {
+        length = HJson_writeTo(root, out.data(), out.size());
+        DoNotOptimize(length);
+    }
+    HJson_delete(root);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+MICRO_BENCH(BM_HJsonWriteTo)->Range(1, 4096);
+
+static void BM_HJsonWriteChain(BenchState& state) {
+    std::string json = MakeProducts(state.range(0));
+    HJson* root = HJson_parse(json.c_str());
+    HJson_arena* arena = HJson_arenaNew();
+    size_t length = 0;
+    while (state.KeepRunning()) {
+        HJson_chain chain;
+        HJson_chainInit(&chain, arena);
+        HJson_writeChain(root, &chain);
+        length = chain.length;
+        DoNotOptimize(chain.iov);
+        HJson_chainFree(&chain);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+    HJson_delete(root);
+    state.SetBytesProcessed(state.iterations() * length);
+}
+MICRO_BENCH(BM_HJsonWriteChain)->Range(1, 4096);
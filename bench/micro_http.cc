@@ -0,0 +1,87 @@
+/*
+ * HTTP hot paths: request parsing on the client side of the proxy, response
+ * parsing on the origin side and response construction on the way back.
+ */
+#include <string>
+#include "micro_bench.hpp"
+
+static const char kRequest[] =
+    "GET /products/search?q=phone&limit=30&skip=0 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:3000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://127.0.0.1:3000/products\r\n"
+    "Cookie: session=4f1c2d7e9a8b; theme=dark\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static std::string MakeBody(size_t size) {
+    std::string body = "{\"products\":[";
+    while (body.size() + 2 < size) {
+        body += "{\"id\":1,\"title\":\"iPhone 9\",\"price\":549,\"rating\":4.69},";
+    }
+    body.resize(size - 2);
+    body += "]}";
+    return body;
+}
+
+static std::string MakeResponse(size_t body_size) {
+    std::string body = MakeBody(body_size);
+    return "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json; charset=utf-8\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Cache-Control: public, max-age=60\r\n"
+        "ETag: W/\"5e6-Tq3c2aN0wYq2S0M9Lr0zZ1pS2dE\"\r\n"
+        "Date: Mon, 19 Oct 2026 12:00:00 GMT\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Connection: close\r\n"
+        "\r\n" + body;
+}
+
+static void BM_ParseHttpRequest(BenchState& state) {
+    std::string req(kRequest);
+    while (state.KeepRunning()) {
+        HttpRequest http_req;
+        MicroBench::ParseHttpRequest(req, http_req);
+        DoNotOptimize(http_req.request_url);
+    }
+    state.SetBytesProcessed(state.iterations() * req.size());
+}
+MICRO_BENCH(BM_ParseHttpRequest);
+
+static void BM_ParseHttpResponse(BenchState& state) {
+    std::string resp = MakeResponse(state.range(0));
+    HttpResponse http_resp;
+    while (state.KeepRunning()) {
+        MicroBench::ParseHttpResponse(resp, http_resp);
+        DoNotOptimize(http_resp.body);
+    }
+    state.SetBytesProcessed(state.iterations() * resp.size());
+}
+MICRO_BENCH(BM_ParseHttpResponse)->Range(512, 512 << 10);
+
+static void BM_ConstructHttpResponse(BenchState& state) {
+    HttpResponse http_resp;
+    MicroBench::ParseHttpResponse(MakeResponse(state.range(0)), http_resp);
+    while (state.KeepRunning()) {
+        std::string resp;
+        MicroBench::ConstructHttpResponse(http_resp, resp);
+        DoNotOptimize(resp);
+    }
+    state.SetBytesProcessed(state.iterations() * http_resp.body.size());
+}
+MICRO_BENCH(BM_ConstructHttpResponse)->Range(512, 512 << 10);
+
+static void BM_ExtendHeader(BenchState& state) {
+    HttpResponse origin;
+    MicroBench::ParseHttpResponse(MakeResponse(512), origin);
+    origin.body.clear();
+    while (state.KeepRunning()) {
+        HttpResponse resp = origin;
+        MicroBench::ExtendHeader(resp, "X-Cache: HIT");
+        DoNotOptimize(resp.header_origin);
+    }
+}
+MICRO_BENCH(BM_ExtendHeader);
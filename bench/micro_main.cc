@@ -0,0 +1,215 @@
+/*
+ * micro-bench [--filter regex] [--min-time 0.5] [--max-range 1000000] [--json results.json]
+ *
+ * Runs every registered benchmark whose name(e.g. "BM_CacheGet/100000/threads:8")
+ * matches --filter. Arguments above --max-range are skipped, the 10M entry
+ * cache runs need several GB of memory so they are opt-in.
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <regex>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include "micro_bench.hpp"
+
+struct option longopts[] = {
+    {"filter", required_argument, 0, 0},
+    {"min-time", required_argument, 0, 1},
+    {"max-range", required_argument, 0, 2},
+    {"json", required_argument, 0, 3},
+    {0, 0, 0, 0}};
+
+struct BenchResult {
+    std::string name;
+    int64_t iterations;
+    double ns_per_op;
+    double items_per_second;
+    double bytes_per_second;
+};
+
+static std::vector<std::unique_ptr<Benchmark>>& Registry() {
+    static std::vector<std::unique_ptr<Benchmark>> registry;
+    return registry;
+}
+
+Benchmark* RegisterBenchmark(const char* name, BenchFunction fn) {
+    Registry().emplace_back(new Benchmark(name, fn));
+    return Registry().back().get();
+}
+
+struct BenchRunner {
+    double min_time = 0.5;
+    int64_t max_range = 1000000;
+    std::vector<BenchResult> results;
+
+    void Run(const std::regex& filter) {
+        for (auto& bench : Registry()) {
+            std::vector<int64_t> args = bench->args_;
+            std::vector<int> threads = bench->threads_;
+            if (args.empty()) {
+                args.push_back(-1);
+            }
+            if (threads.empty()) {
+                threads.push_back(1);
+            }
+            for (int64_t arg : args) {
+                if (arg > max_range) {
+                    continue;
+                }
+                std::string base = bench->name_;
+                std::vector<int64_t> range;
+                if (arg >= 0) {
+                    base += "/" + std::to_string(arg);
+                    range.push_back(arg);
+                }
+                bool prepared = false;
+                for (int thread_count : threads) {
+                    std::string name = base;
+                    if (bench->threads_.size() > 0) {
+                        name += "/threads:" + std::to_string(thread_count);
+                    }
+                    if (!std::regex_search(name, filter)) {
+                        continue;
+                    }
+                    if (!prepared && bench->setup_) {
+                        BenchState state(range, thread_count, 0, 0);
+                        bench->setup_(state);
+                    }
+                    prepared = true;
+                    runOne(*bench, name, range, thread_count);
+                }
+                if (prepared && bench->teardown_) {
+                    BenchState state(range, 1, 0, 0);
+                    bench->teardown_(state);
+                }
+            }
+        }
+    }
+
+    void runOne(Benchmark& bench, const std::string& name, const std::vector<int64_t>& range, int thread_count) {
+        int64_t iterations = 1;
+        while (true) {
+            std::vector<std::unique_ptr<BenchState>> states;
+            for (int i = 0; i < thread_count; ++i) {
+                states.emplace_back(new BenchState(range, thread_count, i, iterations));
+            }
+            double seconds = runThreads(bench, states);
+            bool done = seconds >= min_time || iterations >= 1000000000;
+            if (done) {
+                report(name, states, seconds);
+                return;
+            }
+            // Same growth rule as Google Benchmark: aim 40% past the target
+            double multiplier = seconds <= 0 ? 10 : min_time * 1.4 / seconds;
+            multiplier = std::min(10.0, std::max(multiplier, 1.0));
+            int64_t next = static_cast<int64_t>(iterations * multiplier);
+            iterations = next > iterations ? next : iterations + 1;
+        }
+    }
+
+    /// @return wall clock seconds of the slowest thread
+    double runThreads(Benchmark& bench, std::vector<std::unique_ptr<BenchState>>& states) {
+        if (states.size() == 1) {
+            bench.fn_(*states[0]);
+            return states[0]->ElapsedNs() / 1e9;
+        }
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::vector<std::thread> workers;
+        for (auto& state : states) {
+            BenchState* s = state.get();
+            workers.emplace_back([&bench, s, &ready, &go] {
+                ready++;
+                while (!go) {
+                    std::this_thread::yield();
+                }
+                bench.fn_(*s);
+            });
+        }
+        while (ready < static_cast<int>(states.size())) {
+            std::this_thread::yield();
+        }
+        go = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        int64_t slowest = 0;
+        for (auto& state : states) {
+            slowest = std::max(slowest, state->ElapsedNs());
+        }
+        return slowest / 1e9;
+    }
+
+    void report(const std::string& name, const std::vector<std::unique_ptr<BenchState>>& states, double seconds) {
+        int64_t items = 0, bytes = 0;
+        for (auto& state : states) {
+            items += state->items();
+            bytes += state->bytes();
+        }
+        BenchResult result;
+        result.name = name;
+        result.iterations = states[0]->iterations();
+        result.ns_per_op = seconds * 1e9 / result.iterations;
+        result.items_per_second = seconds > 0 ? items / seconds : 0;
+        result.bytes_per_second = seconds > 0 ? bytes / seconds : 0;
+        fprintf(stdout, "%-48s %12.1f ns %12lld", name.c_str(), result.ns_per_op, (long long)result.iterations);
+        if (items) {
+            fprintf(stdout, " %10.3fM items/s", result.items_per_second / 1e6);
+        }
+        if (bytes) {
+            fprintf(stdout, " %10.1fMB/s", result.bytes_per_second / (1 << 20));
+        }
+        fprintf(stdout, "\n");
+        fflush(stdout);
+        results.push_back(result);
+    }
+
+    bool WriteJson(const std::string& path) {
+        FILE* out = fopen(path.c_str(), "w");
+        if (!out) {
+            return false;
+        }
+        fprintf(out, "{\"benchmarks\":[");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"iterations\":%lld,\"ns_per_op\":%.2f,"
+                "\"items_per_second\":%.1f,\"bytes_per_second\":%.1f}",
+                i ? "," : "", r.name.c_str(), (long long)r.iterations, r.ns_per_op,
+                r.items_per_second, r.bytes_per_second);
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        return true;
+    }
+};
+
+int main(int argc, char *const argv[])
+{
+    int c = 0;
+    std::string filter = ".";
+    std::string json;
+    BenchRunner runner;
+    while ((c = getopt_long(argc, argv, "", longopts, 0)) != -1) {
+        switch (c)
+        {
+        case 0: filter = optarg; break;
+        case 1: runner.min_time = atof(optarg); break;
+        case 2: runner.max_range = strtoll(optarg, 0, 10); break;
+        case 3: json = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [--filter regex] [--min-time s] [--max-range n] [--json file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(stdout, "%-48s %15s %12s\n", "Benchmark", "Time", "Iterations");
+    runner.Run(std::regex(filter));
+    if (!json.empty() && !runner.WriteJson(json)) {
+        fprintf(stderr, "Write [%s] failed.\n", json.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+/*
+ * Mock origin for benchmarking caching-proxy.
+ *
+ * mock-origin --port 18080 [--body-size 1024 | --body-min 512 --body-max 65536]
+ *             [--latency-ms 0] [--chunked] [--cache-control "max-age=60"]
+ *             [--threads 8] [--capture traffic.cap]
+ *
+ * With --capture every url recorded by `caching-proxy --capture` gets the
+ * status, body size and caching headers origin sent when it was captured.
+ * Every request gets one response then the connection is closed, which is
+ * what NetClientUtil expects(Connection: close). Bodies are JSON so the same
+ * origin drives the HJson paths of the proxy.
+ */
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "capture.hpp"
+
+struct option longopts[] = {
+    {"port", required_argument, 0, 0},
+    {"body-size", required_argument, 0, 1},
+    {"body-min", required_argument, 0, 2},
+    {"body-max", required_argument, 0, 3},
+    {"latency-ms", required_argument, 0, 4},
+    {"chunked", no_argument, 0, 5},
+    {"cache-control", required_argument, 0, 6},
+    {"threads", required_argument, 0, 7},
+    {"capture", required_argument, 0, 8},
+    {0, 0, 0, 0}};
+
+struct MockConfig {
+    int port = 18080;
+    size_t body_min = 1024;
+    size_t body_max = 1024;
+    int latency_ms = 0;
+    bool chunked = false;
+    std::string cache_control;
+    int threads = 8;
+};
+
+// Captured origin reply per url
+struct CapturedReply {
+    size_t bytes;
+    uint16_t status_code;
+    std::string cache_headers;
+};
+
+static MockConfig config;
+static std::unordered_map<std::string, CapturedReply> replies;
+
+static bool LoadCapture(const char* path) {
+    std::vector<CaptureRecord> records;
+    if (!Capture::Load(path, records)) {
+        return false;
+    }
+    for (auto& record : records) {
+        auto it = replies.find(record.url);
+        // A miss saw the real origin reply, prefer it over hits
+        if (it == replies.end() || record.cache_status == CacheStatus::kMiss) {
+            replies[record.url] = CapturedReply{record.response_bytes, record.status_code, record.cache_headers};
+        }
+    }
+    fprintf(stdout, "mock-origin loaded %zu urls from %zu captured requests\n", replies.size(), records.size());
+    return true;
+}
+
+// {"url":"/path","data":"xxxx..."} padded to exactly `size` bytes when possible
+static void MakeBody(const std::string& url, size_t size, std::string& body) {
+    body = "{\"url\":\"" + url + "\",\"data\":\"";
+    size_t tail = 2;
+    if (body.size() + tail < size) {
+        body.append(size - body.size() - tail, 'x');
+    }
+    body.append("\"}");
+}
+
+static bool ReadRequest(int sock, std::string& url) {
+    char buffer[4096];
+    std::string req;
+    while (req.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = read(sock, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        req.append(buffer, n);
+        if (req.size() > 64 * 1024) {
+            return false;
+        }
+    }
+    size_t sp1 = req.find(' ');
+    size_t sp2 = req.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+        return false;
+    }
+    url = req.substr(sp1 + 1, sp2 - sp1 - 1);
+    return true;
+}
+
+static void WriteAll(int sock, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = write(sock, data.data() + off, data.size() - off);
+        if (n <= 0) {
+            return;
+        }
+        off += n;
+    }
+}
+
+static void Serve(int sock, std::mt19937_64& rng) {
+    std::string url;
+    if (!ReadRequest(sock, url)) {
+        close(sock);
+        return;
+    }
+    if (config.latency_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config.latency_ms));
+    }
+    size_t size = config.body_min;
+    if (config.body_max > config.body_min) {
+        size = config.body_min + rng() % (config.body_max - config.body_min + 1);
+    }
+    char buffer[256];
+    std::string resp;
+    auto captured = replies.find(url);
+    if (captured != replies.end()) {
+        size = captured->second.bytes;
+        snprintf(buffer, sizeof(buffer), "HTTP/1.1 %u %s\r\nConnection: close\r\n", captured->second.status_code,
+            captured->second.status_code == 200 ? "OK" : "Captured");
+        resp = buffer + captured->second.cache_headers;
+    } else {
+        resp = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n";
+        if (!config.cache_control.empty()) {
+            resp += "Cache-Control: " + config.cache_control + "\r\n";
+        }
+    }
+    std::string body;
+    MakeBody(url, size, body);
+    if (config.chunked) {
+        resp += "Transfer-Encoding: chunked\r\n\r\n";
+        // Split in 4 KB chunks like a streaming origin would
+        for (size_t off = 0; off < body.size(); off += 4096) {
+            size_t len = std::min<size_t>(4096, body.size() - off);
+            snprintf(buffer, sizeof(buffer), "%zx\r\n", len);
+            resp += buffer;
+            resp.append(body, off, len);
+            resp += "\r\n";
+        }
+        resp += "0\r\n\r\n";
+    } else {
+        snprintf(buffer, sizeof(buffer), "Content-Length: %zu\r\n\r\n", body.size());
+        resp += buffer;
+        resp += body;
+    }
+    WriteAll(sock, resp);
+    shutdown(sock, SHUT_WR);
+    close(sock);
+}
+
+int main(int argc, char *const argv[])
+{
+    int c = 0;
+    while ((c = getopt_long(argc, argv, "", longopts, 0)) != -1) {
+        switch (c)
+        {
+        case 0: config.port = atoi(optarg); break;
+        case 1: config.body_min = config.body_max = strtoull(optarg, 0, 10); break;
+        case 2: config.body_min = strtoull(optarg, 0, 10); break;
+        case 3: config.body_max = strtoull(optarg, 0, 10); break;
+        case 4: config.latency_ms = atoi(optarg); break;
+        case 5: config.chunked = true; break;
+        case 6: config.cache_control = optarg; break;
+        case 7: config.threads = std::max(1, atoi(optarg)); break;
+        case 8:
+            if (!LoadCapture(optarg)) {
+                fprintf(stderr, "Load capture [%s] failed.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s --port <port> [--body-size n | --body-min n --body-max n] "
+                "[--latency-ms n] [--chunked] [--cache-control v] [--threads n] [--capture file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (-1 == bind(sock, (sockaddr*)&addr, sizeof(addr)) || -1 == listen(sock, SOMAXCONN)) {
+        fprintf(stderr, "Bind/listen on %d failed.\n", config.port);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "mock-origin listening on 127.0.0.1:%d\n", config.port);
+    fflush(stdout);
+
+    // Accept on every thread, the kernel spreads connections
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.threads; ++i) {
+        workers.emplace_back([sock, i](){
+            std::mt19937_64 rng(i + 1);
+            while (true) {
+                int clisock = accept(sock, 0, 0);
+                if (clisock == -1) {
+                    continue;
+                }
+                Serve(clisock, rng);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/*
+ * Replays a `caching-proxy --capture` file against a proxy.
+ *
+ * replay --capture traffic.cap --target 127.0.0.1:18081
+ *        [--speed 1] [--connections 64] [--metrics-path /__cps/metrics]
+ *        [--label name] [--json results.jsonl]
+ *
+ * Requests go out at their captured arrival times divided by --speed(0 sends
+ * back to back), latency is taken from the scheduled time. Hit ratio comes
+ * from X-Cache, origin bytes from the proxy's metrics before and after.
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "capture.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct option longopts[] = {
+    {"capture", required_argument, 0, 0},
+    {"target", required_argument, 0, 1},
+    {"speed", required_argument, 0, 2},
+    {"connections", required_argument, 0, 3},
+    {"metrics-path", required_argument, 0, 4},
+    {"label", required_argument, 0, 5},
+    {"json", required_argument, 0, 6},
+    {0, 0, 0, 0}};
+
+struct ReplayConfig {
+    std::string capture;
+    std::string host = "127.0.0.1";
+    int port = 18081;
+    double speed = 1;
+    int connections = 64;
+    std::string metrics_path = "/__cps/metrics";
+    std::string label = "replay";
+    std::string json;
+};
+
+struct ThreadResult {
+    std::vector<uint32_t> latency_us;
+    uint64_t errors = 0;
+    uint64_t hits = 0;
+    uint64_t bytes = 0;
+};
+
+static ReplayConfig config;
+
+// One request per connection, returns the whole response
+static bool Send(const std::string& req, std::string& resp) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return false;
+    }
+    struct timeval tv;
+    tv.tv_sec = 10;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr))
+        || write(sock, req.data(), req.size()) != static_cast<ssize_t>(req.size())) {
+        close(sock);
+        return false;
+    }
+    char buffer[16384];
+    ssize_t n;
+    while ((n = read(sock, buffer, sizeof(buffer))) > 0) {
+        resp.append(buffer, n);
+    }
+    close(sock);
+    return n == 0 && resp.compare(0, 5, "HTTP/") == 0;
+}
+
+// cps_origin_bytes_in_total from the proxy, -1 if unavailable
+static int64_t OriginBytes() {
+    std::string resp;
+    if (config.metrics_path.empty()
+        || !Send("GET " + config.metrics_path + " HTTP/1.1\r\nHost: replay\r\n\r\n", resp)) {
+        return -1;
+    }
+    const char name[] = "\ncps_origin_bytes_in_total ";
+    size_t pos = resp.find(name);
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    return strtoll(resp.c_str() + pos + sizeof(name) - 1, 0, 10);
+}
+
+static std::string BuildRequest(const CaptureRecord& record) {
+    std::string req = record.method + " " + record.url + " HTTP/1.1\r\n" + record.headers;
+    if (record.headers.find("Host:") == std::string::npos) {
+        req += "Host: " + config.host + "\r\n";
+    }
+    return req + "\r\n";
+}
+
+static void Run(const std::vector<CaptureRecord>* records, std::atomic<size_t>* next, Clock::time_point start,
+    ThreadResult& result) {
+    size_t i;
+    while ((i = (*next)++) < records->size()) {
+        const CaptureRecord& record = (*records)[i];
+        Clock::time_point scheduled = Clock::now();
+        if (config.speed > 0) {
+            scheduled = start + std::chrono::microseconds(static_cast<int64_t>(record.offset_us / config.speed));
+            std::this_thread::sleep_until(scheduled);
+        }
+        std::string resp;
+        if (!Send(BuildRequest(record), resp)) {
+            result.errors++;
+            continue;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - scheduled).count();
+        result.latency_us.push_back(static_cast<uint32_t>(std::min<int64_t>(us, UINT32_MAX)));
+        size_t head_end = resp.find("\r\n\r\n");
+        std::string head = resp.substr(0, head_end);
+        result.hits += head.find("X-Cache: HIT") != std::string::npos ? 1 : 0;
+        result.bytes += resp.size();
+    }
+}
+
+static uint32_t Percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+}
+
+int main(int argc, char *const argv[])
+{
+    int c = 0;
+    std::string target;
+    while ((c = getopt_long(argc, argv, "", longopts, 0)) != -1) {
+        switch (c)
+        {
+        case 0: config.capture = optarg; break;
+        case 1: target = optarg; break;
+        case 2: config.speed = atof(optarg); break;
+        case 3: config.connections = std::max(1, atoi(optarg)); break;
+        case 4: config.metrics_path = optarg; break;
+        case 5: config.label = optarg; break;
+        case 6: config.json = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s --capture file --target host:port [--speed x] [--connections n] "
+                "[--metrics-path path] [--label name] [--json file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!target.empty()) {
+        size_t colon = target.rfind(':');
+        config.host = target.substr(0, colon);
+        if (colon != std::string::npos) {
+            config.port = atoi(target.c_str() + colon + 1);
+        }
+    }
+    std::vector<CaptureRecord> records;
+    if (!Capture::Load(config.capture, records)) {
+        fprintf(stderr, "Load capture [%s] failed.\n", config.capture.c_str());
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int64_t origin_before = OriginBytes();
+    std::atomic<size_t> next(0);
+    std::vector<ThreadResult> results(config.connections);
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int i = 0; i < config.connections; ++i) {
+        workers.emplace_back(Run, &records, &next, start, std::ref(results[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    int64_t origin_after = OriginBytes();
+
+    std::vector<uint32_t> latency;
+    uint64_t errors = 0, hits = 0, bytes = 0;
+    for (auto& r : results) {
+        latency.insert(latency.end(), r.latency_us.begin(), r.latency_us.end());
+        errors += r.errors;
+        hits += r.hits;
+        bytes += r.bytes;
+    }
+    std::sort(latency.begin(), latency.end());
+    // Hit ratio the proxy had while capturing, to compare against
+    uint64_t captured_hits = 0;
+    for (auto& record : records) {
+        captured_hits += record.cache_status == CacheStatus::kHit || record.cache_status == CacheStatus::kNegativeHit;
+    }
+
+    char line[1024];
+    snprintf(line, sizeof(line),
+        "{\"label\":\"%s\",\"capture\":\"%s\",\"speed\":%.2f,\"requests\":%zu,\"errors\":%llu,"
+        "\"duration_s\":%.3f,\"throughput_rps\":%.1f,\"hit_ratio\":%.4f,\"captured_hit_ratio\":%.4f,"
+        "\"client_bytes\":%llu,\"origin_bytes\":%lld,"
+        "\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}",
+        config.label.c_str(), config.capture.c_str(), config.speed, latency.size(), (unsigned long long)errors,
+        elapsed, latency.size() / elapsed,
+        latency.empty() ? 0.0 : static_cast<double>(hits) / latency.size(),
+        records.empty() ? 0.0 : static_cast<double>(captured_hits) / records.size(),
+        (unsigned long long)bytes,
+        (long long)(origin_before < 0 || origin_after < 0 ? -1 : origin_after - origin_before),
+        Percentile(latency, 0.5), Percentile(latency, 0.9), Percentile(latency, 0.99),
+        Percentile(latency, 0.999), latency.empty() ? 0 : latency.back());
+    fprintf(stdout, "%s\n", line);
+    if (!config.json.empty()) {
+        FILE* out = fopen(config.json.c_str(), "a");
+        if (!out) {
+            fprintf(stderr, "Open [%s] failed.\n", config.json.c_str());
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "%s\n", line);
+        fclose(out);
+    }
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
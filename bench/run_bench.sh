@@ -0,0 +1,49 @@
+#!/bin/sh
+# End-to-end benchmark: mock origin <- caching-proxy <- load generator.
+# Results are appended as one JSON line per run to bench/results/<time>-<sha>.json
+#
+# Knobs(environment): DURATION, CONNECTIONS, RATE, BODY_SIZE, LATENCY_MS
+# CAPTURE=<file> replays a `caching-proxy --capture` file at SPEED(default 1)
+# instead of the synthetic workloads, origin replies come from the capture.
+set -e
+
+cd "$(dirname "$0")/.."
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-16}
+RATE=${RATE:-2000}
+BODY_SIZE=${BODY_SIZE:-4096}
+LATENCY_MS=${LATENCY_MS:-0}
+ORIGIN_PORT=${ORIGIN_PORT:-18080}
+PROXY_PORT=${PROXY_PORT:-18081}
+SPEED=${SPEED:-1}
+
+SHA=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p bench/results
+OUT=bench/results/$(date -u +%Y%m%dT%H%M%SZ)-$SHA.json
+
+ORIGIN_ARGS="--port $ORIGIN_PORT --body-size $BODY_SIZE --latency-ms $LATENCY_MS"
+if [ -n "$CAPTURE" ]; then
+    ORIGIN_ARGS="$ORIGIN_ARGS --capture $CAPTURE"
+fi
+bin/mock-origin $ORIGIN_ARGS &
+ORIGIN_PID=$!
+bin/caching-proxy --port $PROXY_PORT --origin http://127.0.0.1:$ORIGIN_PORT \
+    --keep-alive 600 --access-log off > /dev/null &
+PROXY_PID=$!
+trap 'kill $PROXY_PID $ORIGIN_PID 2>/dev/null; wait 2>/dev/null' EXIT INT TERM
+sleep 1
+
+if [ -n "$CAPTURE" ]; then
+    bin/replay --capture "$CAPTURE" --target 127.0.0.1:$PROXY_PORT --speed $SPEED --json $OUT || true
+    echo "Results written to $OUT"
+    exit 0
+fi
+
+LOAD="bin/load-gen --target 127.0.0.1:$PROXY_PORT --duration $DURATION --json $OUT"
+$LOAD --workload hit --keys 100 --connections $CONNECTIONS || true
+$LOAD --workload miss --connections $CONNECTIONS || true
+$LOAD --workload mixed --keys 10000 --zipf 0.99 --connections $CONNECTIONS || true
+$LOAD --workload mixed --keys 10000 --zipf 0.99 --connections $CONNECTIONS --rate $RATE \
+    --label mixed-open || true
+
+echo "Results written to $OUT"
@@ -0,0 +1,237 @@
+/*
+ * Syscall counter for benchmarking caching-proxy, strace -c without strace.
+ *
+ * syscount [--label name] [--json results.jsonl] -- bin/caching-proxy ...
+ *
+ * Runs the command under ptrace, following every thread and child, and
+ * counts syscall entries per syscall. SIGUSR1 zeroes the counts so startup is
+ * left out, SIGUSR2 writes the counts so far(stdout, and one JSON line to
+ * --json), SIGINT/SIGTERM are passed on to the command and the counts are
+ * written once it exits. Signals are seen at the next syscall of the command,
+ * which the 3s wakeups of the proxy bound.
+ *
+ * Every syscall becomes two stops, the command runs several times slower:
+ * measure throughput without it.
+ */
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+struct option longopts[] = {
+    {"label", required_argument, 0, 0},
+    {"json", required_argument, 0, 1},
+    {0, 0, 0, 0}};
+
+// Head of the kernel's struct ptrace_syscall_info(5.3+), older glibc headers
+// have the request but not the struct
+struct SyscallInfo {
+    uint8_t op;
+    uint8_t pad[3];
+    uint32_t arch;
+    uint64_t instruction_pointer;
+    uint64_t stack_pointer;
+    uint64_t nr;
+    uint64_t args[6];
+};
+
+const uint8_t kSyscallEntry = 1;
+
+#define SYSCALL_NAME(name) {SYS_##name, #name}
+
+// What the proxy and its libraries call, the rest print as their number
+static const std::map<long, const char*> kNames = {
+    SYSCALL_NAME(read), SYSCALL_NAME(write), SYSCALL_NAME(readv), SYSCALL_NAME(writev),
+    SYSCALL_NAME(pread64), SYSCALL_NAME(pwrite64), SYSCALL_NAME(openat), SYSCALL_NAME(close),
+    SYSCALL_NAME(fstat), SYSCALL_NAME(newfstatat), SYSCALL_NAME(statx), SYSCALL_NAME(lseek),
+    SYSCALL_NAME(getdents64), SYSCALL_NAME(mmap), SYSCALL_NAME(munmap), SYSCALL_NAME(mprotect),
+    SYSCALL_NAME(madvise), SYSCALL_NAME(brk), SYSCALL_NAME(ioctl), SYSCALL_NAME(fcntl),
+    SYSCALL_NAME(pipe2), SYSCALL_NAME(dup3), SYSCALL_NAME(socket), SYSCALL_NAME(connect),
+    SYSCALL_NAME(accept), SYSCALL_NAME(accept4), SYSCALL_NAME(bind), SYSCALL_NAME(listen),
+    SYSCALL_NAME(shutdown), SYSCALL_NAME(sendto), SYSCALL_NAME(recvfrom), SYSCALL_NAME(sendmsg),
+    SYSCALL_NAME(recvmsg), SYSCALL_NAME(sendfile), SYSCALL_NAME(splice), SYSCALL_NAME(getsockname),
+    SYSCALL_NAME(getpeername), SYSCALL_NAME(setsockopt), SYSCALL_NAME(getsockopt), SYSCALL_NAME(ppoll),
+    SYSCALL_NAME(pselect6), SYSCALL_NAME(epoll_create1), SYSCALL_NAME(epoll_ctl), SYSCALL_NAME(epoll_pwait),
+    SYSCALL_NAME(epoll_pwait2), SYSCALL_NAME(eventfd2), SYSCALL_NAME(io_uring_setup),
+    SYSCALL_NAME(io_uring_enter), SYSCALL_NAME(io_uring_register), SYSCALL_NAME(futex),
+    SYSCALL_NAME(nanosleep), SYSCALL_NAME(clock_nanosleep), SYSCALL_NAME(clock_gettime),
+    SYSCALL_NAME(gettimeofday), SYSCALL_NAME(sched_yield), SYSCALL_NAME(getpid), SYSCALL_NAME(gettid),
+    SYSCALL_NAME(getrandom), SYSCALL_NAME(uname), SYSCALL_NAME(prlimit64), SYSCALL_NAME(rt_sigaction),
+    SYSCALL_NAME(rt_sigprocmask), SYSCALL_NAME(rt_sigreturn), SYSCALL_NAME(clone), SYSCALL_NAME(clone3),
+    SYSCALL_NAME(execve), SYSCALL_NAME(wait4), SYSCALL_NAME(exit), SYSCALL_NAME(exit_group),
+    SYSCALL_NAME(set_tid_address), SYSCALL_NAME(set_robust_list), SYSCALL_NAME(rseq),
+    SYSCALL_NAME(unlinkat), SYSCALL_NAME(renameat), SYSCALL_NAME(fsync), SYSCALL_NAME(fdatasync),
+#ifdef SYS_open
+    // Legacy calls only some architectures have
+    SYSCALL_NAME(open), SYSCALL_NAME(stat), SYSCALL_NAME(poll), SYSCALL_NAME(select),
+    SYSCALL_NAME(epoll_wait), SYSCALL_NAME(unlink), SYSCALL_NAME(rename), SYSCALL_NAME(dup2),
+    SYSCALL_NAME(arch_prctl),
+#endif
+};
+
+static volatile sig_atomic_t reset_requested = 0;
+static volatile sig_atomic_t dump_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void OnSignal(int sig) {
+    if (sig == SIGUSR1) {
+        reset_requested = 1;
+    } else if (sig == SIGUSR2) {
+        dump_requested = 1;
+    } else {
+        stop_requested = 1;
+    }
+}
+
+static std::string SyscallName(long nr) {
+    auto it = kNames.find(nr);
+    return it != kNames.end() ? it->second : "sys_" + std::to_string(nr);
+}
+
+static void Dump(const std::map<long, uint64_t>& counts, const std::string& label, const std::string& json) {
+    std::vector<std::pair<uint64_t, long>> sorted;
+    uint64_t total = 0;
+    for (auto& c : counts) {
+        sorted.emplace_back(c.second, c.first);
+        total += c.second;
+    }
+    std::sort(sorted.rbegin(), sorted.rend());
+    fprintf(stdout, "%-20s %12s\n", "syscall", "calls");
+    std::string by_name;
+    for (auto& s : sorted) {
+        std::string name = SyscallName(s.second);
+        fprintf(stdout, "%-20s %12llu\n", name.c_str(), (unsigned long long)s.first);
+        by_name += (by_name.empty() ? "\"" : ",\"") + name + "\":" + std::to_string(s.first);
+    }
+    fprintf(stdout, "%-20s %12llu\n", "total", (unsigned long long)total);
+    fflush(stdout);
+    if (json.empty()) {
+        return;
+    }
+    FILE* out = fopen(json.c_str(), "a");
+    if (!out) {
+        fprintf(stderr, "Open [%s] failed.\n", json.c_str());
+        return;
+    }
+    fprintf(out, "{\"label\":\"%s\",\"syscalls\":%llu,\"by_name\":{%s}}\n",
+        label.c_str(), (unsigned long long)total, by_name.c_str());
+    fclose(out);
+}
+
+int main(int argc, char *const argv[])
+{
+    int c = 0;
+    std::string label = "syscount";
+    std::string json;
+    while ((c = getopt_long(argc, argv, "+", longopts, 0)) != -1) {
+        switch (c)
+        {
+        case 0: label = optarg; break;
+        case 1: json = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [--label name] [--json file] -- command [args...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [--label name] [--json file] -- command [args...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pid_t child = fork();
+    if (child == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP);
+        execvp(argv[optind], argv + optind);
+        perror("execvp");
+        _exit(127);
+    }
+
+    // No SA_RESTART, waitpid comes back with EINTR
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, 0);
+    sigaction(SIGUSR2, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    int status = 0;
+    if (waitpid(child, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        fprintf(stderr, "Child did not stop.\n");
+        return EXIT_FAILURE;
+    }
+    ptrace(PTRACE_SETOPTIONS, child, 0,
+        PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+    std::map<long, uint64_t> counts;
+    // Threads and children not seen yet start with a SIGSTOP of their own
+    std::set<pid_t> tasks = {child};
+    int exit_code = EXIT_FAILURE;
+    while (!tasks.empty()) {
+        if (reset_requested) {
+            reset_requested = 0;
+            counts.clear();
+        }
+        if (dump_requested) {
+            dump_requested = 0;
+            Dump(counts, label, json);
+        }
+        if (stop_requested) {
+            stop_requested = 0;
+            kill(child, SIGINT);
+        }
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            tasks.erase(tid);
+            if (tid == child) {
+                exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            }
+            continue;
+        }
+        if (!WIFSTOPPED(status)) {
+            continue;
+        }
+        int sig = WSTOPSIG(status);
+        int deliver = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            SyscallInfo info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) > 0 && info.op == kSyscallEntry) {
+                counts[static_cast<long>(info.nr)]++;
+            }
+        } else if (sig == SIGTRAP && (status >> 16) != 0) {
+            // clone/fork/exec event, a new task shows up with its own stop
+        } else if (sig == SIGSTOP && tasks.insert(tid).second) {
+            // First stop of a new thread
+        } else {
+            deliver = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, deliver);
+    }
+    Dump(counts, label, json);
+    return exit_code;
+}
@@ -0,0 +1,99 @@
+#ifndef ACCESS_LOG_HPP
+#define ACCESS_LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "spsc_ring.hpp"
+#include "metrics.hpp"
+
+#define ACCESS_LOG_URL_SIZE 256
+#define ACCESS_LOG_LINE_SIZE 512
+#define ACCESS_LOG_BATCH 64
+
+enum class CacheStatus : uint8_t {
+    kHit,
+    kMiss,
+    kNegativeHit,
+    kAdmin,
+    kBypass
+};
+
+enum class AccessLogPolicy {
+    kDrop,  // drop the record when the thread's ring is full
+    kBlock  // wait for the writer to make room
+};
+
+// Fixed size so ring slots never allocate, long urls are truncated
+struct AccessRecord {
+    int64_t timestamp_us;
+    char method[8];
+    char url[ACCESS_LOG_URL_SIZE];
+    CacheStatus cache_status;
+    uint16_t status_code;
+    uint64_t bytes;
+    uint32_t stage_us[static_cast<int>(Stage::kStageCount)];
+};
+
+class AccessLog {
+public:
+    AccessLog(const AccessLog&) = delete;
+    AccessLog(const AccessLog&&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&&) = delete;
+    virtual ~AccessLog();
+
+    static AccessLog& GetInstance();
+
+    /// @brief Init
+    /// @param path log file, "-" for stdout, empty disables
+    /// @param capacity records buffered per thread
+    /// @param policy what a full ring does
+    /// @param sample log 1 of every `sample` requests, 5xx always logged
+    /// @return false if `path` can't be opened
+    bool Init(const std::string& path = "-", size_t capacity = 1024,
+              AccessLogPolicy policy = AccessLogPolicy::kDrop, int sample = 1);
+
+    void Start();
+
+    /// @brief Drain what is buffered and stop the writer.
+    void Stop();
+
+    /// @brief Hot path, never does I/O.
+    void Log(const AccessRecord& record);
+
+    bool Enabled() const;
+
+private:
+    AccessLog();
+
+    SpscRing<AccessRecord>* ring();
+
+    size_t drain();
+
+    void flush(struct iovec* iov, int cnt);
+
+    static int format(const AccessRecord& record, char* buf, size_t n);
+
+private:
+    int fd_;
+    size_t capacity_;
+    AccessLogPolicy policy_;
+    int sample_;
+    std::atomic<bool> running_;
+    std::mutex mtx_;
+    std::vector<SpscRing<AccessRecord>*> rings_;
+    std::thread t_;
+};
+
+#endif // ACCESS_LOG_HPP
@@ -0,0 +1,67 @@
+#ifndef CACHE_KEY_HPP
+#define CACHE_KEY_HPP
+
+#include <string>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <strings.h>
+
+using HeaderMap = std::unordered_map<std::string, std::string>;
+
+class CacheKey {
+public:
+    CacheKey(const CacheKey&) = delete;
+    CacheKey(const CacheKey&&) = delete;
+    CacheKey& operator=(const CacheKey&) = delete;
+    CacheKey& operator=(const CacheKey&&) = delete;
+    virtual ~CacheKey();
+
+    static CacheKey& GetInstance();
+
+    /// @brief Init
+    /// @param sort_query sort query params by name then value
+    /// @param strip_params comma separated params dropped from the key, e.g. "utm_source,fbclid"
+    /// @param lowercase_host lowercase scheme and host of absolute-form urls
+    void Init(bool sort_query = false, const std::string& strip_params = "", bool lowercase_host = false);
+
+    /// @brief Build the primary key of a request url.
+    std::string Normalize(const std::string& url) const;
+
+    /// @brief Build the secondary key of a variant from the request headers
+    ///        the response varies on.
+    /// @param primary primary key
+    /// @param vary normalized Vary field, see NormalizeVary
+    std::string Secondary(const std::string& primary, const std::string& vary, const HeaderMap& header) const;
+
+    /// @brief Lowercase, dedupe and sort the field names of a Vary header.
+    /// @return "*" if the response varies on everything
+    static std::string NormalizeVary(const std::string& vary);
+
+    /// @brief Case-insensitive header lookup.
+    static const std::string* FindHeader(const HeaderMap& header, const char* name);
+
+    /// @brief Remove query param `name` from `url`, the first one if repeated.
+    /// @param value its value, percent-decoded
+    /// @return false if `url` has no such param
+    static bool TakeParam(std::string& url, const char* name, std::string& value);
+
+private:
+    CacheKey();
+
+    static std::string toLower(const std::string& s);
+
+    static std::string trim(const std::string& s);
+
+    static void split(const std::string& s, char sep, std::vector<std::string>& out);
+
+private:
+    bool sort_query_;
+    bool lowercase_host_;
+    std::set<std::string> strip_params_;
+};
+
+#endif // CACHE_KEY_HPP
@@ -6,6 +6,12 @@
 #include <mutex>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include "metrics.hpp"
+
+struct HJson;
 
 using TimePoint = std::chrono::steady_clock::time_point;
 
@@ -13,6 +19,31 @@ struct TMDBCache {
     std::string dest_url;
     std::string cache_content;
     TimePoint last_active;
+    // Origin status line and header block replayed on hit
+    std::string status_code;
+    std::string status_msg;
+    std::string header_origin;
+    // Negative entry(404/410/upstream failure), expires at `expire_at`
+    // regardless of activity.
+    bool negative;
+    TimePoint expire_at;
+    // Non-empty on a primary key whose variants live under secondary keys,
+    // holds the normalized Vary field names.
+    std::string vary;
+    // Surrogate-Key tags for targeted purge
+    std::vector<std::string> tags;
+    // Parsed JSON body, owning the arena it lives in. Indexed before it is
+    // cached and read-only after, so copies share it across threads.
+    std::shared_ptr<HJson> json;
+    size_t json_bytes;
+};
+
+struct CacheStats {
+    size_t entries;
+    size_t negative_entries;
+    size_t bytes;
+    size_t max_bytes;
+    int expires;
 };
 
 class CacheTimer {
@@ -36,18 +67,68 @@ public:
 
     std::string GetCache(const std::string& url);
 
+    /// @brief Lookup a cache entry, negative entries included.
+    /// @return true if hit
+    bool GetCache(const std::string& url, TMDBCache& cache);
+
     void KeepCacheAlive(const std::string& url, const std::string& content = "");
 
+    /// @brief Refresh the last active time of an entry after a hit. Unlike
+    ///        KeepCacheAlive never inserts, an entry purged or evicted since
+    ///        the lookup stays gone.
+    /// @return false if `url` is no longer cached
+    bool TouchCache(const std::string& url);
+
+    /// @brief Insert or replace a positive entry.
+    void KeepCacheAlive(const std::string& url, const TMDBCache& cache);
+
+    /// @brief Insert or replace a negative entry living `ttl` seconds.
+    void KeepNegativeCache(const std::string& url, const TMDBCache& cache, int ttl);
+
     void ClearCache();
 
+    /// @brief Purge `url` and all of its Vary variants.
+    /// @return number of entries purged
+    size_t PurgeUrl(const std::string& url);
+
+    size_t PurgePrefix(const std::string& prefix);
+
+    size_t PurgeTag(const std::string& tag);
+
+    /// @brief Change expire time(s) of inactive entries.
+    void SetExpires(int expires);
+
+    /// @brief Byte budget, least recently active entries are evicted beyond it.
+    /// @param max_bytes 0 for unlimited
+    void SetMaxBytes(size_t max_bytes);
+
+    CacheStats GetStats();
+
 private:
+    friend struct MicroBench;
+
     CacheTimer();
 
     void checkInactiveCache();
 
+    void insertCache(const std::string& url, const TMDBCache& cache);
+
+    void eraseCache(std::map<std::string, TMDBCache>::iterator it);
+
+    void evictCache();
+
+    static void eraseIndex(std::multimap<TimePoint, std::string>& index, TimePoint tp, const std::string& url);
+
+    static size_t cacheBytes(const TMDBCache& cache);
+
 private:
-    std::map<TimePoint, std::string> time_map_;
+    std::multimap<TimePoint, std::string> time_map_;
+    std::multimap<TimePoint, std::string> negative_map_;
     std::map<std::string, TMDBCache> cache_map_;
+    std::map<std::string, std::set<std::string>> tag_map_;
+    size_t total_bytes_;
+    size_t max_bytes_;
+    size_t negative_entries_;
     std::chrono::seconds check_interval_;
     std::chrono::seconds expire_interval_;
     bool running_;
@@ -0,0 +1,70 @@
+#ifndef CACHE_WARMER_HPP
+#define CACHE_WARMER_HPP
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+struct WarmProgress {
+    size_t total;
+    size_t done;
+    size_t failed;
+    bool running;
+};
+
+class CacheWarmer {
+public:
+    CacheWarmer(const CacheWarmer&) = delete;
+    CacheWarmer(const CacheWarmer&&) = delete;
+    CacheWarmer& operator=(const CacheWarmer&) = delete;
+    CacheWarmer& operator=(const CacheWarmer&&) = delete;
+    virtual ~CacheWarmer();
+
+    static CacheWarmer& GetInstance();
+
+    /// @brief Init
+    /// @param concurrency origin fetches in flight
+    /// @param rate fetches per second, 0 for unlimited
+    void Init(int concurrency = 4, int rate = 50);
+
+    /// @brief Prefetch every url of `path` in background. `path` is either a
+    ///        url list(one per line) or an access log.
+    /// @return false if a warm-up is running or `path` can't be read
+    bool Start(const std::string& path);
+
+    void Stop();
+
+    WarmProgress GetProgress();
+
+private:
+    CacheWarmer();
+
+    void run(std::vector<std::string> urls);
+
+    void waitRate();
+
+    void reportProgress();
+
+    static bool parseLine(const std::string& line, std::string& url);
+
+private:
+    int concurrency_;
+    int rate_;
+    std::atomic<bool> running_;
+    std::atomic<bool> stopping_;
+    std::atomic<size_t> total_;
+    std::atomic<size_t> done_;
+    std::atomic<size_t> failed_;
+    std::mutex mtx_;
+    std::chrono::steady_clock::time_point next_slot_;
+    std::thread t_;
+};
+
+#endif // CACHE_WARMER_HPP
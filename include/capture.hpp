@@ -0,0 +1,101 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include "access_log.hpp"
+
+/*
+ * Traffic capture file, little endian:
+ *
+ *   CaptureFileHeader
+ *   { CaptureRecordHeader, method, url, request headers, cache headers }...
+ *
+ * Request headers are the client's header block("Name: value\r\n"...),
+ * cache headers the caching related subset of the response(Cache-Control,
+ * Expires, ETag, Last-Modified, Vary, Surrogate-Key, Content-Type).
+ * Credentials(Authorization, Cookie, Proxy-Authorization) are recorded as
+ * CAPTURE_REDACTED, and the file is only readable by its owner.
+ */
+#define CAPTURE_MAGIC 0x50414343 // "CCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_REDACTED "[redacted]"
+
+struct CaptureFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Wall clock of the first record offset
+    int64_t start_unix_us;
+};
+
+struct CaptureRecordHeader {
+    // Arrival, microseconds since capture start
+    uint64_t offset_us;
+    // Response body bytes(what origin sent on a miss)
+    uint32_t response_bytes;
+    uint16_t status_code;
+    uint8_t cache_status;
+    uint8_t method_len;
+    uint16_t url_len;
+    uint16_t headers_len;
+    uint16_t cache_headers_len;
+    uint16_t reserved;
+};
+
+struct CaptureRecord {
+    uint64_t offset_us;
+    uint32_t response_bytes;
+    uint16_t status_code;
+    CacheStatus cache_status;
+    std::string method;
+    std::string url;
+    std::string headers;
+    std::string cache_headers;
+};
+
+class Capture {
+public:
+    Capture(const Capture&) = delete;
+    Capture(const Capture&&) = delete;
+    Capture& operator=(const Capture&) = delete;
+    Capture& operator=(const Capture&&) = delete;
+    virtual ~Capture();
+
+    static Capture& GetInstance();
+
+    /// @brief Start capturing into `path`, truncated, mode 0600. Empty disables.
+    /// @return false if `path` can't be opened
+    bool Init(const std::string& path);
+
+    bool Enabled() const { return out_ != nullptr; }
+
+    /// @brief Append one request, thread safe. Oversized fields are truncated.
+    void Record(CaptureRecord& record);
+
+    /// @brief Flush and close the capture file.
+    void Stop();
+
+    /// @brief True for request headers carrying credentials, recorded as CAPTURE_REDACTED.
+    static bool IsSecretHeader(const std::string& name);
+
+    /// @brief Keep only the caching related lines of a header block.
+    static void FilterCacheHeaders(const std::string& header_block, std::string& cache_headers);
+
+    /// @brief Load a whole capture file.
+    /// @return false if the file is missing or malformed
+    static bool Load(const std::string& path, std::vector<CaptureRecord>& records);
+
+private:
+    Capture();
+
+private:
+    std::mutex mtx_;
+    FILE* out_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif // CAPTURE_HPP
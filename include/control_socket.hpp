@@ -0,0 +1,83 @@
+#ifndef CONTROL_SOCKET_HPP
+#define CONTROL_SOCKET_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CONTROL_SOCKET "/tmp/net_cache_server.sock"
+#define CONTROL_MAGIC 0x43505343u // "CPSC"
+#define CONTROL_MAX_PAYLOAD (64 * 1024)
+
+/*
+ * Wire format, host byte order(the socket never leaves the machine):
+ *
+ *   | magic u32 | op u8 | status u8 | reserved u16 | length u32 | payload |
+ *
+ * Request and response share the header, a response echoes the op.
+ */
+enum class ControlOp : uint8_t {
+    kClearCache     = 1,
+    kPurgeUrl       = 2, // payload: url
+    kPurgePrefix    = 3, // payload: key prefix
+    kPurgeTag       = 4, // payload: surrogate tag
+    kStats          = 5, // response payload: ControlStats
+    kSetTtl         = 6, // payload: u32 seconds
+    kSetNegativeTtl = 7, // payload: u32 seconds
+    kSetMaxBytes    = 8, // payload: u64 bytes, 0 for unlimited
+    kWarm           = 9  // payload: absolute path of a url list or access log
+};
+
+enum class ControlStatus : uint8_t {
+    kOk         = 0,
+    kBadRequest = 1,
+    kBusy       = 2
+};
+
+struct ControlHeader {
+    uint32_t magic;
+    uint8_t  op;
+    uint8_t  status;
+    uint16_t reserved;
+    uint32_t length;
+};
+
+struct ControlStats {
+    uint64_t entries;
+    uint64_t negative_entries;
+    uint64_t bytes;
+    uint64_t max_bytes;
+    uint32_t ttl;
+    uint32_t negative_ttl;
+    uint64_t warm_total;
+    uint64_t warm_done;
+    uint64_t warm_failed;
+};
+
+class ControlSocket {
+public:
+    /// @brief Bind and listen on `path`, replacing a stale socket file.
+    /// @return listening fd or -1
+    static int Listen(const char* path = CONTROL_SOCKET);
+
+    /// @return connected fd or -1 if no server listens on `path`
+    static int Connect(const char* path = CONTROL_SOCKET);
+
+    static bool Send(int fd, ControlOp op, ControlStatus status, const std::string& payload);
+
+    static bool Recv(int fd, ControlHeader& header, std::string& payload);
+
+    /// @brief One request/response round trip on a fresh connection.
+    static bool Request(ControlOp op, const std::string& payload, ControlHeader& header, std::string& resp);
+
+private:
+    static bool readFull(int fd, char* buf, size_t n);
+
+    static bool writeFull(int fd, const char* buf, size_t n);
+};
+
+#endif // CONTROL_SOCKET_HPP
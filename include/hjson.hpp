@@ -4,7 +4,12 @@
 #include <cstring>
 #include <cmath>
 #include <climits>
+#include <cstdint>
 #include <cstdio>
+#include <sys/uio.h>
+#if defined(__SSE2__) && !defined(HJSON_NO_SIMD)
+#include <immintrin.h>
+#endif
 
 #define HJSON_MAJOR_VERSION 1
 #define HJSON_MINOR_VERSION 0
@@ -18,9 +23,30 @@
 
 #define DBL_EPSILON __DBL_EPSILON__
 
-#define BUFFER_SIZE 32
+#define BUFFER_SIZE 256
+// Chunk size of iovec chains, and the shortest string a chain references
+// from the tree instead of copying
+#define HJSON_CHAIN_CHUNK (16 * 1024)
+#define HJSON_CHAIN_DIRECT 512
 
-static const char* ep = nullptr;
+// First arena block, later ones double up to HJSON_ARENA_MAX_BLOCK
+#define HJSON_ARENA_BLOCK 4096
+#define HJSON_ARENA_MAX_BLOCK (1 << 20)
+
+// Parsed objects/arrays with this many children get a lookup index
+#define HJSON_INDEX_MIN 16
+
+// Nesting allowed when a parse sets no max_depth, deeper input would only
+// run the recursive descent out of stack
+#define HJSON_MAX_DEPTH 512
+
+// Last parse error of the calling thread, see HJson_getError. The static of
+// an inline function is one object across translation units, unlike a
+// static variable in this header.
+inline const char*& HJson_lastError() {
+    static thread_local const char* ep = nullptr;
+    return ep;
+}
 
 enum class ValueType {
     kUnknown = -1,
@@ -33,24 +59,38 @@ enum class ValueType {
     kArray
 };
 
+struct HJson;
+struct HJson_index;
+static HJson* HJson_indexAt(HJson* node, int index);
+static HJson* HJson_indexGet(HJson* node, const char* k);
+
 struct HJson {
     struct HJson* next;
     // object/array value data domain
     struct HJson* child;
     ValueType type;
-    // integer/boolean value
+    // integer/boolean value, numbers outside int read 0
     int biv;
+    // 64-bit integer value, exact when integral is set
+    int64_t lv;
     // double value
     double dv;
     // string value
     char* sv;
     // key
     char* key;
+    // number written without fraction or exponent that fits lv
+    bool integral;
+    // wide object/array lookups, set by the parser, filled on first use
+    struct HJson_index* index;
 
     HJson* at(int index) {
-        if (type != ValueType::kArray) {
+        if (type != ValueType::kArray || index < 0) {
             return nullptr;
         }
+        if (this->index) {
+            return HJson_indexAt(this, index);
+        }
         HJson* p = child;
         while (p && index--) {
             p = p->next;
@@ -65,6 +105,8 @@ struct HJson {
             || type == ValueType::kBooleanTrue
             || type == ValueType::kNull) {
                 return 0 == std::strcmp(k, key) ? this : nullptr;
+        } else if (index) {
+            return HJson_indexGet(this, k);
         } else {
             HJson* p = child;
             while (p) {
@@ -93,6 +135,14 @@ struct HJson {
         return biv;
     }
 
+    int64_t ToInt64() {
+        if (type != ValueType::kNumber) {
+            perror("Failed converting to Int64");
+            exit(1);
+        }
+        return lv;
+    }
+
     double ToDouble() {
         if (type != ValueType::kNumber) {
             perror("Failed converting to Int");
@@ -110,27 +160,299 @@ struct HJson {
     }
 };
 
+// One chunk of an arena, payload follows the header
+struct HJson_block {
+    struct HJson_block* prev;
+    size_t size;
+    size_t used;
+};
+
+// Bump allocator a parsed document is carved from. Nodes and strings are
+// never freed one by one, the whole document goes with the arena.
+struct HJson_arena {
+    struct HJson_block* block;
+    size_t next_size;
+};
+
+// Children of an array in order, or an object's children hashed by key
+// (open addressing, first of duplicate keys wins as in the linear walk).
+// Built on the first at()/get(), dropped again by HJson_addItem.
+struct HJson_index {
+    // Tables come from here, malloc() without one
+    HJson_arena* arena;
+    HJson** slots;
+    int count;
+    unsigned mask;
+};
+
+// Output of the writers: a buffer grown with realloc, the caller's memory
+// (fixed) or the current chunk of an iovec chain
 struct HJson_buffer {
     char* buffer;
     int offset;
     int size;
+    // Never grown, output that does not fit sets failed
+    bool fixed;
+    bool failed;
+    struct HJson_chain* chain;
 };
 
-static const char* HJson_parseValue(HJson* item, const char* value);
+// Serialized output as an iovec array ready for writev: punctuation, numbers
+// and short strings are copied into chunks from `arena`, long strings point
+// into the tree, which must outlive the writes
+struct HJson_chain {
+    struct iovec* iov;
+    int count;
+    int cap;
+    // Bytes over all of iov
+    size_t length;
+    HJson_arena* arena;
+    // Bytes of the current chunk no iovec covers yet start here
+    char* pending;
+};
+
+// Where parsing stops and where nodes and strings go
+enum class ParseError {
+    kNone,
+    // Unexpected character, or input ending early
+    kSyntax,
+    // Bad escape sequence or raw control character in a string
+    kString,
+    kNumber,
+    kDepth,
+    kSize,
+    kMemory
+};
+
+// Parse context: input bounds and limits in, error out. One per parse, so
+// any number of threads can parse at once. Zero-initialize and set what is
+// needed, see HJson_parseContext.
+struct HJson_reader {
+    const char* end;
+    // Strings stay in the(writable) input, terminated in place
+    bool insitu;
+    HJson_arena* arena;
+    // Limits, 0 for HJSON_MAX_DEPTH and no size limit
+    int max_depth;
+    size_t max_size;
+    // First error: code, position and offset from the start of the input
+    ParseError code;
+    const char* error;
+    size_t offset;
+    // Containers open at the current position
+    int depth;
+};
+
+// Record the first error only, outer levels fail because of it
+static const char* HJson_fail(HJson_reader* r, const char* at, ParseError code) {
+    if (r->code == ParseError::kNone) {
+        r->code = code;
+        r->error = at;
+    }
+    return 0;
+}
+
+static const char* HJson_parseValue(HJson* item, const char* value, HJson_reader* r);
 static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf);
 
 static const char* HJson_version() {
     return HJSON_VERSION_STRING;
 }
 
-static HJson* HJson_new() {
-    HJson* node = (HJson*)malloc(sizeof(HJson));
+static HJson_arena* HJson_arenaNew() {
+    HJson_arena* arena = (HJson_arena*)malloc(sizeof(HJson_arena));
+    if (arena) {
+        arena->block = 0;
+        arena->next_size = HJSON_ARENA_BLOCK;
+    }
+    return arena;
+}
+
+// Forget every document but keep the memory: several blocks are merged into
+// one as large as all of them, so a reused arena parses documents of a
+// steady size without any malloc.
+static void HJson_arenaReset(HJson_arena* arena) {
+    if (!arena || !arena->block) {
+        return;
+    }
+    if (arena->block->prev) {
+        size_t total = 0;
+        HJson_block* p = arena->block;
+        while (p) {
+            HJson_block* prev = p->prev;
+            total += p->size;
+            free(p);
+            p = prev;
+        }
+        arena->block = (HJson_block*)malloc(sizeof(HJson_block) + total);
+        if (!arena->block) {
+            return;
+        }
+        arena->block->prev = 0;
+        arena->block->size = total;
+    }
+    arena->block->used = 0;
+}
+
+// Release every document parsed into `arena`, one free() per block
+static void HJson_arenaDelete(HJson_arena* arena) {
+    if (!arena) {
+        return;
+    }
+    HJson_block* p = arena->block;
+    while (p) {
+        HJson_block* prev = p->prev;
+        free(p);
+        p = prev;
+    }
+    free(arena);
+}
+
+// Memory held by `arena`, headers included
+static size_t HJson_arenaBytes(const HJson_arena* arena) {
+    size_t bytes = arena ? sizeof(HJson_arena) : 0;
+    for (HJson_block* p = arena ? arena->block : 0; p; p = p->prev) {
+        bytes += sizeof(HJson_block) + p->size;
+    }
+    return bytes;
+}
+
+static void* HJson_arenaAlloc(HJson_arena* arena, size_t size) {
+    // Nodes hold doubles and pointers, keep every allocation aligned for them
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    HJson_block* block = arena->block;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = arena->next_size;
+        while (block_size < size) {
+            block_size *= 2;
+        }
+        block = (HJson_block*)malloc(sizeof(HJson_block) + block_size);
+        if (!block) {
+            return 0;
+        }
+        block->prev = arena->block;
+        block->size = block_size;
+        block->used = 0;
+        arena->block = block;
+        if (arena->next_size < HJSON_ARENA_MAX_BLOCK) {
+            arena->next_size *= 2;
+        }
+    }
+    void* p = (char*)(block + 1) + block->used;
+    block->used += size;
+    return p;
+}
+
+// malloc() without an arena
+static void* HJson_alloc(HJson_arena* arena, size_t size) {
+    return arena ? HJson_arenaAlloc(arena, size) : malloc(size);
+}
+
+static HJson* HJson_new(HJson_arena* arena = nullptr) {
+    HJson* node = (HJson*)HJson_alloc(arena, sizeof(HJson));
     if (node) {
         memset(node, 0, sizeof(HJson));
     }
     return node;
 }
 
+static HJson_index* HJson_indexNew(HJson_arena* arena) {
+    HJson_index* index = (HJson_index*)HJson_alloc(arena, sizeof(HJson_index));
+    if (index) {
+        memset(index, 0, sizeof(HJson_index));
+        index->arena = arena;
+    }
+    return index;
+}
+
+static unsigned HJson_hash(const char* k) {
+    // FNV-1a
+    unsigned h = 2166136261u;
+    while (*k) {
+        h = (h ^ (unsigned char)*k++) * 16777619u;
+    }
+    return h;
+}
+
+static bool HJson_indexBuild(HJson* node) {
+    HJson_index* index = node->index;
+    int count = 0;
+    for (HJson* p = node->child; p; p = p->next) {
+        count++;
+    }
+    // Arrays in order, objects at most half full
+    unsigned size = count;
+    if (node->type == ValueType::kObject) {
+        size = 1;
+        while (size < 2u * count) {
+            size <<= 1;
+        }
+    }
+    if (!index->arena) {
+        free(index->slots);
+    }
+    index->slots = (HJson**)HJson_alloc(index->arena, size * sizeof(HJson*));
+    if (!index->slots) {
+        index->count = 0;
+        return false;
+    }
+    memset(index->slots, 0, size * sizeof(HJson*));
+    index->mask = size - 1;
+    int i = 0;
+    for (HJson* p = node->child; p; p = p->next) {
+        if (node->type == ValueType::kArray) {
+            index->slots[i++] = p;
+            continue;
+        }
+        unsigned h = HJson_hash(p->key) & index->mask;
+        while (index->slots[h] && strcmp(index->slots[h]->key, p->key) != 0) {
+            h = (h + 1) & index->mask;
+        }
+        if (!index->slots[h]) {
+            index->slots[h] = p;
+        }
+    }
+    index->count = count;
+    return true;
+}
+
+static HJson* HJson_indexAt(HJson* node, int index) {
+    HJson_index* ix = node->index;
+    if (ix->count == 0 && !HJson_indexBuild(node)) {
+        return nullptr;
+    }
+    return index >= 0 && index < ix->count ? ix->slots[index] : nullptr;
+}
+
+static HJson* HJson_indexGet(HJson* node, const char* k) {
+    HJson_index* ix = node->index;
+    if (ix->count == 0 && !HJson_indexBuild(node)) {
+        return nullptr;
+    }
+    unsigned h = HJson_hash(k) & ix->mask;
+    while (ix->slots[h]) {
+        if (strcmp(ix->slots[h]->key, k) == 0) {
+            return ix->slots[h];
+        }
+        h = (h + 1) & ix->mask;
+    }
+    return nullptr;
+}
+
+// Fill every index under `node` now. Lookups build them on first use
+// otherwise, which writes: do this before sharing a document across threads.
+static void HJson_buildIndex(HJson* node) {
+    for (; node; node = node->next) {
+        if (node->index && node->index->count == 0) {
+            HJson_indexBuild(node);
+        }
+        if (node->type == ValueType::kArray || node->type == ValueType::kObject) {
+            HJson_buildIndex(node->child);
+        }
+    }
+}
+
+// Not for documents from HJson_parseArena, release their arena instead
 static void HJson_delete(HJson* node) {
     HJson* next;
     while (node) {
@@ -146,402 +468,1311 @@ static void HJson_delete(HJson* node) {
         if (node->key) {
             free(node->key);
         }
+        if (node->index) {
+            free(node->index->slots);
+            free(node->index);
+        }
         free(node);
         node = next;
     }
 }
 
-static const char* skip(const char* p) {
-    while (p && *p && (unsigned char)*p <= 32) {
+// Scanning kernels: the first byte of [p, end) a string scan stops at(quote,
+// backslash, control character) or the first non-whitespace byte. SSE2 is
+// the x86-64 baseline, AVX2 is picked at runtime where the CPU has it; the
+// scalar loops finish the tails and serve other architectures.
+typedef const char* (*HJson_scanFn)(const char* p, const char* end);
+
+static const char* HJson_scanStringScalar(const char* p, const char* end) {
+    while (p < end && *p != '\"' && *p != '\\' && (unsigned char)*p >= 0x20) {
         p++;
     }
     return p;
 }
 
+static const char* HJson_skipSpaceScalar(const char* p, const char* end) {
+    while (p < end && (unsigned char)*p <= 32) {
+        p++;
+    }
+    return p;
+}
+
+#if defined(__SSE2__) && !defined(HJSON_NO_SIMD)
+static const char* HJson_scanStringSse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctrl  = _mm_set1_epi8(0x1f);
+    for (; end - p >= 16; p += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        // b <= 0x1f unsigned: max(b, 0x1f) == 0x1f
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, quote), _mm_cmpeq_epi8(b, slash)),
+            _mm_cmpeq_epi8(_mm_max_epu8(b, ctrl), ctrl));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return HJson_scanStringScalar(p, end);
+}
+
+static const char* HJson_skipSpaceSse2(const char* p, const char* end) {
+    const __m128i space = _mm_set1_epi8(32);
+    for (; end - p >= 16; p += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(b, space), space)) & 0xffff;
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return HJson_skipSpaceScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* HJson_scanStringAvx2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i slash = _mm256_set1_epi8('\\');
+    const __m256i ctrl  = _mm256_set1_epi8(0x1f);
+    for (; end - p >= 32; p += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b, quote), _mm256_cmpeq_epi8(b, slash)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(b, ctrl), ctrl));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return HJson_scanStringSse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* HJson_skipSpaceAvx2(const char* p, const char* end) {
+    const __m256i space = _mm256_set1_epi8(32);
+    for (; end - p >= 32; p += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(b, space), space));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return HJson_skipSpaceSse2(p, end);
+}
+#endif
+
+static HJson_scanFn HJson_pickScanString() {
+#if defined(__SSE2__) && !defined(HJSON_NO_SIMD)
+    return __builtin_cpu_supports("avx2") ? HJson_scanStringAvx2 : HJson_scanStringSse2;
+#else
+    return HJson_scanStringScalar;
+#endif
+}
+
+static HJson_scanFn HJson_pickSkipSpace() {
+#if defined(__SSE2__) && !defined(HJSON_NO_SIMD)
+    return __builtin_cpu_supports("avx2") ? HJson_skipSpaceAvx2 : HJson_skipSpaceSse2;
+#else
+    return HJson_skipSpaceScalar;
+#endif
+}
+
+static const char* HJson_scanString(const char* p, const char* end) {
+    static const HJson_scanFn scan = HJson_pickScanString();
+    return scan(p, end);
+}
+
+static const char* HJson_skipSpace(const char* p, const char* end) {
+    static const HJson_scanFn scan = HJson_pickSkipSpace();
+    return scan(p, end);
+}
+
+// Byte at `p`, '\0' past the end of the input
+static char peek(const HJson_reader* r, const char* p) {
+    return p && p < r->end ? *p : '\0';
+}
+
+static bool match(const HJson_reader* r, const char* p, const char* literal, size_t n) {
+    return static_cast<size_t>(r->end - p) >= n && !memcmp(p, literal, n);
+}
+
+static const char* skip(const HJson_reader* r, const char* p) {
+    // Compact JSON has no whitespace to skip, only indentation runs are worth
+    // a vector load
+    if (!p || p >= r->end || (unsigned char)*p > 32) {
+        return p;
+    }
+    return HJson_skipSpace(p + 1, r->end);
+}
+
 // Deserialize
 
-static const char* HJson_parseNumber(HJson* item, const char* value) {
-    double num = 0;
-    int num_sign = 1;
+// Powers of ten a double holds exactly
+static const double HJson_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Numbers are read as a 64-bit mantissa and a decimal exponent. Integers
+// that fit keep the exact value in lv. Doubles with a mantissa below 2^53
+// and an exponent within +-22 are one correctly rounded multiplication or
+// division(Clinger's fast path), which covers prices, ratings and
+// coordinates. Longer mantissas and larger exponents go to strtod.
+static const char* HJson_parseNumber(HJson* item, const char* value, HJson_reader* r) {
+    const char* start = value;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    // Significant digits seen, mantissa holds the first 19
+    int digits = 0;
+    // Decimal exponent of the mantissa's last digit
     int scale = 0;
-    int exponent = 0;
-    int exponent_sign = 1;
-    if (*value == '-') {
-        num_sign = -1;
+    bool integral = true;
+    if (peek(r, value) == '-') {
+        negative = true;
         value++;
     }
-    // Leading zero?
-    while (value && *value == '0') {
+    if (!(peek(r, value) >= '0' && peek(r, value) <= '9')) {
+        return HJson_fail(r, start, ParseError::kNumber);
+    }
+    // A leading zero is the whole integer part
+    if (peek(r, value) == '0') {
         value++;
+        if (peek(r, value) >= '0' && peek(r, value) <= '9') {
+            return HJson_fail(r, start, ParseError::kNumber);
+        }
     }
-    // Number?
-    if (value && *value >= '1' && *value <= '9') {
-        do
-        {
-            num = num * 10.0 + (*value++ - '0');
-        } while (value && *value >= '0' && *value <= '9');
+    while (peek(r, value) >= '0' && peek(r, value) <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*value - '0');
+        } else {
+            scale++;
+        }
+        digits++;
+        value++;
     }
     // Double?
-    if (value && *value == '.') {
+    if (peek(r, value) == '.') {
+        integral = false;
         value++;
-        while (value && *value >= '0' && *value <= '9') {
-            num = num * 10.0 + (*value++ - '0');
-            scale--;
+        if (!(peek(r, value) >= '0' && peek(r, value) <= '9')) {
+            return HJson_fail(r, start, ParseError::kNumber);
+        }
+        while (peek(r, value) >= '0' && peek(r, value) <= '9') {
+            if (digits == 0 && *value == '0') {
+                // Zeros before the first significant digit
+                scale--;
+            } else if (digits < 19) {
+                mantissa = mantissa * 10 + (*value - '0');
+                scale--;
+                digits++;
+            } else {
+                digits++;
+            }
+            value++;
         }
     }
     // Exponent?
-    if (value && (*value == 'e' || *value == 'E')) {
+    if (peek(r, value) == 'e' || peek(r, value) == 'E') {
+        integral = false;
         value++;
-        if (value && *value == '-') {
+        int exponent_sign = 1;
+        int exponent = 0;
+        if (peek(r, value) == '-') {
             exponent_sign = -1;
             value++;
-        } else if (value && *value == '+') {
+        } else if (peek(r, value) == '+') {
             value++;
         }
-        while (value && *value >= '0' && *value <= '9') {
-            exponent = exponent * 10 + (*value++ - '0');
+        if (!(peek(r, value) >= '0' && peek(r, value) <= '9')) {
+            return HJson_fail(r, start, ParseError::kNumber);
+        }
+        while (peek(r, value) >= '0' && peek(r, value) <= '9') {
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (*value - '0');
+            }
+            value++;
         }
+        scale += exponent_sign * exponent;
     }
 
-    num = num_sign * num * pow(10.0, (scale + exponent_sign * exponent));
-
     item->type = ValueType::kNumber;
-    item->dv = num;
-    item->biv = static_cast<int>(num);
+    item->integral = false;
+    // -0 has no int64 form, it stays a double to keep its sign
+    if (integral && digits <= 19 && !(negative && mantissa == 0)
+        && mantissa <= (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) {
+        item->integral = true;
+        item->lv = negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa;
+        item->dv = (double)item->lv;
+    } else if (digits <= 19 && mantissa <= (1ULL << 53) && scale >= -22 && scale <= 22) {
+        double num = (double)mantissa;
+        num = scale < 0 ? num / HJson_pow10[-scale] : num * HJson_pow10[scale];
+        item->dv = negative ? -num : num;
+    } else {
+        // strtod wants a terminated string, the input may not be one
+        char stack[64];
+        size_t len = value - start;
+        char* copy = len < sizeof(stack) ? stack : (char*)malloc(len + 1);
+        if (!copy) {
+            return HJson_fail(r, start, ParseError::kMemory);
+        }
+        memcpy(copy, start, len);
+        copy[len] = '\0';
+        item->dv = strtod(copy, 0);
+        if (copy != stack) {
+            free(copy);
+        }
+    }
+    if (!item->integral) {
+        item->lv = item->dv >= (double)INT64_MIN && item->dv < (double)INT64_MAX ? (int64_t)item->dv : 0;
+    }
+    item->biv = item->lv >= INT_MIN && item->lv <= INT_MAX ? (int)item->lv : 0;
 
     return value;
 }
 
-// Escape handle
-// TODO: Unicode support
-static const char* HJson_parseString(HJson* item, const char* value) {
-    const char* end_ptr = value + 1;
-    int str_len = 0;
-    char* sb = 0;
-    
-    if (value && *value != '\"') {
-        ep = value;
-        return 0;
+static int HJson_hex4(const char* p) {
+    int v = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') {
+            v |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    return v;
+}
+
+static char* HJson_utf8(char* dp, unsigned cp) {
+    if (cp < 0x80) {
+        *dp++ = (char)cp;
+    } else if (cp < 0x800) {
+        *dp++ = (char)(0xc0 | (cp >> 6));
+        *dp++ = (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        *dp++ = (char)(0xe0 | (cp >> 12));
+        *dp++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *dp++ = (char)(0x80 | (cp & 0x3f));
+    } else {
+        *dp++ = (char)(0xf0 | (cp >> 18));
+        *dp++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+        *dp++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+        *dp++ = (char)(0x80 | (cp & 0x3f));
     }
-    while (end_ptr && *end_ptr != '\"') {
-        if (*end_ptr++ == '\\') {
-            end_ptr++;
+    return dp;
+}
+
+// Decode the string body [sp, close) into dp, which may be sp itself: no
+// escape decodes longer than it is written. Runs between escapes move with
+// one memmove each.
+// @return end of the output, 0 on a bad escape
+static char* HJson_unescape(const char* sp, const char* close, char* dp) {
+    while (sp < close) {
+        const char* run = HJson_scanString(sp, close);
+        if (run != sp) {
+            if (dp != sp) {
+                memmove(dp, sp, run - sp);
+            }
+            dp += run - sp;
+            sp = run;
+        }
+        if (sp >= close) {
+            break;
+        }
+        // A backslash, the closing scan made sure another byte follows
+        char c = sp[1];
+        sp += 2;
+        switch (c)
+        {
+        case '\"': *dp++ = '\"'; break;
+        case '\\': *dp++ = '\\'; break;
+        case '/':  *dp++ = '/';  break;
+        case 'b':  *dp++ = '\b'; break;
+        case 'f':  *dp++ = '\f'; break;
+        case 'n':  *dp++ = '\n'; break;
+        case 'r':  *dp++ = '\r'; break;
+        case 't':  *dp++ = '\t'; break;
+        case 'u': {
+            int cp = close - sp >= 4 ? HJson_hex4(sp) : -1;
+            if (cp < 0 || (cp >= 0xdc00 && cp <= 0xdfff)) {
+                return 0;
+            }
+            sp += 4;
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                // UTF-16 surrogate pair, the low half must follow
+                int lo = close - sp >= 6 && sp[0] == '\\' && sp[1] == 'u' ? HJson_hex4(sp + 2) : -1;
+                if (lo < 0xdc00 || lo > 0xdfff) {
+                    return 0;
+                }
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                sp += 6;
+            }
+            dp = HJson_utf8(dp, cp);
+            break;
+        }
+        default:
+            return 0;
         }
     }
-    str_len = end_ptr - value - 1;
-    sb = (char*)malloc(str_len + 1);
-    if (!sb) {
-        return 0;
+    return dp;
+}
+
+// Strings are decoded: escapes become the bytes they stand for, \uXXXX
+// (and surrogate pairs) UTF-8. Raw control characters are rejected.
+static const char* HJson_parseString(HJson* item, const char* value, HJson_reader* r) {
+    if (peek(r, value) != '\"') {
+        return HJson_fail(r, value, ParseError::kSyntax);
+    }
+    const char* sp = value + 1;
+    // Closing quote, escapes are stepped over in pairs
+    const char* close = HJson_scanString(sp, r->end);
+    bool escaped = false;
+    while (close < r->end && *close == '\\') {
+        escaped = true;
+        close = r->end - close > 2 ? HJson_scanString(close + 2, r->end) : r->end;
+    }
+    if (close >= r->end || *close != '\"') {
+        // Unterminated, or a control character
+        return close < r->end ? HJson_fail(r, close, ParseError::kString) : HJson_fail(r, value, ParseError::kSyntax);
+    }
+    char* sb = 0;
+    if (r->insitu) {
+        // Decoded over itself, terminated at most at the closing quote
+        sb = const_cast<char*>(sp);
+    } else {
+        sb = (char*)HJson_alloc(r->arena, close - sp + 1);
+        if (!sb) {
+            return HJson_fail(r, value, ParseError::kMemory);
+        }
     }
     item->type = ValueType::kString;
     item->sv = sb;
 
-    // Get string literal
-    const char* sp = value + 1;
-    char* dp = sb;
-    while (sp < end_ptr) {
-        *dp++ = *sp++;
+    char* dp = sb + (close - sp);
+    if (escaped) {
+        dp = HJson_unescape(sp, close, sb);
+        if (!dp) {
+            return HJson_fail(r, value, ParseError::kString);
+        }
+    } else if (!r->insitu) {
+        memcpy(sb, sp, close - sp);
     }
     *dp = '\0';
-    if (*sp == '\"') sp++;
-    return sp;
+    return close + 1;
 }
 
-static const char* HJson_parseArray(HJson* item, const char* value) {
+static const char* HJson_parseArray(HJson* item, const char* value, HJson_reader* r) {
     HJson* child;
-    if (value && *value != '[') {
-        ep = value;
-        return 0;
+    if (peek(r, value) != '[') {
+        return HJson_fail(r, value, ParseError::kSyntax);
+    }
+    if (++r->depth > (r->max_depth ? r->max_depth : HJSON_MAX_DEPTH)) {
+        return HJson_fail(r, value, ParseError::kDepth);
     }
     item->type = ValueType::kArray;
-    value = skip(value + 1);
+    value = skip(r, value + 1);
     // Empty array
-    if (value && *value == ']') {
+    if (peek(r, value) == ']') {
+        r->depth--;
         return value + 1;
     }
-    item->child = child = HJson_new();
+    item->child = child = HJson_new(r->arena);
+    if (!child) {
+        return HJson_fail(r, value, ParseError::kMemory);
+    }
+    int count = 1;
 
-    value = skip(HJson_parseValue(child, skip(value)));
+    value = skip(r, HJson_parseValue(child, skip(r, value), r));
     if (!value) {
         return 0;
     }
 
     // Comma separator
-    while (value && *value == ',') {
+    while (peek(r, value) == ',') {
         HJson* next;
-        next = HJson_new();
+        next = HJson_new(r->arena);
         if (!next) {
-            return 0;
+            return HJson_fail(r, value, ParseError::kMemory);
         }
         child->next = next;
         child = next;
+        count++;
 
-        value = skip(HJson_parseValue(child, skip(value + 1)));
+        value = skip(r, HJson_parseValue(child, skip(r, value + 1), r));
         if (!value) {
             return 0;
         }
     }
     // ending
-    if (value && *value == ']') {
+    if (peek(r, value) == ']') {
+        if (count >= HJSON_INDEX_MIN) {
+            item->index = HJson_indexNew(r->arena);
+        }
+        r->depth--;
         return value + 1;
     }
-
-    ep = value;
-    return 0;
+    return HJson_fail(r, value, ParseError::kSyntax);
 }
 
-static const char* HJson_parseObject(HJson* item, const char* value) {
+static const char* HJson_parseObject(HJson* item, const char* value, HJson_reader* r) {
     HJson* child;
-    if (value && *value != '{') {
-        ep = value;
-        return 0;
+    if (peek(r, value) != '{') {
+        return HJson_fail(r, value, ParseError::kSyntax);
+    }
+    if (++r->depth > (r->max_depth ? r->max_depth : HJSON_MAX_DEPTH)) {
+        return HJson_fail(r, value, ParseError::kDepth);
     }
     item->type = ValueType::kObject;
-    value = skip(value + 1);
-    if (value && *value == '}') {
+    value = skip(r, value + 1);
+    if (peek(r, value) == '}') {
         // Empty object
+        r->depth--;
         return value + 1;
     }
-    item->child = child = HJson_new();
+    item->child = child = HJson_new(r->arena);
+    if (!child) {
+        return HJson_fail(r, value, ParseError::kMemory);
+    }
+    int count = 1;
     // Find key
-    value = skip(HJson_parseString(child, skip(value)));
+    value = skip(r, HJson_parseString(child, skip(r, value), r));
     if (!value) {
         return 0;
     }
     child->key = child->sv;
     child->sv = 0;
-    if (value && *value != ':') {
-        ep = value;
-        return 0;
+    if (peek(r, value) != ':') {
+        return HJson_fail(r, value, ParseError::kSyntax);
     }
     // Find value
-    value = skip(HJson_parseValue(child, skip(value + 1)));
+    value = skip(r, HJson_parseValue(child, skip(r, value + 1), r));
     if (!value) {
         return 0;
     }
     // Comma separator
-    while (value && *value == ',') {
+    while (peek(r, value) == ',') {
         HJson* next;
-        next = HJson_new();
+        next = HJson_new(r->arena);
         if (!next) {
-            return 0;
+            return HJson_fail(r, value, ParseError::kMemory);
         }
         child->next = next;
         child = next;
+        count++;
 
         // Parse again
-        value = skip(HJson_parseString(child, skip(value + 1)));
+        value = skip(r, HJson_parseString(child, skip(r, value + 1), r));
         if (!value) {
             return 0;
         }
 
         child->key = child->sv;
         child->sv = 0;
-        if (value && *value != ':') {
-            ep = value;
-            return 0;
+        if (peek(r, value) != ':') {
+            return HJson_fail(r, value, ParseError::kSyntax);
         }
-        value = skip(HJson_parseValue(child, skip(value + 1)));
+        value = skip(r, HJson_parseValue(child, skip(r, value + 1), r));
         if (!value) {
             return 0;
         }
     }
 
     // ending
-    if (value && *value == '}') {
+    if (peek(r, value) == '}') {
+        if (count >= HJSON_INDEX_MIN) {
+            item->index = HJson_indexNew(r->arena);
+        }
+        r->depth--;
         return value + 1;
     }
-
-    ep = value;
-    return 0;
+    return HJson_fail(r, value, ParseError::kSyntax);
 }
 
-static const char* HJson_parseValue(HJson* item, const char* value) {
+static const char* HJson_parseValue(HJson* item, const char* value, HJson_reader* r) {
     if (!value) return 0;
 
-    if (!strncmp(value, "null", 4)) {
+    if (match(r, value, "null", 4)) {
         item->type = ValueType::kNull;
         return value + 4;
     }
-    if (!strncmp(value, "false", 5)) {
+    if (match(r, value, "false", 5)) {
         item->type = ValueType::kBooleanFalse;
         item->biv = 0;
         return value + 5;
     }
-    if (!strncmp(value, "true", 4)) {
+    if (match(r, value, "true", 4)) {
         item->type = ValueType::kBooleanTrue;
         item->biv = 1;
         return value + 4;
     }
-    if (*value == '\"') {
-        return HJson_parseString(item, value);
+    char c = peek(r, value);
+    if (c == '\"') {
+        return HJson_parseString(item, value, r);
     }
-    if (*value == '-' || (*value >= '0' && *value <= '9')) {
-        return HJson_parseNumber(item, value);
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        return HJson_parseNumber(item, value, r);
     }
-    if (*value == '{') {
-        return HJson_parseObject(item, value);
+    if (c == '{') {
+        return HJson_parseObject(item, value, r);
     }
-    if (*value == '[') {
-        return HJson_parseArray(item, value);
+    if (c == '[') {
+        return HJson_parseArray(item, value, r);
     }
-    ep = value;
-    return 0;
+    return HJson_fail(r, value, ParseError::kSyntax);
+}
+
+// `whole`: anything but whitespace after the value is a kSyntax error
+static HJson* HJson_parseWith(const char* value, HJson_reader* r, bool whole = false) {
+    HJson* root_node = 0;
+    const char* rest = nullptr;
+    if (r->max_size && (size_t)(r->end - value) > r->max_size) {
+        HJson_fail(r, value, ParseError::kSize);
+    } else if (!(root_node = HJson_new(r->arena))) {
+        HJson_fail(r, value, ParseError::kMemory);
+    } else if (!(rest = HJson_parseValue(root_node, skip(r, value), r))
+        || (whole && (rest = skip(r, rest)) < r->end && !HJson_fail(r, rest, ParseError::kSyntax))) {
+        // parse failed, an arena keeps what it handed out until released
+        if (!r->arena) {
+            HJson_delete(root_node);
+        }
+        root_node = nullptr;
+    }
+    if (r->code != ParseError::kNone) {
+        r->offset = r->error - value;
+    }
+    HJson_lastError() = r->error;
+    return root_node;
 }
 
 static HJson* HJson_parse(const char* value) {
-    HJson* root_node = HJson_new();
-    if (!root_node) {
+    HJson_reader r = {value + strlen(value), false, nullptr};
+    return HJson_parseWith(value, &r);
+}
+
+// Parse exactly value[0, len), no terminator needed and nothing past it is
+// read. Release with HJson_delete.
+static HJson* HJson_parseLength(const char* value, size_t len) {
+    HJson_reader r = {value + len, false, nullptr};
+    return HJson_parseWith(value, &r);
+}
+
+// Same as HJson_parse with every node and string taken from `arena`, the
+// document lives until the arena is reset or deleted. Nothing is freed on
+// failure either, the arena still owns it.
+static HJson* HJson_parseArena(const char* value, HJson_arena* arena) {
+    HJson_reader r = {value + strlen(value), false, arena};
+    return HJson_parseWith(value, &r);
+}
+
+// Parse value[0, len) with the limits and arena set in `ctx`, which was
+// zero-initialized. The input must be exactly one value, trailing bytes other
+// than whitespace fail. On failure ctx->code, ctx->error and ctx->offset say
+// what went wrong where; the context is the caller's, so concurrent parses
+// never see each other's errors.
+static HJson* HJson_parseContext(const char* value, size_t len, HJson_reader* ctx) {
+    ctx->end = value + len;
+    ctx->insitu = false;
+    ctx->code = ParseError::kNone;
+    ctx->error = nullptr;
+    ctx->offset = 0;
+    ctx->depth = 0;
+    return HJson_parseWith(value, ctx, true);
+}
+
+static const char* HJson_errorString(ParseError code) {
+    switch (code)
+    {
+    case ParseError::kNone: return "no error";
+    case ParseError::kSyntax: return "syntax error";
+    case ParseError::kString: return "invalid string";
+    case ParseError::kNumber: return "invalid number";
+    case ParseError::kDepth: return "nesting too deep";
+    case ParseError::kSize: return "document too large";
+    case ParseError::kMemory: return "out of memory";
+    }
+    return "unknown error";
+}
+
+// Parse buffer[0, len) in place, e.g. a response body straight off the
+// socket: strings are left where they are and terminated over their closing
+// quote, only nodes are allocated, from `arena`. `buffer` is modified and
+// must outlive the document.
+static HJson* HJson_parseInsitu(char* buffer, size_t len, HJson_arena* arena) {
+    if (!arena) {
+        // HJson_delete would free the strings
         return nullptr;
     }
-    const char* end = 0;
-    end = HJson_parseValue(root_node, skip(value));
-    if (!end) {
-        // parse failed
-        HJson_delete(root_node);
-        root_node = nullptr;
+    HJson_reader r = {buffer + len, true, arena};
+    return HJson_parseWith(buffer, &r);
+}
+
+// Pull parsing
+//
+// Event by event without building a tree, for documents too large to hold:
+// feed the input in chunks of any size as it arrives, call HJson_pullNext
+// until it asks for more. Memory is the nesting stack plus the longest
+// string or number, whatever the document size.
+//
+//     HJson_pull pull;
+//     HJson_pullInit(&pull);
+//     while (read a chunk) {
+//         HJson_pullFeed(&pull, chunk, n, at_eof);
+//         while ((ev = HJson_pullNext(&pull)) != PullEvent::kNeedMore) { ... }
+//     }
+//     HJson_pullFree(&pull);
+
+#define HJSON_PULL_MAX_DEPTH 512
+
+enum class PullEvent {
+    // Chunk used up, feed the next one
+    kNeedMore,
+    kBeginObject,
+    kEndObject,
+    kBeginArray,
+    kEndArray,
+    // Object key in sv
+    kKey,
+    // Scalar, see type: sv for strings, lv/dv/integral for numbers
+    kValue,
+    // Document complete, nothing but whitespace followed
+    kEnd,
+    // Malformed input, offset is where; every later call returns it again
+    kError
+};
+
+// What the parser waits for next
+enum class PullState {
+    kValue,
+    // Value or ']' right after '['
+    kFirstValue,
+    kKey,
+    // Key or '}' right after '{'
+    kFirstKey,
+    kColon,
+    // ',' or the close of the container, the end at depth 0
+    kAfterValue,
+    kDone,
+    kError
+};
+
+struct HJson_pull {
+    // Current chunk, must stay valid until kNeedMore
+    const char* p;
+    const char* end;
+    bool last;
+    // Stream offset of `end`, errors report an offset from it
+    size_t fed;
+    PullState state;
+    // '{' or '[' per open container
+    char stack[HJSON_PULL_MAX_DEPTH];
+    int depth;
+    // A string/number/literal split across chunks: its kind ('"', '0',
+    // 'a', 0 for none), the bytes so far, a backslash pending at the split,
+    // whether the string had any
+    char pending;
+    bool escape;
+    bool escaped;
+    char* token;
+    size_t token_len;
+    size_t token_cap;
+    // Stream offset where the pending token starts, its errors point there
+    size_t start;
+
+    // Event data, valid until the next call
+    ValueType type;
+    // Decoded and terminated, sv_len counts embedded NULs
+    const char* sv;
+    size_t sv_len;
+    int64_t lv;
+    double dv;
+    bool integral;
+    // Stream offset of the error
+    size_t offset;
+};
+
+static void HJson_pullInit(HJson_pull* s) {
+    memset(s, 0, sizeof(HJson_pull));
+    s->state = PullState::kValue;
+}
+
+static void HJson_pullFree(HJson_pull* s) {
+    free(s->token);
+    s->token = 0;
+    s->token_cap = 0;
+}
+
+// Next chunk, `last` once no more input follows. Only after kNeedMore: the
+// previous chunk must be used up.
+static void HJson_pullFeed(HJson_pull* s, const char* data, size_t len, bool last) {
+    s->p = data;
+    s->end = data + len;
+    s->last = last;
+    s->fed += len;
+}
+
+static PullEvent HJson_pullFailAt(HJson_pull* s, size_t offset) {
+    s->state = PullState::kError;
+    s->offset = offset;
+    return PullEvent::kError;
+}
+
+static PullEvent HJson_pullFail(HJson_pull* s, const char* at) {
+    return HJson_pullFailAt(s, s->fed - (s->end - at));
+}
+
+// Make room for `len` more token bytes
+static bool HJson_pullReserve(HJson_pull* s, size_t len) {
+    if (s->token_len + len <= s->token_cap) {
+        return true;
     }
-    return root_node;
+    size_t cap = s->token_cap ? s->token_cap : 64;
+    while (cap < s->token_len + len) {
+        cap *= 2;
+    }
+    char* token = (char*)realloc(s->token, cap);
+    if (!token) {
+        return false;
+    }
+    s->token = token;
+    s->token_cap = cap;
+    return true;
+}
+
+static bool HJson_pullKeep(HJson_pull* s, const char* from, const char* to) {
+    if (from == to) {
+        return true;
+    }
+    if (!HJson_pullReserve(s, to - from)) {
+        return false;
+    }
+    memcpy(s->token + s->token_len, from, to - from);
+    s->token_len += to - from;
+    return true;
+}
+
+// Closing quote of a string body starting at p, `end` when the chunk ends
+// first, else the raw control character found
+static const char* HJson_pullScanString(HJson_pull* s, const char* p) {
+    while (p < s->end) {
+        if (s->escape) {
+            s->escape = false;
+            p++;
+            continue;
+        }
+        p = HJson_scanString(p, s->end);
+        if (p == s->end || *p != '\\') {
+            return p;
+        }
+        s->escape = true;
+        s->escaped = true;
+        p++;
+    }
+    return p;
+}
+
+static bool HJson_pullNumberChar(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+// Finish the token [from, to), split or not, into the event fields
+static PullEvent HJson_pullToken(HJson_pull* s, char kind, const char* from, const char* to) {
+    // Decoded strings are never longer, room for the terminator up front so
+    // the copy below stays put
+    if (!HJson_pullReserve(s, to - from + 1)) {
+        return HJson_pullFailAt(s, s->start);
+    }
+    if (s->token_len) {
+        // The front came with earlier chunks, decode from the copy in place
+        HJson_pullKeep(s, from, to);
+        from = s->token;
+        to = s->token + s->token_len;
+    }
+    s->token_len = 0;
+    if (kind == '\"') {
+        char* dp = s->token + (to - from);
+        if (s->escaped) {
+            s->escaped = false;
+            dp = HJson_unescape(from, to, s->token);
+            if (!dp) {
+                return HJson_pullFailAt(s, s->start);
+            }
+        } else if (from != s->token) {
+            memcpy(s->token, from, to - from);
+        }
+        *dp = '\0';
+        s->type = ValueType::kString;
+        s->sv = s->token;
+        s->sv_len = dp - s->token;
+        return PullEvent::kValue;
+    }
+    if (kind == '0') {
+        HJson item;
+        memset(&item, 0, sizeof(item));
+        HJson_reader r = {to, false, nullptr};
+        if (HJson_parseNumber(&item, from, &r) != to) {
+            return HJson_pullFailAt(s, s->start);
+        }
+        s->type = ValueType::kNumber;
+        s->lv = item.lv;
+        s->dv = item.dv;
+        s->integral = item.integral;
+        return PullEvent::kValue;
+    }
+    size_t len = to - from;
+    if (len == 4 && !memcmp(from, "null", 4)) {
+        s->type = ValueType::kNull;
+    } else if (len == 4 && !memcmp(from, "true", 4)) {
+        s->type = ValueType::kBooleanTrue;
+    } else if (len == 5 && !memcmp(from, "false", 5)) {
+        s->type = ValueType::kBooleanFalse;
+    } else {
+        return HJson_pullFailAt(s, s->start);
+    }
+    return PullEvent::kValue;
+}
+
+// Carry on with a string, number or literal, from its start or from where
+// the previous chunk cut it
+static PullEvent HJson_pullScalar(HJson_pull* s) {
+    const char* from = s->p;
+    const char* to = from;
+    if (s->pending == '\"') {
+        to = HJson_pullScanString(s, from);
+        if (to < s->end && *to != '\"') {
+            return HJson_pullFail(s, to);
+        }
+    } else if (s->pending == '0') {
+        while (to < s->end && HJson_pullNumberChar(*to)) {
+            to++;
+        }
+    } else {
+        while (to < s->end && *to >= 'a' && *to <= 'z') {
+            to++;
+        }
+    }
+    if (to == s->end && (s->pending == '\"' || !s->last)) {
+        // Cut by the chunk, keep what there is. Unterminated at the end of
+        // input fails where the string opened, as the tree parser does
+        if (s->last) {
+            return HJson_pullFailAt(s, s->start);
+        }
+        if (!HJson_pullKeep(s, from, to)) {
+            return HJson_pullFail(s, to);
+        }
+        s->p = to;
+        return PullEvent::kNeedMore;
+    }
+    char kind = s->pending;
+    s->pending = 0;
+    // Past the closing quote
+    s->p = kind == '\"' ? to + 1 : to;
+    PullEvent ev = HJson_pullToken(s, kind, from, to);
+    if (ev == PullEvent::kValue && s->state != PullState::kError) {
+        if (s->state == PullState::kKey) {
+            s->state = PullState::kColon;
+            return PullEvent::kKey;
+        }
+        s->state = PullState::kAfterValue;
+    }
+    return ev;
+}
+
+static PullEvent HJson_pullNext(HJson_pull* s) {
+    if (s->state == PullState::kError) {
+        return PullEvent::kError;
+    }
+    if (s->pending) {
+        return HJson_pullScalar(s);
+    }
+    if (s->p < s->end && (unsigned char)*s->p <= 32) {
+        s->p = HJson_skipSpace(s->p + 1, s->end);
+    }
+    if (s->p >= s->end) {
+        if (!s->last) {
+            return PullEvent::kNeedMore;
+        }
+        if (s->state != PullState::kDone && !(s->state == PullState::kAfterValue && s->depth == 0)) {
+            return HJson_pullFail(s, s->p);
+        }
+        s->state = PullState::kDone;
+        return PullEvent::kEnd;
+    }
+    char c = *s->p;
+    switch (s->state)
+    {
+    case PullState::kFirstValue:
+        if (c == ']') {
+            break;
+        }
+        // fall through
+    case PullState::kValue:
+        if (c == '{' || c == '[') {
+            if (s->depth == HJSON_PULL_MAX_DEPTH) {
+                return HJson_pullFail(s, s->p);
+            }
+            s->stack[s->depth++] = c;
+            s->p++;
+            s->state = c == '{' ? PullState::kFirstKey : PullState::kFirstValue;
+            return c == '{' ? PullEvent::kBeginObject : PullEvent::kBeginArray;
+        }
+        s->start = s->fed - (s->end - s->p);
+        if (c == '\"') {
+            s->p++;
+            s->pending = '\"';
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            s->pending = '0';
+        } else if (c == 't' || c == 'f' || c == 'n') {
+            s->pending = 'a';
+        } else {
+            return HJson_pullFail(s, s->p);
+        }
+        s->state = PullState::kValue;
+        return HJson_pullScalar(s);
+    case PullState::kFirstKey:
+        if (c == '}') {
+            break;
+        }
+        // fall through
+    case PullState::kKey:
+        if (c != '\"') {
+            return HJson_pullFail(s, s->p);
+        }
+        s->start = s->fed - (s->end - s->p);
+        s->p++;
+        s->pending = '\"';
+        s->state = PullState::kKey;
+        return HJson_pullScalar(s);
+    case PullState::kColon:
+        if (c != ':') {
+            return HJson_pullFail(s, s->p);
+        }
+        s->p++;
+        s->state = PullState::kValue;
+        return HJson_pullNext(s);
+    case PullState::kAfterValue:
+        if (s->depth == 0) {
+            return HJson_pullFail(s, s->p);
+        }
+        if (c == ',') {
+            s->p++;
+            s->state = s->stack[s->depth - 1] == '{' ? PullState::kKey : PullState::kValue;
+            return HJson_pullNext(s);
+        }
+        break;
+    default:
+        return HJson_pullFail(s, s->p);
+    }
+    // Closing bracket, must match the open container
+    char open = s->depth ? s->stack[s->depth - 1] : 0;
+    if ((c == '}' && open != '{') || (c == ']' && open != '[') || (c != '}' && c != ']')) {
+        return HJson_pullFail(s, s->p);
+    }
+    s->p++;
+    s->depth--;
+    s->state = PullState::kAfterValue;
+    return c == '}' ? PullEvent::kEndObject : PullEvent::kEndArray;
 }
 
 // Serialize
 
+static bool HJson_chainPush(HJson_chain* chain, const char* base, size_t len) {
+    if (!len) {
+        return true;
+    }
+    chain->length += len;
+    if (chain->count) {
+        // Continues the previous piece, e.g. the rest of a chunk
+        struct iovec* last = &chain->iov[chain->count - 1];
+        if ((const char*)last->iov_base + last->iov_len == base) {
+            last->iov_len += len;
+            return true;
+        }
+    }
+    if (chain->count == chain->cap) {
+        int cap = chain->cap ? chain->cap * 2 : 16;
+        struct iovec* iov = (struct iovec*)realloc(chain->iov, cap * sizeof(struct iovec));
+        if (!iov) {
+            return false;
+        }
+        chain->iov = iov;
+        chain->cap = cap;
+    }
+    chain->iov[chain->count].iov_base = const_cast<char*>(base);
+    chain->iov[chain->count].iov_len = len;
+    chain->count++;
+    return true;
+}
+
+// Close what the current chunk holds so far into an iovec
+static bool HJson_chainFlush(HJson_buffer* const p) {
+    HJson_chain* chain = p->chain;
+    char* end = p->buffer + p->offset;
+    if (!p->buffer || end == chain->pending) {
+        return true;
+    }
+    bool ok = HJson_chainPush(chain, chain->pending, end - chain->pending);
+    chain->pending = end;
+    return ok;
+}
+
+// Room for `needed` bytes plus a terminator at p->buffer + p->offset
 static char* HJson_avoid(HJson_buffer * const p, int needed) {
-    char* new_buf = 0;
-    int new_size = 0;
-    if (!p) {
+    if (!p || p->failed) {
         return 0;
     }
-    if (!p->buffer) {
-        p->buffer = (char*)malloc(BUFFER_SIZE);
+    if (!p->buffer && !p->fixed && !p->chain) {
+        p->size = needed + 1 > BUFFER_SIZE ? needed + 1 : BUFFER_SIZE;
+        p->buffer = (char*)malloc(p->size);
         p->offset = 0;
-        p->size = BUFFER_SIZE;
+        if (!p->buffer) {
+            p->failed = true;
+            return 0;
+        }
     }
-    needed += p->offset + 1;
-    if (needed <= p->size) {
+    if (p->buffer && p->offset + needed + 1 <= p->size) {
         return p->buffer + p->offset;
     }
-    // Simple double diff
-    new_size = p->size + (needed - p->size) * 2;
-    new_buf = (char*)malloc(new_size);
-    if (!new_buf) {
+    if (p->fixed) {
+        p->failed = true;
+        return 0;
+    }
+    if (p->chain) {
+        // Next chunk, the full one becomes an iovec
+        int size = needed + 1 > HJSON_CHAIN_CHUNK ? needed + 1 : HJSON_CHAIN_CHUNK;
+        char* chunk = (char*)HJson_arenaAlloc(p->chain->arena, size);
+        if (!HJson_chainFlush(p) || !chunk) {
+            p->failed = true;
+            return 0;
+        }
+        p->buffer = chunk;
         p->offset = 0;
-        p->size = 0;
+        p->size = size;
+        p->chain->pending = chunk;
+        return chunk;
+    }
+    // Doubling keeps the copies linear in the output
+    int new_size = p->size * 2 > p->offset + needed + 1 ? p->size * 2 : p->offset + needed + 1;
+    char* new_buf = (char*)realloc(p->buffer, new_size);
+    if (!new_buf) {
+        p->failed = true;
         return 0;
     }
-    memcpy(new_buf, p->buffer, p->size);
-    free(p->buffer);
     p->buffer = new_buf;
     p->size = new_size;
     return p->buffer + p->offset;
 }
 
+static void HJson_append(HJson_buffer* const p, const char* v, int v_len);
+
 static void HJson_concat(HJson_buffer* const p, const char* v) {
-    char* out = 0;
-    int v_len = strlen(v);
-    out = HJson_avoid(p, v_len);
+    HJson_append(p, v, strlen(v));
+}
+
+static void HJson_append(HJson_buffer* const p, const char* v, int v_len) {
+    // Most appends fit, only growth takes the call
+    char* out = p->buffer && p->offset + v_len < p->size ? p->buffer + p->offset : HJson_avoid(p, v_len);
     if (out) {
-        strcpy(out, v);
+        memcpy(out, v, v_len);
+        out[v_len] = '\0';
         p->offset += v_len;
     }
 }
 
+// Quoted, with what JSON does not allow raw escaped again. Runs without
+// anything to escape go out in one piece.
+static void HJson_writeEscaped(HJson_buffer* const buf, const char* s) {
+    const char* end = s + strlen(s);
+    HJson_append(buf, "\"", 1);
+    while (s < end) {
+        const char* run = HJson_scanString(s, end);
+        if (buf->chain && run - s >= HJSON_CHAIN_DIRECT) {
+            // Long clean run, point at it
+            if (!HJson_chainFlush(buf) || !HJson_chainPush(buf->chain, s, run - s)) {
+                buf->failed = true;
+            }
+        } else {
+            HJson_append(buf, s, run - s);
+        }
+        if (run == end) {
+            break;
+        }
+        char esc[8];
+        switch (*run)
+        {
+        case '\"': HJson_append(buf, "\\\"", 2); break;
+        case '\\': HJson_append(buf, "\\\\", 2); break;
+        case '\b': HJson_append(buf, "\\b", 2); break;
+        case '\f': HJson_append(buf, "\\f", 2); break;
+        case '\n': HJson_append(buf, "\\n", 2); break;
+        case '\r': HJson_append(buf, "\\r", 2); break;
+        case '\t': HJson_append(buf, "\\t", 2); break;
+        default:
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*run);
+            HJson_append(buf, esc, 6);
+            break;
+        }
+        s = run + 1;
+    }
+    HJson_append(buf, "\"", 1);
+}
+
+static const char HJson_digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Decimal digits of v at out, two per step. @return end, not terminated
+static char* HJson_u64toa(char* out, uint64_t v) {
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        unsigned pair = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = HJson_digitPairs[pair + 1];
+        *--p = HJson_digitPairs[pair];
+    }
+    if (v >= 10) {
+        *--p = HJson_digitPairs[v * 2 + 1];
+        *--p = HJson_digitPairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return out + len;
+}
+
+// Fixed notation for doubles with up to 8 decimals and below 2^53 scaled,
+// the usual prices and coordinates: the fewest decimals k for which
+// m / 10^k reads back as dv. Division by an exact power of ten is what the
+// parser's fast path does, so the digits round-trip. @return end, 0 if no k fits
+static char* HJson_fixedtoa(char* out, double dv) {
+    double a = fabs(dv);
+    if (a < 1e-5 || a >= 1e15) {
+        return 0;
+    }
+    for (int k = 1; k <= 8; ++k) {
+        double scaled = a * HJson_pow10[k];
+        if (scaled >= 9007199254740992.0) {
+            return 0;
+        }
+        uint64_t m = (uint64_t)(scaled + 0.5);
+        if ((double)m / HJson_pow10[k] != a) {
+            continue;
+        }
+        char digits[24];
+        char* end = HJson_u64toa(digits, m);
+        int len = end - digits;
+        char* p = out;
+        if (dv < 0) {
+            *p++ = '-';
+        }
+        if (len <= k) {
+            // 0.00ddd
+            *p++ = '0';
+            *p++ = '.';
+            memset(p, '0', k - len);
+            p += k - len;
+            memcpy(p, digits, len);
+            return p + len;
+        }
+        memcpy(p, digits, len - k);
+        p += len - k;
+        *p++ = '.';
+        memcpy(p, digits + len - k, k);
+        return p + k;
+    }
+    return 0;
+}
+
+// Integers come out exact from lv. Doubles take the fewest significant
+// digits(15 to 17, any for subnormals) that read back to the same value, so 0.1 stays 0.1 and
+// nothing is lost; NaN and infinities have no JSON form and become null.
 static bool HJson_writeNumber(HJson *const node, HJson_buffer * const buf) {
-    char* out = 0;
+    // Formatted aside, HJson_measure counts the actual length only
+    char out[32];
+    char* end = out;
     double dv = node->dv;
-    int iv = node->biv;
-    if (dv < DBL_EPSILON) {
-        // Special zero
-        out = (char*)malloc(2);
-        if (out) {
-            strcpy(out, "0");
-        }
-    } else if (fabs((double)iv - dv) <= DBL_EPSILON && (dv <= INT_MAX) && (dv >= INT_MIN)) {
-        // Integer
-        out = (char*)malloc(21);
-        if (out) {
-            sprintf(out, "%d", iv);
+    if (node->integral || (dv == floor(dv) && fabs(dv) < 9007199254740992.0 && !std::signbit(dv))) {
+        // Exact integer, from lv or a double below 2^53, -0 is left to printf
+        int64_t lv = node->integral ? node->lv : (int64_t)dv;
+        if (lv < 0) {
+            *end++ = '-';
         }
+        end = HJson_u64toa(end, lv < 0 ? 0 - (uint64_t)lv : (uint64_t)lv);
+    } else if (dv != dv || dv - dv != 0) {
+        memcpy(end, "null", 4);
+        end += 4;
+    } else if ((end = HJson_fixedtoa(out, dv)) != 0) {
+        // Short decimal, no printf needed
     } else {
-        // Floating
-        out = (char*)malloc(64);
-        if (out) {
-            if ((dv * 0) != 0) {
-                sprintf(out, "null");
-            } else if (fabs(floor(dv) - dv) <= DBL_EPSILON && dv < 1.0e60) {
-                sprintf(out, "%0.f", dv);
-            } else if (fabs(dv) < 1.0e-6 || fabs(dv) > 1.0e9) {
-                sprintf(out, "%e", dv);
-            } else {
-                sprintf(out, "%f", dv);
+        end = out;
+        int len = 0;
+        // Subnormals carry fewer bits, their shortest form may be shorter
+        int precision = fabs(dv) < 2.2250738585072014e-308 ? 1 : 15;
+        for (; precision <= 17; ++precision) {
+            len = snprintf(out, 32, "%.*g", precision, dv);
+            if (precision == 17 || strtod(out, 0) == dv) {
+                break;
             }
         }
+        end += len;
     }
-    if (out) {
-        HJson_concat(buf, out);
-        free(out);
-        return true;
-    }
-    free(out);
-    return false;
+    HJson_append(buf, out, end - out);
+    return !buf->failed;
 }
 
 static bool HJson_writeString(HJson *const node, HJson_buffer * const buf) {
-    const char* inner_sv = node->sv;
-    // Begin
-    HJson_concat(buf, "\"");
-    HJson_concat(buf, inner_sv);
-    // End
-    HJson_concat(buf, "\"");
+    HJson_writeEscaped(buf, node->sv);
     return true;
 }   
 
 static bool HJson_writeArray(HJson *const node, HJson_buffer * const buf) {
     // Begin
-    HJson_concat(buf, "[");
+    HJson_append(buf, "[", 1);
     HJson* ptr = node->child;
     while (ptr) {
         if (!HJson_writeValue(ptr, buf)) {
             // If failed, write double quotation.
-            HJson_concat(buf, "\"Error array\"");
+            HJson_append(buf, "\"Error array\"", 13);
         }
         if (ptr->next) {
             // Comma separator
-            HJson_concat(buf, ",");
+            HJson_append(buf, ",", 1);
         }
         ptr = ptr->next;
     }
     // End
-    HJson_concat(buf, "]");
+    HJson_append(buf, "]", 1);
     return true;
 }
 
 static bool HJson_writeObject(HJson *const node, HJson_buffer * const buf) {
     // Begin
-    HJson_concat(buf, "{");
+    HJson_append(buf, "{", 1);
     const char* obj_key = 0;
     HJson* ptr = node->child;
     while (ptr) {
         // Write key
         obj_key = ptr->key;
-        HJson_concat(buf, "\"");
-        HJson_concat(buf, obj_key);
-        HJson_concat(buf, "\"");
+        HJson_writeEscaped(buf, obj_key);
         // Write separator
-        HJson_concat(buf, ":");
+        HJson_append(buf, ":", 1);
         // Write value
         if (!HJson_writeValue(ptr, buf)) {
             // If failed, write double quotation.
-            HJson_concat(buf, "\"Error Object\"");
+            HJson_append(buf, "\"Error Object\"", 14);
         }
         // Write separator
         if (ptr->next) {
-            HJson_concat(buf, ",");
+            HJson_append(buf, ",", 1);
         }
         ptr = ptr->next;
     }
     //End
-    HJson_concat(buf, "}");
+    HJson_append(buf, "}", 1);
     return true;
 }
 
@@ -553,13 +1784,13 @@ static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
     case ValueType::kObject:
         return HJson_writeObject(node, buf);
     case ValueType::kNull:
-        HJson_concat(buf, "null");
+        HJson_append(buf, "null", 4);
         return true;
     case ValueType::kBooleanTrue:
-        HJson_concat(buf, "true");
+        HJson_append(buf, "true", 4);
         return true;
     case ValueType::kBooleanFalse:
-        HJson_concat(buf, "false");
+        HJson_append(buf, "false", 5);
         return true;
     case ValueType::kNumber:
         return HJson_writeNumber(node, buf);
@@ -570,33 +1801,136 @@ static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
     }
 }
 
+// Longest output of a string: quotes, runs copied, escapes 2 or 6 bytes
+static size_t HJson_measureEscaped(const char* s) {
+    const char* end = s + strlen(s);
+    size_t size = 2;
+    while (s < end) {
+        const char* run = HJson_scanString(s, end);
+        size += run - s;
+        if (run == end) {
+            break;
+        }
+        char c = *run;
+        size += c == '\"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t' ? 2 : 6;
+        s = run + 1;
+    }
+    return size;
+}
+
+static size_t HJson_measureNumber(HJson* const node) {
+    double dv = node->dv;
+    if (node->integral || (dv == floor(dv) && fabs(dv) < 9007199254740992.0 && !std::signbit(dv))) {
+        int64_t lv = node->integral ? node->lv : (int64_t)dv;
+        uint64_t v = lv < 0 ? 0 - (uint64_t)lv : (uint64_t)lv;
+        size_t size = lv < 0 ? 2 : 1;
+        while (v >= 10) {
+            v /= 10;
+            size++;
+        }
+        return size;
+    }
+    // "null", or %.17g at its longest: -1.2345678901234567e-308
+    return dv != dv || dv - dv != 0 ? 4 : 24;
+}
+
+// Size pass: bytes HJson_write would produce for node, exact but for
+// doubles, which count at their longest. A buffer of HJson_measure() + 1
+// always fits the output.
+static size_t HJson_measure(HJson* const node) {
+    switch (node->type)
+    {
+    case ValueType::kArray:
+    case ValueType::kObject: {
+        size_t size = 2;
+        for (HJson* ptr = node->child; ptr; ptr = ptr->next) {
+            if (node->type == ValueType::kObject) {
+                size += HJson_measureEscaped(ptr->key) + 1;
+            }
+            size += HJson_measure(ptr) + (ptr->next ? 1 : 0);
+        }
+        return size;
+    }
+    case ValueType::kNull:
+    case ValueType::kBooleanTrue:
+        return 4;
+    case ValueType::kBooleanFalse:
+        return 5;
+    case ValueType::kNumber:
+        return HJson_measureNumber(node);
+    case ValueType::kString:
+        return HJson_measureEscaped(node->sv);
+    default:
+        // The error strings containers write instead
+        return 14;
+    }
+}
+
+// Serialize into out[0, size), terminated. No allocation at all.
+// @return length, -1 when the output does not fit(size it with HJson_measure)
+static int HJson_writeTo(HJson *const node, char* out, size_t size) {
+    if (!node || !out || !size) {
+        return -1;
+    }
+    HJson_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.buffer = out;
+    buf.size = size > INT_MAX ? INT_MAX : (int)size;
+    buf.fixed = true;
+    if (!HJson_writeValue(node, &buf) || buf.failed) {
+        return -1;
+    }
+    out[buf.offset] = '\0';
+    return buf.offset;
+}
+
+// One allocation sized by HJson_measure, written once. Release with free.
 static const char* HJson_write(HJson *const node, int& length) {
     if (!node) {
         return 0;
     }
-    HJson_buffer* inner_buffer;
-    inner_buffer = (HJson_buffer*)malloc(sizeof(HJson_buffer));
-    if (!inner_buffer) {
+    size_t size = HJson_measure(node) + 1;
+    if (size > INT_MAX) {
         return 0;
     }
-    memset(inner_buffer, 0, sizeof(HJson_buffer));
-    if (!HJson_writeValue(node, inner_buffer)) {
-        free(inner_buffer->buffer);
-        free(inner_buffer);
+    char* out = (char*)malloc(size);
+    if (!out) {
         return 0;
     }
-    // Copy
-    char* ret_buf;
-    ret_buf = (char*)malloc(inner_buffer->offset + 1);
-    if (!ret_buf) {
+    int len = HJson_writeTo(node, out, size);
+    if (len < 0) {
+        free(out);
         return 0;
     }
-    length = inner_buffer->offset;
-    memset(ret_buf, 0, inner_buffer->offset + 1);
-    memcpy(ret_buf, inner_buffer->buffer, inner_buffer->offset + 1);
-    free(inner_buffer->buffer);
-    free(inner_buffer);
-    return ret_buf;
+    length = len;
+    return out;
+}
+
+static void HJson_chainInit(HJson_chain* chain, HJson_arena* arena) {
+    memset(chain, 0, sizeof(HJson_chain));
+    chain->arena = arena;
+}
+
+// Frees the iovec array, the chunks belong to the arena
+static void HJson_chainFree(HJson_chain* chain) {
+    free(chain->iov);
+    chain->iov = 0;
+    chain->count = 0;
+    chain->cap = 0;
+}
+
+// Serialize as iovecs appended to `chain`, for writev straight to a socket:
+// nothing is copied twice and long strings not at all. Valid until the
+// arena is reset and while the tree lives.
+static bool HJson_writeChain(HJson *const node, HJson_chain* chain) {
+    if (!node || !chain || !chain->arena) {
+        return false;
+    }
+    HJson_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.chain = chain;
+    bool ok = HJson_writeValue(node, &buf) && !buf.failed;
+    return HJson_chainFlush(&buf) && ok;
 }
 
 static HJson* HJson_createNumber(double v) {
@@ -606,11 +1940,26 @@ static HJson* HJson_createNumber(double v) {
         return 0;
     }
     node->type = ValueType::kNumber;
-    node->biv = (int)v;
+    node->lv = v >= (double)INT64_MIN && v < (double)INT64_MAX ? (int64_t)v : 0;
+    node->biv = node->lv >= INT_MIN && node->lv <= INT_MAX ? (int)node->lv : 0;
     node->dv = v;
     return node;
 }
 
+static HJson* HJson_createInt64(int64_t v) {
+    HJson* node = 0;
+    node = HJson_new();
+    if (!node) {
+        return 0;
+    }
+    node->type = ValueType::kNumber;
+    node->integral = true;
+    node->lv = v;
+    node->biv = v >= INT_MIN && v <= INT_MAX ? (int)v : 0;
+    node->dv = (double)v;
+    return node;
+}
+
 static HJson* HJson_createBoolean(bool v) {
     HJson* node = 0;
     node = HJson_new();
@@ -658,6 +2007,10 @@ static void HJson_addItem(HJson* container, HJson* item) {
     if (!item) {
         return;
     }
+    if (container->index) {
+        // Rebuilt on the next lookup
+        container->index->count = 0;
+    }
     if (!child) {
         container->child = item;
     } else {
@@ -679,7 +2032,10 @@ static void HJson_addItemToObject(HJson* container, const char* key, HJson* item
     HJson_addItem(container, item);
 }
 
+// Where the calling thread's last parse failed, "" after a success. Use
+// HJson_parseContext for the error code and offset.
 static const char* HJson_getError() {
+    const char* ep = HJson_lastError();
     return ep ? ep : "";
 }
 
@@ -0,0 +1,125 @@
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <csignal>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+enum class IoBackend {
+    kEpoll,
+    kUring
+};
+
+/*
+ * io_uring over the raw syscalls, liburing is not a dependency. Covers what
+ * the proxy needs: multishot accept/recv, send, connect, cancel and close,
+ * plus a registered ring of provided buffers for the multishot recvs. One
+ * ring per thread, not thread safe.
+ */
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /// @brief Kernel has io_uring with every feature used here(6.0+).
+    static bool Supported();
+
+    /// @param entries submission queue size, the completion queue is twice it
+    /// @param single_issuer only the calling thread ever submits
+    bool Init(unsigned entries, bool single_issuer);
+
+    /// @brief Register `count`(power of two) buffers of `size` bytes as
+    ///        buffer group `group` for recvs with buffer selection.
+    bool SetupBuffers(uint16_t group, unsigned count, unsigned size);
+
+    const char* Buffer(unsigned bid) const { return buffers_ + static_cast<size_t>(bid) * buffer_size_; }
+
+    /// @brief Hand buffer `bid` back to the kernel once its data is consumed.
+    void RecycleBuffer(unsigned bid);
+
+    /// @return nullptr only if the ring could not be flushed to make room
+    struct io_uring_sqe* GetSqe();
+
+    struct io_uring_sqe* PrepAcceptMultishot(int fd, int flags, uint64_t user_data);
+
+    struct io_uring_sqe* PrepRecvMultishot(int fd, uint16_t group, uint64_t user_data);
+
+    struct io_uring_sqe* PrepSend(int fd, const void* buf, size_t len, int flags, uint64_t user_data);
+
+    struct io_uring_sqe* PrepConnect(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t user_data);
+
+    struct io_uring_sqe* PrepRead(int fd, void* buf, unsigned len, uint64_t user_data);
+
+    struct io_uring_sqe* PrepPollMultishot(int fd, unsigned events, uint64_t user_data);
+
+    /// @brief Cancel every request on `fd`.
+    struct io_uring_sqe* PrepCancelFd(int fd, uint64_t user_data);
+
+    struct io_uring_sqe* PrepClose(int fd, uint64_t user_data);
+
+    /// @brief Submit what is queued without waiting.
+    int Submit();
+
+    /// @brief Submit what is queued and wait for `wait_nr` completions.
+    /// @param timeout_ms -1 waits forever
+    /// @param sigmask signal mask while waiting, like epoll_pwait
+    /// @return 0, -ETIME on timeout, -EINTR on a signal or another -errno
+    int Wait(unsigned wait_nr, int timeout_ms, const sigset_t* sigmask = nullptr);
+
+    /// @brief Call `f(cqe)` for every completion ready, then release them.
+    template <typename F>
+    unsigned ForEachCqe(F f) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        for (; head != tail; ++head, ++n) {
+            f(cqes_[head & cq_mask_]);
+            // Release one by one, `f` may recycle buffers or submit
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        }
+        return n;
+    }
+
+private:
+    unsigned pendingSqes() const;
+
+    unsigned readyCqes() const;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz);
+
+private:
+    int fd_;
+    int ring_index_;
+    unsigned features_;
+
+    void* sq_ptr_;
+    size_t sq_size_;
+    void* cq_ptr_;
+    size_t cq_size_;
+    struct io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    struct io_uring_buf_ring* buf_ring_;
+    size_t buf_ring_size_;
+    char* buffers_;
+    unsigned buffer_count_;
+    unsigned buffer_size_;
+};
+
+#endif // IO_URING_HPP
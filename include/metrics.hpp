@@ -0,0 +1,133 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+using SteadyClock = std::chrono::steady_clock;
+
+enum class Stage {
+    kAcceptParse = 0,
+    kCacheLookup,
+    kOriginConnect,
+    kTlsHandshake,
+    kOriginTtfb,
+    kBodyTransfer,
+    kClientWrite,
+    kStageCount
+};
+
+enum class Counter {
+    kRequests = 0,
+    kHit,
+    kMiss,
+    kNegativeHit,
+    kStale,
+    kEvict,
+    kExpire,
+    kOriginError,
+    kBytesIn,
+    kBytesOut,
+    kOriginBytesIn,
+    kAccessLogDropped,
+    kShedConnection,
+    kShedOrigin,
+    kRateLimited,
+    kAcceptError,
+    kHeaderTimeout,
+    kBodyTimeout,
+    kIdleTimeout,
+    kWriteTimeout,
+    kTlsHandshake,
+    kTlsResumed,
+    kTlsHandshakeError,
+    kTlsKtls,
+    kPassThrough,
+    kInvalidation,
+    kJsonMinified,
+    kJsonMinifySaved,
+    kJsonMinifyFailed,
+    kJsonSelect,
+    kCounterCount
+};
+
+/*
+ * Log-linear(HDR style) latency buckets in microseconds: values below 16 get
+ * their own bucket, above that every power of two is split in 16 sub buckets,
+ * so any recorded value is off by less than 1/16.
+ */
+#define METRICS_SUB_BUCKETS 16
+#define METRICS_SUB_BITS 4
+#define METRICS_MAX_EXP 36
+#define METRICS_BUCKETS (METRICS_SUB_BUCKETS + (METRICS_MAX_EXP - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+// Written by exactly one thread, read by the snapshot
+struct MetricsSlab {
+    std::atomic<uint64_t> counters[static_cast<int>(Counter::kCounterCount)];
+    std::atomic<uint64_t> buckets[static_cast<int>(Stage::kStageCount)][METRICS_BUCKETS];
+    std::atomic<uint64_t> sum_us[static_cast<int>(Stage::kStageCount)];
+};
+
+// Stage latencies of the request a thread is handling
+struct RequestStages {
+    uint32_t us[static_cast<int>(Stage::kStageCount)];
+};
+
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum_us;
+
+    /// @return upper bound(us) of the bucket holding quantile `q`
+    uint64_t Quantile(double q) const;
+};
+
+class Metrics {
+public:
+    Metrics(const Metrics&) = delete;
+    Metrics(const Metrics&&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&&) = delete;
+    virtual ~Metrics();
+
+    static Metrics& GetInstance();
+
+    void Add(Counter counter, uint64_t n = 1);
+
+    void Observe(Stage stage, SteadyClock::time_point begin, SteadyClock::time_point end);
+
+    void ObserveUs(Stage stage, uint64_t us);
+
+    /// @brief Also add every stage this thread observes into `stages`,
+    ///        nullptr unbinds.
+    void BindRequest(RequestStages* stages);
+
+    uint64_t GetCounter(Counter counter);
+
+    HistogramSnapshot GetHistogram(Stage stage);
+
+    /// @brief Render every slab in Prometheus text exposition format.
+    void Render(std::string& out);
+
+    static size_t BucketIndex(uint64_t us);
+
+    static uint64_t BucketUpper(size_t idx);
+
+    static const char* StageName(Stage stage);
+
+private:
+    Metrics();
+
+    MetricsSlab* slab();
+
+private:
+    std::mutex mtx_;
+    std::vector<MetricsSlab*> slabs_;
+};
+
+#endif // METRICS_HPP
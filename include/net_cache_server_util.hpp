@@ -3,12 +3,25 @@
 
 #include <string>
 #include <cstdint>
+#include <climits>
 #include <regex>
+#include <sstream>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/signal.h>
 #include <sys/types.h>
@@ -16,13 +29,18 @@
 #include <sys/stat.h>
 #include "err.hpp"
 #include "cache_timer.hpp"
+#include "cache_key.hpp"
 #include "net_client_util.hpp"
-
-#define NAMED_PIPE "/tmp/net_cache_server_pipe"
-
-struct PipeMessage {
-    int pid;
-};
+#include "control_socket.hpp"
+#include "cache_warmer.hpp"
+#include "metrics.hpp"
+#include "access_log.hpp"
+#include "trace.hpp"
+#include "capture.hpp"
+#include "rate_limiter.hpp"
+#include "hjson.hpp"
+#include "timer_wheel.hpp"
+#include "io_uring.hpp"
 
 enum class HttpReqParseStatus {
     kParseRequestLine,
@@ -40,6 +58,51 @@ struct HttpRequest {
     std::string body;
 };
 
+enum class ConnState {
+    kHandshake,
+    kReadHeader,
+    kReadBody,
+    // io_uring: a streamed request waits for its recv to be cancelled
+    kHandoff,
+    kProcessing,
+    kWrite
+};
+
+// One client connection, owned by the event loop except while a worker
+// holds it in kProcessing, polled only while a read or write would block
+struct ClientConn {
+    ~ClientConn() {
+        if (ssl) {
+            SSL_free(ssl);
+        }
+    }
+
+    int fd = -1;
+    SSL* ssl = nullptr;
+    ConnState state = ConnState::kReadHeader;
+    std::string in;
+    size_t header_len = 0;
+    size_t body_len = 0;
+    // Non-GET: the body is relayed to origin by the worker, not buffered
+    bool stream = false;
+    std::string out;
+    size_t written = 0;
+    bool polled = false;
+    // io_uring requests that still refer to it
+    int inflight = 0;
+    bool receiving = false;
+    SteadyClock::time_point accepted;
+    SteadyClock::time_point phase_deadline;
+    SteadyClock::time_point last_active;
+    SteadyClock::time_point write_begin;
+    TimerNode timer;
+    RequestTrace trace;
+    RequestStages stages{};
+    HttpRequest req{};
+    HttpResponse resp{};
+    CacheStatus cache_status = CacheStatus::kAdmin;
+};
+
 class NetCacheServerUtil {
 public:
     NetCacheServerUtil(const NetCacheServerUtil&) = delete;
@@ -52,44 +115,279 @@ public:
 
     void Init(int port, int keep_alive_seconds = 300, const char* ip = "127.0.0.1", bool is_ssl = false);
 
+    /// @brief Cache 404/410 replies and upstream failures for `ttl_seconds`.
+    /// @param ttl_seconds 0 disables negative caching
+    void SetNegativeCache(int ttl_seconds);
+
+    /// @brief Cache application/json replies re-serialized without whitespace,
+    ///        Content-Length follows. Bodies that do not parse are kept as is.
+    void SetMinifyJson(bool minify);
+
+    /// @brief Keep application/json replies parsed next to their bytes and
+    ///        answer `?select=a,b` of a url by projecting the fields out of
+    ///        the document of the url without select.
+    void SetJsonSelect(bool select);
+
+    /// @brief Serve Prometheus metrics on `path`, empty disables.
+    void SetMetricsPath(const std::string& path);
+
+    /// @brief Warm up `path` once the origin client is ready.
+    void SetWarmFile(const std::string& path);
+
+    /// @brief Serve connections from `workers` threads.
+    void SetWorkers(int workers);
+
+    /// @brief Overload caps, requests beyond them get a fast 503.
+    /// @param max_connections connections queued or in service, 0 unlimited
+    /// @param max_origin_fetches misses fetching from origin at once, 0 for
+    ///        workers - 1. Kept below workers so hits always find one free.
+    void SetOverload(size_t max_connections, int max_origin_fetches);
+
+    /// @brief Token bucket per client address, 429 beyond it.
+    /// @param rate requests per second, 0 disables
+    /// @param burst requests a client may send at once
+    void SetRateLimit(double rate, double burst);
+
+    /// @brief Client deadlines enforced by the event loop, 0 disables one.
+    /// @param header_ms accept to the end of the request headers
+    /// @param body_ms end of headers to the end of the request body
+    /// @param idle_ms longest gap without any bytes moving
+    /// @param write_ms whole response written to the client
+    void SetTimeouts(int header_ms, int body_ms, int idle_ms, int write_ms);
+
+    /// @brief Certificate chain and key(PEM) of the HTTPS listener, used when
+    ///        Init() was given is_ssl.
+    /// @param session_cache_size TLS 1.2 sessions kept for resumption, 0
+    ///        leaves only tickets
+    void SetTls(const std::string& cert_file, const std::string& key_file, long session_cache_size = 20480);
+
+    /// @brief Client socket I/O through epoll(default) or io_uring, origin
+    ///        fetches follow. Falls back to epoll where io_uring is missing.
+    void SetIoBackend(IoBackend backend);
+
     void Start(const std::string& forward_origin);
 
+    /// @brief Bring `url` into cache unless it is already there, thread safe.
+    ///        Waits for an origin slot below half the cap, never shed. A cap
+    ///        of 1 is left to client misses and warm-up runs without a slot.
+    /// @return false if origin could not be reached
+    bool Prefetch(const std::string& url);
+
     static void SignalHandler(int sig);
 
 private:
-    NetCacheServerUtil();
+    friend struct MicroBench;
 
-    void readMsg(int clisock, std::string& req);
+    // Low bits of a connection's io_uring user_data
+    enum class UringOp : uint64_t {
+        kRecv = 0,
+        kSend,
+        kCancel,
+        kClose
+    };
 
-    void writeMsg(int clisock, const std::string& resp);
+    // How a streamed body relay ended
+    enum class RelayResult {
+        kDone,
+        kClientGone,
+        kClientTimeout,
+        kOriginFailed
+    };
+
+    NetCacheServerUtil();
 
-    void parseHttpRequest(const std::string& req);
+    void parseHttpRequest(const std::string& req, HttpRequest& http_req);
 
-    void parseRequestLine(const std::string& line);
+    void parseRequestLine(const std::string& line, HttpRequest& http_req, HttpReqParseStatus& status);
 
-    void parseHeaderField(const std::string& line);
+    void parseHeaderField(const std::string& line, HttpRequest& http_req, HttpReqParseStatus& status);
 
-    void parseMessageBody(const std::string& line);
+    void parseMessageBody(const std::string& line, HttpRequest& http_req, HttpReqParseStatus& status);
 
     void constructHttpResponse(const HttpResponse& resp_origin, std::string& resp);
 
-    void handleConnect(int clisock);
+    /// @brief Admission on the event loop: rate limit, connection cap, then
+    ///        start reading the request.
+    void dispatch(int clisock, const struct sockaddr_in& cliaddr);
+
+    void initTls();
+
+    /// @brief Drive the server handshake, then read the request.
+    void handshakeConnect(ClientConn* conn);
+
+    /// @brief recv/send over plain TCP or TLS, -1 with EAGAIN when blocked.
+    ssize_t recvConnect(ClientConn* conn, char* buf, size_t n);
+
+    ssize_t sendConnect(ClientConn* conn, const char* buf, size_t n);
+
+    /// @brief Drain readable bytes, hand the request to a worker once whole.
+    void readConnect(ClientConn* conn);
+
+    /// @brief Check what has arrived past `scanned`, queue the request once
+    ///        whole or wait for more.
+    void consumeRequest(ClientConn* conn, size_t scanned, bool eof);
+
+    void waitRequest(ClientConn* conn, SteadyClock::time_point now);
+
+    /// @brief Hand a whole request, or the head of a streamed one, to a worker.
+    void queueRequest(ClientConn* conn, SteadyClock::time_point now);
+
+    /// @brief Worker side: parse, serve from cache or origin, build the reply.
+    void handleRequest(ClientConn* conn);
+
+    /// @brief Worker side of a non-GET request: relay the body to origin and
+    ///        the response back, invalidate the cached url.
+    /// @return false if nothing was sent, conn->resp then holds the error reply
+    bool streamRequest(ClientConn* conn);
+
+    /// @brief Move `len` bytes, up to EOF for SIZE_MAX, between the client and
+    ///        origin. `pipefd` splices plain sockets, {-1, -1} copies.
+    RelayResult relay(ClientConn* conn, OriginStream& origin, const int pipefd[2], bool upload,
+        size_t len, SteadyClock::time_point deadline, size_t& moved);
+
+    /// @brief Worker side blocking send to the nonblocking client socket.
+    RelayResult sendClient(ClientConn* conn, const char* buf, size_t n, SteadyClock::time_point deadline);
+
+    /// @brief Wait for `events` on the client within `deadline` and the idle
+    ///        timeout, counting `expired` or an idle timeout when it passes.
+    bool waitClient(ClientConn* conn, short events, SteadyClock::time_point deadline, Counter expired);
+
+    /// @brief Event loop side of the reply, polls for the rest if needed.
+    void writeConnect(ClientConn* conn);
+
+    /// @brief Push as much of the reply as the socket takes.
+    /// @return false if the socket is full and the reply is not done
+    bool sendReply(ClientConn* conn);
+
+    /// @brief Register for `events` and arm the connection deadline.
+    void pollConnect(ClientConn* conn, uint32_t events, SteadyClock::time_point now);
+
+    /// @brief Metrics, trace, access log and capture of a served request,
+    ///        close_notify on TLS.
+    void finishConnect(ClientConn* conn);
+
+    /// @brief Close now, free after the current event batch.
+    void closeConnect(ClientConn* conn);
+
+    /// @brief Best-effort reply on a connection that is being dropped.
+    void abortConnect(ClientConn* conn, const char* resp);
+
+    void armTimer(ClientConn* conn, SteadyClock::time_point now);
+
+    void expireConnect(ClientConn* conn);
+
+    /// @brief Free closed connections nothing in flight refers to.
+    void reapClosed();
+
+    /// @brief Start writing the replies workers have built.
+    void flushReplies();
+
+    void runEpoll();
+
+    void runUring();
+
+    static uint64_t uringData(ClientConn* conn, UringOp op);
+
+    void uringRecv(ClientConn* conn);
+
+    void uringSend(ClientConn* conn);
+
+    void uringComplete(const struct io_uring_cqe& cqe);
+
+    void rejectConnect(int clisock, int status_code);
+
+    void startWorkers();
+
+    void stopWorkers();
+
+    void handleControl(int ctlsock);
+
+    void handleMetrics(HttpResponse& resp_metrics);
+
+    void logAccess(CacheStatus cache_status, const HttpRequest& req, const HttpResponse& resp, size_t bytes, const RequestStages& stages);
+
+    void captureRequest(CacheStatus cache_status, const HttpRequest& req, const HttpResponse& resp);
+
+    /// @brief Replace the body of `resp` with `json` written compactly and fix
+    ///        up its headers.
+    void minifyJson(HttpResponse& resp, HJson* json);
+
+    /// @brief Answer a `select=a,b` request from the cache entry of its url
+    ///        without select, fetching that from origin on a miss. Entries
+    ///        without a document are answered as they are.
+    /// @return false if the request has no select
+    bool selectJson(const HttpRequest& req, SteadyClock::time_point parsed, HttpResponse& resp, CacheStatus& cache_status);
+
+    /// @brief Reply with cache entry `cache` as a hit.
+    void replyCache(const TMDBCache& cache, HttpResponse& resp, CacheStatus& cache_status);
 
     void extendHeader(HttpResponse& resp, const char* extend);
 
+    void joinHeader(const HttpResponse& resp, std::string& header_origin);
+
+    /// @brief Fetch `req` from origin and cache the reply as a miss would.
+    /// @return false if origin could not be reached
+    bool fetchOrigin(const HttpRequest& req, const std::string& cache_key, HttpResponse& resp_origin);
+
+    /// @brief fetchOrigin without the cap check, the caller holds an origin slot.
+    bool loadOrigin(const HttpRequest& req, const std::string& cache_key, HttpResponse& resp_origin);
+
+    bool lookupCache(const HttpRequest& req, const std::string& primary, TMDBCache& cache);
+
+    void storeCache(const HttpRequest& req, const std::string& primary, const HttpResponse& resp, const TMDBCache& cache, int negative_ttl = 0);
+
 private:
     std::string ip_;
     uint16_t port_;
     int keep_alive_seconds_;
+    std::atomic<int> negative_ttl_seconds_;
+    bool minify_json_;
+    bool json_select_;
     bool is_ssl_;
 
     sigset_t sigmask_, origmask_;
     struct sigaction sa_;
 
-    HttpRequest http_req_;
-    HttpReqParseStatus status_;
+    int ctl_fd_;
+    std::string warm_file_;
+    std::string metrics_path_;
+
+    int workers_;
+    size_t max_connections_;
+    int max_origin_fetches_;
+    std::atomic<size_t> connections_;
+    std::atomic<int> origin_fetches_;
+    RateLimiter rate_limiter_;
+
+    std::mutex queue_mtx_;
+    std::condition_variable queue_cv_;
+    std::deque<ClientConn*> queue_;
+    bool stopping_;
+    std::vector<std::thread> pool_;
+
+    int epoll_fd_;
+    int wake_fd_;
+    TimerWheel timers_;
+    std::chrono::milliseconds header_timeout_;
+    std::chrono::milliseconds body_timeout_;
+    std::chrono::milliseconds idle_timeout_;
+    std::chrono::milliseconds write_timeout_;
+    // Connections the event loop owns, not those a worker holds
+    std::unordered_set<ClientConn*> conns_;
+    std::vector<ClientConn*> closed_;
+    // Replies built by workers, written back by the event loop
+    std::mutex done_mtx_;
+    std::vector<ClientConn*> done_;
+
+    std::string tls_cert_;
+    std::string tls_key_;
+    long tls_session_cache_;
+    SSL_CTX* ssl_ctx_;
 
-    int pipe_fd_;
+    IoBackend io_backend_;
+    std::unique_ptr<IoUring> uring_;
+    int listen_fd_;
+    uint64_t wake_count_;
 };
 
 #endif // NET_SERVER_UTIL_HPP
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cstring>
+#include <cerrno>
 #include <stdexcept>
 #include <unordered_map>
 #include <algorithm>
@@ -15,6 +16,9 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "err.hpp"
+#include "io_uring.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 enum class HttpRespParseStatus {
     kParseStatusLine,
@@ -32,6 +36,12 @@ struct HttpResponse {
     std::string body;
 };
 
+/// @brief Origin connection of a streamed request, see NetClientUtil::Open.
+struct OriginStream {
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
+
 class NetClientUtil {
 public:
     NetClientUtil(const NetClientUtil&) = delete;
@@ -44,31 +54,63 @@ public:
 
     void Init(const char* domain, uint16_t port, int timeout = 3, int max_retry = 3, bool is_ssl = false);
 
+    /// @brief Fetch plain http origins over a per-thread io_uring, TLS
+    ///        origins and kernels without it keep blocking sockets.
+    void SetIoBackend(IoBackend backend);
+
     /*
-     * @brief Make HTTP/HTTPS get request.
+     * @brief Make HTTP/HTTPS get request, safe to call from several threads.
      * @param endpoint URL
      * @param header request header
      * @param resp Response message
      */
     int Get(const char* endpoint, const std::string& header, HttpResponse& resp);
 
+    /*
+     * @brief Connect to origin and send the head of a `method` request, the
+     *        caller streams the body and the response through Read/Write.
+     * @param header request header lines, CRLF between them
+     * @return 0, -1 with nothing left open
+     */
+    int Open(const char* method, const char* endpoint, const std::string& header, OriginStream& stream);
+
+    /// @brief read(2)-like on the blocking origin socket, -1 with EAGAIN on timeout.
+    ssize_t Read(OriginStream& stream, char* buf, size_t n);
+
+    /// @brief Write all `n` bytes. @return n, -1 on error or timeout
+    ssize_t Write(OriginStream& stream, const char* buf, size_t n);
+
+    void Close(OriginStream& stream);
+
 private:
+    friend struct MicroBench;
+
     NetClientUtil();
 
-    void constructGetRequest(const char* endpoint, const std::string& header, std::string& req);
+    void constructRequest(const char* method, const char* endpoint, const std::string& header, std::string& req);
+
+    void resolve(struct sockaddr_in& addr);
 
-    void parseHttpResponse(const std::string& resp);
+    void setTimeouts(int sock);
 
-    void parseStatusLine(const std::string& line);
+    /// @brief Connect `sock` and do the TLS handshake for https origins.
+    void connectOrigin(int sock, const struct sockaddr_in& addr, SSL*& ssl);
 
-    void parseHeaderField(const std::string& line);
+    void parseHttpResponse(const std::string& resp, HttpResponse& http_resp);
 
-    void parseMessageBody(const std::string& line);
+    void parseStatusLine(const std::string& line, HttpResponse& http_resp, HttpRespParseStatus& status);
+
+    void parseHeaderField(const std::string& line, HttpResponse& http_resp, HttpRespParseStatus& status);
+
+    void parseMessageBody(const std::string& line, HttpResponse& http_resp, HttpRespParseStatus& status);
 
     int netRead(int sock, char* buf, size_t n, SSL* ssl);
 
     int netWrite(int sock, const char* buf, size_t n, SSL* ssl);
 
+    /// @brief Connect, send `request` and read until EOF or timeout on `ring`.
+    void uringGet(IoUring& ring, int sock, const struct sockaddr_in& addr, const std::string& request, std::string& resp);
+
 private:
     std::string domain_;
     uint16_t port_;
@@ -76,8 +118,7 @@ private:
     int max_retry_;
     bool is_ssl_;
     SSL_CTX* ssl_ctx_;
-    HttpResponse http_resp_;
-    HttpRespParseStatus status_;
+    IoBackend io_backend_;
 };
 
 #endif // NET_CLIENT_UTIL_HPP
\ No newline at end of file
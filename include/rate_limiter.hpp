@@ -0,0 +1,44 @@
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <chrono>
+#include <unordered_map>
+#include <cstdint>
+
+#define RATE_LIMITER_MAX_CLIENTS 65536
+
+/*
+ * Token bucket per client IPv4 address. Each client may burst `burst`
+ * requests, then gets `rate` per second. Owned by the accept loop, not
+ * thread safe.
+ */
+class RateLimiter {
+public:
+    RateLimiter();
+
+    /// @param rate tokens per second, 0 disables limiting
+    /// @param burst bucket size, at least 1
+    void Init(double rate, double burst);
+
+    bool Enabled() const { return rate_ > 0; }
+
+    /// @brief Take one token for `ip`(network byte order).
+    /// @return false if the client is over its rate
+    bool Allow(uint32_t ip, std::chrono::steady_clock::time_point now);
+
+private:
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    // Forget clients whose bucket has refilled, they behave as new ones
+    void prune(std::chrono::steady_clock::time_point now);
+
+private:
+    double rate_;
+    double burst_;
+    std::unordered_map<uint32_t, Bucket> buckets_;
+};
+
+#endif // RATE_LIMITER_HPP
@@ -0,0 +1,67 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/*
+ * Bounded single-producer/single-consumer ring. Slots are allocated up
+ * front, Push/Pop never allocate. Head and tail sit on their own cache
+ * lines so producer and consumer don't bounce one line between cores.
+ */
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : head_(0), tail_(0) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    /// @brief Producer side.
+    /// @return false if full
+    bool Push(const T& v) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[tail & mask_] = v;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Consumer side.
+    /// @return false if empty
+    bool Pop(T& v) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        v = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_;
+    // Padded apart by hand, alignas on heap objects needs C++17 new
+    char pad0_[64];
+    std::atomic<size_t> head_;
+    char pad1_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    char pad2_[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif // SPSC_RING_HPP
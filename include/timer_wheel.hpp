@@ -0,0 +1,85 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+using SteadyTimePoint = std::chrono::steady_clock::time_point;
+
+// Intrusive, embedded in whatever owns the deadline
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expire_tick = 0;
+    void* owner = nullptr;
+
+    bool Scheduled() const { return prev != nullptr; }
+};
+
+/*
+ * Hashed timing wheel: Schedule and Cancel are O(1) list splices, Advance
+ * costs one slot per elapsed tick. Deadlines further than one rotation stay
+ * in their slot and are skipped until their tick comes round. Not thread
+ * safe, owned by the event loop.
+ */
+class TimerWheel {
+public:
+    /// @param tick resolution, deadlines fire up to one tick late
+    /// @param slots wheel size, rounded up to a power of two
+    TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100), size_t slots = 1024);
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /// @brief (Re)arm `node` to fire at `when`.
+    void Schedule(TimerNode* node, SteadyTimePoint when);
+
+    void Cancel(TimerNode* node);
+
+    /// @brief Fire every timer due by `now`, `expired(node)` may reschedule.
+    template <typename F>
+    void Advance(SteadyTimePoint now, F expired) {
+        uint64_t target = tickOf(now);
+        if (size_ == 0) {
+            current_ = std::max(current_, target);
+            return;
+        }
+        while (current_ < target) {
+            ++current_;
+            TimerNode& head = slots_[current_ & mask_];
+            TimerNode* node = head.next;
+            while (node != &head) {
+                TimerNode* next = node->next;
+                if (node->expire_tick <= current_) {
+                    unlink(node);
+                    --size_;
+                    expired(node);
+                }
+                node = next;
+            }
+        }
+    }
+
+    /// @return milliseconds until the next tick with armed timers, -1 if none
+    int NextTimeoutMs(SteadyTimePoint now) const;
+
+    size_t Size() const { return size_; }
+
+private:
+    uint64_t tickOf(SteadyTimePoint tp) const;
+
+    static void unlink(TimerNode* node);
+
+private:
+    std::chrono::milliseconds tick_;
+    size_t mask_;
+    std::vector<TimerNode> slots_;
+    SteadyTimePoint origin_;
+    uint64_t current_;
+    size_t size_;
+};
+
+#endif // TIMER_WHEEL_HPP
@@ -0,0 +1,132 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include "metrics.hpp"
+
+#define TRACE_MAX_SPANS 32
+
+enum class TraceEvent : uint8_t {
+    kRequest = 0,
+    kReadMsg,
+    kParse,
+    kAcceptParse,
+    kCacheLookup,
+    kDnsResolve,
+    kOriginConnect,
+    kTlsHandshake,
+    kOriginSend,
+    kOriginTtfb,
+    kBodyTransfer,
+    kCacheStore,
+    kClientWrite,
+    kEventCount
+};
+
+struct TraceSpan {
+    TraceEvent event;
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+// Fixed-size span buffer of one sampled request, lives on the handler's stack
+struct RequestTrace {
+    TraceSpan spans[TRACE_MAX_SPANS];
+    uint32_t count;
+    bool sampled;
+    SteadyClock::time_point begin;
+};
+
+/*
+ * Opt-in sampled request tracing. 1 of every `sample` requests binds a
+ * RequestTrace to its handler thread, every stage records a span into it,
+ * and requests slower than the threshold are appended to a Chrome
+ * trace-event file(JSON array format, loads in Perfetto or chrome://tracing).
+ * Unsampled requests pay one thread_local load per stage.
+ */
+class Tracer {
+public:
+    Tracer(const Tracer&) = delete;
+    Tracer(const Tracer&&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&&) = delete;
+    virtual ~Tracer();
+
+    static Tracer& GetInstance();
+
+    /// @brief Init
+    /// @param sample trace 1 of every `sample` requests, 0 disables
+    /// @param slow_ms dump sampled requests at least this slow, 0 dumps all
+    /// @param path trace file, truncated
+    /// @return false if the trace file could not be opened
+    bool Init(int sample, int slow_ms, const std::string& path);
+
+    bool Enabled() const { return sample_ > 0; }
+
+    /// @brief Decide whether the request just accepted is sampled.
+    void Begin(RequestTrace& trace);
+
+    /// @brief Make `trace` the calling thread's current request if it was
+    ///        sampled, nullptr unbinds. A request may move between threads.
+    void Bind(RequestTrace* trace);
+
+    /// @brief Unbind and dump `trace` if it was sampled and slow.
+    void End(RequestTrace& trace, const std::string& method, const std::string& url, int status_code);
+
+    /// @brief Record a span if this thread has a sampled request bound.
+    void Record(TraceEvent event, SteadyClock::time_point begin, SteadyClock::time_point end);
+
+    /// @brief Record a span into `trace` if it was sampled.
+    void Record(RequestTrace& trace, TraceEvent event, SteadyClock::time_point begin, SteadyClock::time_point end);
+
+    static bool Active();
+
+    static const char* EventName(TraceEvent event);
+
+private:
+    Tracer();
+
+    void dump(const RequestTrace& trace, const std::string& method, const std::string& url, int status_code);
+
+    int64_t sinceEpoch(SteadyClock::time_point tp) const;
+
+private:
+    int sample_;
+    std::chrono::microseconds slow_;
+    std::atomic<uint64_t> seq_;
+    SteadyClock::time_point epoch_;
+    std::mutex mtx_;
+    FILE* out_;
+    uint64_t dumped_;
+};
+
+// Records the enclosing block as one span of a sampled request
+class TraceScope {
+public:
+    explicit TraceScope(TraceEvent event)
+        : event_(event), active_(Tracer::Active()) {
+        if (active_) {
+            begin_ = SteadyClock::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (active_) {
+            Tracer::GetInstance().Record(event_, begin_, SteadyClock::now());
+        }
+    }
+
+private:
+    TraceEvent event_;
+    bool active_;
+    SteadyClock::time_point begin_;
+};
+
+#endif // TRACE_HPP
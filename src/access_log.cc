@@ -0,0 +1,194 @@
+#include "access_log.hpp"
+
+namespace {
+
+const char* kCacheStatusNames[] = {"HIT", "MISS", "NEGATIVE_HIT", "ADMIN", "BYPASS"};
+
+}
+
+AccessLog::AccessLog()
+    : fd_(-1)
+    , capacity_(1024)
+    , policy_(AccessLogPolicy::kDrop)
+    , sample_(1)
+    , running_(false) {
+
+}
+
+AccessLog::~AccessLog() {
+    Stop();
+    if (fd_ > STDERR_FILENO) {
+        close(fd_);
+    }
+}
+
+AccessLog& AccessLog::GetInstance() {
+    static AccessLog ins;
+    return ins;
+}
+
+bool AccessLog::Init(const std::string& path, size_t capacity, AccessLogPolicy policy, int sample)
+{
+    capacity_ = std::max<size_t>(capacity, 2);
+    policy_   = policy;
+    sample_   = std::max(1, sample);
+    if (path.empty()) {
+        fd_ = -1;
+    } else if (path == "-") {
+        fd_ = STDOUT_FILENO;
+    } else {
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AccessLog::Start()
+{
+    if (!Enabled() || running_) {
+        return;
+    }
+    running_ = true;
+    t_ = std::thread([this](){
+        while (running_) {
+            if (drain() == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        // Whatever got in before Stop()
+        while (drain() > 0) {
+        }
+    });
+}
+
+void AccessLog::Stop()
+{
+    running_ = false;
+    if (t_.joinable()) {
+        t_.join();
+    }
+}
+
+bool AccessLog::Enabled() const
+{
+    return fd_ != -1;
+}
+
+void AccessLog::Log(const AccessRecord& record)
+{
+    if (!Enabled()) {
+        return;
+    }
+    static thread_local uint64_t seq = 0;
+    if (sample_ > 1 && (seq++ % sample_) != 0 && record.status_code < 500) {
+        return;
+    }
+    SpscRing<AccessRecord>* r = ring();
+    if (r->Push(record)) {
+        return;
+    }
+    if (policy_ == AccessLogPolicy::kDrop || !running_) {
+        Metrics::GetInstance().Add(Counter::kAccessLogDropped);
+        return;
+    }
+    while (!r->Push(record)) {
+        std::this_thread::yield();
+    }
+}
+
+SpscRing<AccessRecord>* AccessLog::ring()
+{
+    static thread_local SpscRing<AccessRecord>* local = nullptr;
+    if (!local) {
+        local = new SpscRing<AccessRecord>(capacity_);
+        std::lock_guard<std::mutex> lock(mtx_);
+        rings_.push_back(local);
+    }
+    return local;
+}
+
+size_t AccessLog::drain()
+{
+    std::vector<SpscRing<AccessRecord>*> rings;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        rings = rings_;
+    }
+    static char lines[ACCESS_LOG_BATCH][ACCESS_LOG_LINE_SIZE];
+    struct iovec iov[ACCESS_LOG_BATCH];
+    int cnt = 0;
+    size_t total = 0;
+    AccessRecord record;
+    for (auto r : rings) {
+        while (r->Pop(record)) {
+            int len = format(record, lines[cnt], ACCESS_LOG_LINE_SIZE);
+            iov[cnt].iov_base = lines[cnt];
+            iov[cnt].iov_len  = static_cast<size_t>(len);
+            total++;
+            if (++cnt == ACCESS_LOG_BATCH) {
+                flush(iov, cnt);
+                cnt = 0;
+            }
+        }
+    }
+    if (cnt > 0) {
+        flush(iov, cnt);
+    }
+    return total;
+}
+
+void AccessLog::flush(struct iovec* iov, int cnt)
+{
+    // One syscall per batch, finish by hand if writev comes back short
+    ssize_t written = writev(fd_, iov, cnt);
+    if (written < 0) {
+        return;
+    }
+    for (int i = 0; i < cnt; ++i) {
+        if (static_cast<size_t>(written) >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            continue;
+        }
+        const char* p = (const char*)iov[i].iov_base + written;
+        size_t left = iov[i].iov_len - written;
+        written = 0;
+        while (left > 0) {
+            ssize_t n = write(fd_, p, left);
+            if (n <= 0) {
+                return;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+}
+
+int AccessLog::format(const AccessRecord& record, char* buf, size_t n)
+{
+    time_t sec = static_cast<time_t>(record.timestamp_us / 1000000);
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+    const uint32_t* us = record.stage_us;
+    int len = snprintf(buf, n,
+        "%s.%06dZ \"%s %s\" %u %s %llu"
+        " accept_parse=%u cache_lookup=%u origin_connect=%u tls_handshake=%u"
+        " origin_ttfb=%u body_transfer=%u client_write=%u\n",
+        ts, static_cast<int>(record.timestamp_us % 1000000),
+        record.method, record.url, record.status_code,
+        kCacheStatusNames[static_cast<int>(record.cache_status)],
+        (unsigned long long)record.bytes,
+        us[0], us[1], us[2], us[3], us[4], us[5], us[6]);
+    if (len < 0) {
+        return 0;
+    }
+    if (static_cast<size_t>(len) >= n) {
+        // Truncated, keep the line terminated
+        buf[n - 2] = '\n';
+        return static_cast<int>(n - 1);
+    }
+    return len;
+}
@@ -0,0 +1,210 @@
+#include "cache_key.hpp"
+
+CacheKey::CacheKey() : sort_query_(false), lowercase_host_(false) {
+
+}
+
+CacheKey::~CacheKey() {
+
+}
+
+CacheKey& CacheKey::GetInstance() {
+    static CacheKey ins;
+    return ins;
+}
+
+void CacheKey::Init(bool sort_query, const std::string& strip_params, bool lowercase_host)
+{
+    sort_query_     = sort_query;
+    lowercase_host_ = lowercase_host;
+
+    std::vector<std::string> params;
+    split(strip_params, ',', params);
+    strip_params_.clear();
+    for (auto& param : params) {
+        std::string name = trim(param);
+        if (!name.empty()) {
+            strip_params_.insert(name);
+        }
+    }
+}
+
+std::string CacheKey::Normalize(const std::string& url) const
+{
+    // Fragment never reaches the origin
+    std::string path = url.substr(0, url.find('#'));
+    std::string query;
+    size_t qpos = path.find('?');
+    if (qpos != std::string::npos) {
+        query = path.substr(qpos + 1);
+        path.erase(qpos);
+    }
+
+    // Absolute-form: scheme://host/path
+    size_t spos = path.find("://");
+    if (lowercase_host_ && spos != std::string::npos) {
+        size_t hend = path.find('/', spos + 3);
+        if (hend == std::string::npos) {
+            hend = path.size();
+        }
+        std::transform(path.begin(), path.begin() + hend, path.begin(), ::tolower);
+    }
+
+    if (query.empty()) {
+        return path;
+    }
+    if (!sort_query_ && strip_params_.empty()) {
+        return path + "?" + query;
+    }
+
+    std::vector<std::string> params;
+    split(query, '&', params);
+    std::vector<std::string> kept;
+    for (auto& param : params) {
+        if (param.empty()) {
+            continue;
+        }
+        if (strip_params_.count(param.substr(0, param.find('='))) != 0) {
+            continue;
+        }
+        kept.push_back(param);
+    }
+    if (sort_query_) {
+        // Sort by name, keep relative order of repeated names
+        std::stable_sort(kept.begin(), kept.end(), [](const std::string& a, const std::string& b) {
+            return a.substr(0, a.find('=')) < b.substr(0, b.find('='));
+        });
+    }
+    if (kept.empty()) {
+        return path;
+    }
+    path.append("?");
+    for (size_t i = 0; i < kept.size(); ++i) {
+        if (i) path.append("&");
+        path.append(kept[i]);
+    }
+    return path;
+}
+
+std::string CacheKey::Secondary(const std::string& primary, const std::string& vary, const HeaderMap& header) const
+{
+    std::string key = primary;
+    std::vector<std::string> names;
+    split(vary, ',', names);
+    for (auto& name : names) {
+        key.append("\n");
+        key.append(name);
+        key.append("=");
+        const std::string* value = FindHeader(header, name.c_str());
+        if (!value) {
+            continue;
+        }
+        // "gzip, br" and "gzip,br" select the same variant
+        std::vector<std::string> tokens;
+        split(toLower(*value), ',', tokens);
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (i) key.append(",");
+            key.append(trim(tokens[i]));
+        }
+    }
+    return key;
+}
+
+std::string CacheKey::NormalizeVary(const std::string& vary)
+{
+    std::vector<std::string> names;
+    split(toLower(vary), ',', names);
+    std::set<std::string> sorted;
+    for (auto& name : names) {
+        std::string field = trim(name);
+        if (field == "*") {
+            return "*";
+        }
+        if (!field.empty()) {
+            sorted.insert(field);
+        }
+    }
+    std::string ret;
+    for (auto& field : sorted) {
+        if (!ret.empty()) ret.append(",");
+        ret.append(field);
+    }
+    return ret;
+}
+
+const std::string* CacheKey::FindHeader(const HeaderMap& header, const char* name)
+{
+    for (auto it = header.begin(); it != header.end(); ++it) {
+        if (0 == strcasecmp(it->first.c_str(), name)) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+bool CacheKey::TakeParam(std::string& url, const char* name, std::string& value)
+{
+    size_t qpos = url.find('?');
+    if (qpos == std::string::npos) {
+        return false;
+    }
+    size_t name_len = strlen(name);
+    size_t begin = qpos + 1;
+    while (begin < url.size()) {
+        size_t end = url.find('&', begin);
+        if (end == std::string::npos) {
+            end = url.size();
+        }
+        if (end - begin >= name_len && 0 == url.compare(begin, name_len, name)
+            && (end - begin == name_len || url[begin + name_len] == '=')) {
+            value.clear();
+            for (size_t i = begin + name_len + 1; i < end; ++i) {
+                if (url[i] == '%' && i + 2 < end && isxdigit((unsigned char)url[i + 1]) && isxdigit((unsigned char)url[i + 2])) {
+                    value.push_back(static_cast<char>(std::stoi(url.substr(i + 1, 2), nullptr, 16)));
+                    i += 2;
+                } else {
+                    value.push_back(url[i] == '+' ? ' ' : url[i]);
+                }
+            }
+            // Take the param and one of the separators around it
+            if (end < url.size()) {
+                url.erase(begin, end + 1 - begin);
+            } else {
+                url.erase(begin - 1);
+            }
+            return true;
+        }
+        begin = end + 1;
+    }
+    return false;
+}
+
+std::string CacheKey::toLower(const std::string& s)
+{
+    std::string ret = s;
+    std::transform(ret.begin(), ret.end(), ret.begin(), ::tolower);
+    return ret;
+}
+
+std::string CacheKey::trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+void CacheKey::split(const std::string& s, char sep, std::vector<std::string>& out)
+{
+    size_t begin = 0;
+    while (begin <= s.size()) {
+        size_t end = s.find(sep, begin);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        out.push_back(s.substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
@@ -1,6 +1,6 @@
 #include "cache_timer.hpp"
 
-CacheTimer::CacheTimer() : running_(false) {
+CacheTimer::CacheTimer() : total_bytes_(0), max_bytes_(0), negative_entries_(0), running_(false) {
 
 }
 
@@ -39,7 +39,9 @@ void CacheTimer::Stop() {
 std::string CacheTimer::GetCache(const std::string &url)
 {
     std::lock_guard<std::mutex> lock(mtx_);
-    return cache_map_.count(url) == 0 ? "" : cache_map_.find(url)->second.cache_content;
+    auto it = cache_map_.find(url);
+    // Negative entries carry no content worth serving as 200
+    return it == cache_map_.end() || it->second.negative ? "" : it->second.cache_content;
 }
 
 void CacheTimer::KeepCacheAlive(const std::string &url, const std::string& content)
@@ -47,26 +49,147 @@ void CacheTimer::KeepCacheAlive(const std::string &url, const std::string& conte
     std::lock_guard<std::mutex> lock(mtx_);
     auto it = cache_map_.find(url);
     if (it != cache_map_.end()) {
-        time_map_.erase(it->second.last_active);
+        eraseIndex(time_map_, it->second.last_active, url);
         it->second.last_active = std::chrono::steady_clock::now();
-        time_map_[it->second.last_active] = url;
+        time_map_.emplace(it->second.last_active, url);
     } else {
-        auto now = std::chrono::steady_clock::now();
-        TMDBCache cache{
-            .dest_url = url,
-            .cache_content = content,
-            .last_active = now
-        };
-        cache_map_[url] = cache;
-        time_map_.emplace(now, url);
+        TMDBCache cache{};
+        cache.cache_content = content;
+        insertCache(url, cache);
+    }
+}
+
+bool CacheTimer::GetCache(const std::string &url, TMDBCache &cache)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = cache_map_.find(url);
+    if (it == cache_map_.end()) {
+        return false;
+    }
+    if (it->second.negative && it->second.expire_at <= std::chrono::steady_clock::now()) {
+        eraseCache(it);
+        Metrics::GetInstance().Add(Counter::kStale);
+        return false;
+    }
+    cache = it->second;
+    return true;
+}
+
+bool CacheTimer::TouchCache(const std::string &url)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = cache_map_.find(url);
+    if (it == cache_map_.end()) {
+        return false;
     }
+    eraseIndex(time_map_, it->second.last_active, url);
+    it->second.last_active = std::chrono::steady_clock::now();
+    time_map_.emplace(it->second.last_active, url);
+    return true;
+}
+
+void CacheTimer::KeepCacheAlive(const std::string &url, const TMDBCache &cache)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    TMDBCache entry = cache;
+    entry.negative = false;
+    insertCache(url, entry);
+}
+
+void CacheTimer::KeepNegativeCache(const std::string &url, const TMDBCache &cache, int ttl)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    TMDBCache entry = cache;
+    entry.negative = true;
+    entry.expire_at = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+    insertCache(url, entry);
 }
 
 void CacheTimer::ClearCache()
 {
     std::lock_guard<std::mutex> lock(mtx_);
     time_map_.clear();
+    negative_map_.clear();
     cache_map_.clear();
+    tag_map_.clear();
+    total_bytes_ = 0;
+    negative_entries_ = 0;
+}
+
+size_t CacheTimer::PurgeUrl(const std::string &url)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    size_t purged = 0;
+    auto it = cache_map_.find(url);
+    if (it != cache_map_.end()) {
+        eraseCache(it);
+        purged++;
+    }
+    // Variants live under "<url>\n<secondary>"
+    std::string variant = url + "\n";
+    it = cache_map_.lower_bound(variant);
+    while (it != cache_map_.end() && 0 == it->first.compare(0, variant.size(), variant)) {
+        eraseCache(it++);
+        purged++;
+    }
+    return purged;
+}
+
+size_t CacheTimer::PurgePrefix(const std::string &prefix)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    size_t purged = 0;
+    auto it = cache_map_.lower_bound(prefix);
+    while (it != cache_map_.end() && 0 == it->first.compare(0, prefix.size(), prefix)) {
+        eraseCache(it++);
+        purged++;
+    }
+    return purged;
+}
+
+size_t CacheTimer::PurgeTag(const std::string &tag)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto tit = tag_map_.find(tag);
+    if (tit == tag_map_.end()) {
+        return 0;
+    }
+    // eraseCache drops the tag set once it gets empty
+    std::set<std::string> urls = tit->second;
+    size_t purged = 0;
+    for (auto& url : urls) {
+        auto it = cache_map_.find(url);
+        if (it != cache_map_.end()) {
+            eraseCache(it);
+            purged++;
+        }
+    }
+    return purged;
+}
+
+void CacheTimer::SetExpires(int expires)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    expire_interval_ = std::chrono::seconds(expires);
+}
+
+void CacheTimer::SetMaxBytes(size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    max_bytes_ = max_bytes;
+    evictCache();
+}
+
+CacheStats CacheTimer::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    CacheStats stats;
+    stats.entries          = cache_map_.size();
+    stats.negative_entries = negative_entries_;
+    stats.bytes            = total_bytes_;
+    stats.max_bytes        = max_bytes_;
+    stats.expires          = static_cast<int>(expire_interval_.count());
+    return stats;
 }
 
 void CacheTimer::checkInactiveCache()
@@ -75,13 +198,98 @@ void CacheTimer::checkInactiveCache()
     auto now = std::chrono::steady_clock::now();
     auto expire_point = now - expire_interval_;
 
-    auto it = time_map_.begin();
-    while (it != time_map_.end() && it->first < expire_point) {
-        auto url = it->second;
-        auto cache = cache_map_.find(url);
-        if (cache != cache_map_.end()) {
-            cache_map_.erase(url);
+    while (!time_map_.empty() && time_map_.begin()->first < expire_point) {
+        auto cache = cache_map_.find(time_map_.begin()->second);
+        if (cache != cache_map_.end() && cache->second.last_active == time_map_.begin()->first) {
+            eraseCache(cache);
+            Metrics::GetInstance().Add(Counter::kExpire);
+        } else {
+            time_map_.erase(time_map_.begin());
+        }
+    }
+
+    // Negative entries expire on their own short ttl
+    while (!negative_map_.empty() && negative_map_.begin()->first <= now) {
+        auto cache = cache_map_.find(negative_map_.begin()->second);
+        if (cache != cache_map_.end()
+            && cache->second.negative
+            && cache->second.expire_at == negative_map_.begin()->first) {
+            eraseCache(cache);
+            Metrics::GetInstance().Add(Counter::kExpire);
+        } else {
+            negative_map_.erase(negative_map_.begin());
+        }
+    }
+}
+
+void CacheTimer::insertCache(const std::string &url, const TMDBCache &cache)
+{
+    auto it = cache_map_.find(url);
+    if (it != cache_map_.end()) {
+        eraseCache(it);
+    }
+    auto now = std::chrono::steady_clock::now();
+    TMDBCache& entry = cache_map_[url];
+    entry = cache;
+    entry.dest_url = url;
+    entry.last_active = now;
+    time_map_.emplace(now, url);
+    if (entry.negative) {
+        negative_map_.emplace(entry.expire_at, url);
+        negative_entries_++;
+    }
+    for (auto& tag : entry.tags) {
+        tag_map_[tag].insert(url);
+    }
+    total_bytes_ += cacheBytes(entry);
+    evictCache();
+}
+
+void CacheTimer::eraseCache(std::map<std::string, TMDBCache>::iterator it)
+{
+    eraseIndex(time_map_, it->second.last_active, it->first);
+    if (it->second.negative) {
+        eraseIndex(negative_map_, it->second.expire_at, it->first);
+        negative_entries_--;
+    }
+    for (auto& tag : it->second.tags) {
+        auto tag_it = tag_map_.find(tag);
+        if (tag_it != tag_map_.end()) {
+            tag_it->second.erase(it->first);
+            if (tag_it->second.empty()) {
+                tag_map_.erase(tag_it);
+            }
+        }
+    }
+    total_bytes_ -= cacheBytes(it->second);
+    cache_map_.erase(it);
+}
+
+void CacheTimer::evictCache()
+{
+    while (max_bytes_ > 0 && total_bytes_ > max_bytes_ && !time_map_.empty()) {
+        auto cache = cache_map_.find(time_map_.begin()->second);
+        if (cache != cache_map_.end() && cache->second.last_active == time_map_.begin()->first) {
+            eraseCache(cache);
+            Metrics::GetInstance().Add(Counter::kEvict);
+        } else {
+            time_map_.erase(time_map_.begin());
+        }
+    }
+}
+
+size_t CacheTimer::cacheBytes(const TMDBCache &cache)
+{
+    return cache.dest_url.size() + cache.cache_content.size() + cache.header_origin.size() + cache.json_bytes;
+}
+
+void CacheTimer::eraseIndex(std::multimap<TimePoint, std::string> &index, TimePoint tp, const std::string &url)
+{
+    auto range = index.equal_range(tp);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == url) {
+            index.erase(it);
+            return;
         }
-        it = time_map_.erase(it);
     }
 }
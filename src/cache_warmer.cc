@@ -0,0 +1,164 @@
+#include "cache_warmer.hpp"
+#include "net_cache_server_util.hpp"
+
+CacheWarmer::CacheWarmer()
+    : concurrency_(4)
+    , rate_(50)
+    , running_(false)
+    , stopping_(false)
+    , total_(0)
+    , done_(0)
+    , failed_(0) {
+
+}
+
+CacheWarmer::~CacheWarmer() {
+    Stop();
+}
+
+CacheWarmer& CacheWarmer::GetInstance() {
+    static CacheWarmer ins;
+    return ins;
+}
+
+void CacheWarmer::Init(int concurrency, int rate)
+{
+    concurrency_ = std::max(1, concurrency);
+    rate_        = std::max(0, rate);
+}
+
+bool CacheWarmer::Start(const std::string& path)
+{
+    if (running_) {
+        return false;
+    }
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Open warm-up file [%s] failed.\n", path.c_str());
+        return false;
+    }
+    std::vector<std::string> urls;
+    std::set<std::string> seen;
+    std::string line, url;
+    while (std::getline(in, line)) {
+        if (parseLine(line, url) && seen.insert(url).second) {
+            urls.push_back(url);
+        }
+    }
+    if (t_.joinable()) {
+        t_.join();
+    }
+    total_    = urls.size();
+    done_     = 0;
+    failed_   = 0;
+    stopping_ = false;
+    running_  = true;
+    next_slot_ = std::chrono::steady_clock::now();
+    fprintf(stdout, "Warm-up [%s]: %zu urls.\n", path.c_str(), urls.size());
+    fflush(stdout);
+    t_ = std::thread(&CacheWarmer::run, this, std::move(urls));
+    return true;
+}
+
+void CacheWarmer::Stop()
+{
+    stopping_ = true;
+    if (t_.joinable()) {
+        t_.join();
+    }
+}
+
+WarmProgress CacheWarmer::GetProgress()
+{
+    WarmProgress progress;
+    progress.total   = total_;
+    progress.done    = done_;
+    progress.failed  = failed_;
+    progress.running = running_;
+    return progress;
+}
+
+void CacheWarmer::run(std::vector<std::string> urls)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < concurrency_; ++i) {
+        workers.emplace_back([&](){
+            size_t idx;
+            while (!stopping_ && (idx = next++) < urls.size()) {
+                waitRate();
+                if (!NetCacheServerUtil::GetInstance().Prefetch(urls[idx])) {
+                    failed_++;
+                }
+                if (++done_ % 100 == 0) {
+                    reportProgress();
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    reportProgress();
+    running_ = false;
+}
+
+void CacheWarmer::waitRate()
+{
+    if (rate_ <= 0) {
+        return;
+    }
+    std::chrono::steady_clock::time_point slot;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto now = std::chrono::steady_clock::now();
+        slot = std::max(now, next_slot_);
+        next_slot_ = slot + std::chrono::microseconds(1000000 / rate_);
+    }
+    std::this_thread::sleep_until(slot);
+}
+
+void CacheWarmer::reportProgress()
+{
+    fprintf(stdout, "Warm-up: %zu/%zu done, %zu failed.\n", (size_t)done_, (size_t)total_, (size_t)failed_);
+    fflush(stdout);
+}
+
+bool CacheWarmer::parseLine(const std::string& line, std::string& url)
+{
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#') {
+        return false;
+    }
+    size_t quote = line.find('"');
+    size_t bracket = line.find("for [");
+    if (bracket != std::string::npos) {
+        // Proxy stdout: Cache hit for [url].
+        size_t end = line.find(']', bracket);
+        if (end == std::string::npos) {
+            return false;
+        }
+        url = line.substr(bracket + 5, end - bracket - 5);
+    } else if (quote != std::string::npos) {
+        // Access log: ... "GET url HTTP/1.1" ...
+        size_t end = line.find('"', quote + 1);
+        std::string request = line.substr(quote + 1, end == std::string::npos ? std::string::npos : end - quote - 1);
+        size_t sp = request.find(' ');
+        if (sp == std::string::npos || request.compare(0, sp, "GET") != 0) {
+            return false;
+        }
+        size_t url_end = request.find(' ', sp + 1);
+        url = request.substr(sp + 1, url_end == std::string::npos ? std::string::npos : url_end - sp - 1);
+    } else {
+        // Url list
+        size_t end = line.find_first_of(" \t\r", begin);
+        url = line.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    }
+    // Absolute-form goes to the configured origin anyway
+    size_t scheme = url.find("://");
+    if (scheme != std::string::npos) {
+        size_t path = url.find('/', scheme + 3);
+        url = path == std::string::npos ? "/" : url.substr(path);
+    }
+    return !url.empty() && url[0] == '/';
+}
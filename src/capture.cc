@@ -0,0 +1,179 @@
+#include "capture.hpp"
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char* kCacheHeaders[] = {
+    "Cache-Control",
+    "Expires",
+    "ETag",
+    "Last-Modified",
+    "Vary",
+    "Surrogate-Key",
+    "Content-Type",
+};
+
+const char* kSecretHeaders[] = {
+    "Authorization",
+    "Cookie",
+    "Proxy-Authorization",
+};
+
+bool readString(FILE* in, size_t len, std::string& out) {
+    out.resize(len);
+    return len == 0 || fread(&out[0], 1, len, in) == len;
+}
+
+}
+
+Capture::Capture()
+    : out_(nullptr) {
+
+}
+
+Capture::~Capture() {
+    Stop();
+}
+
+Capture& Capture::GetInstance() {
+    static Capture ins;
+    return ins;
+}
+
+bool Capture::Init(const std::string& path)
+{
+    if (path.empty()) {
+        return true;
+    }
+    // Request headers end up in here, keep it private even if it existed
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    if (fchmod(fd, 0600) != 0 || !(out_ = fdopen(fd, "wb"))) {
+        close(fd);
+        return false;
+    }
+    // Records are small, let stdio batch them into large writes
+    setvbuf(out_, nullptr, _IOFBF, 1 << 20);
+    start_ = std::chrono::steady_clock::now();
+    CaptureFileHeader header;
+    header.magic   = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.start_unix_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    fwrite(&header, sizeof(header), 1, out_);
+    return true;
+}
+
+void Capture::Record(CaptureRecord& record)
+{
+    if (record.method.size() > UINT8_MAX) {
+        record.method.resize(UINT8_MAX);
+    }
+    for (std::string* field : {&record.url, &record.headers, &record.cache_headers}) {
+        if (field->size() > UINT16_MAX) {
+            field->resize(UINT16_MAX);
+        }
+    }
+    CaptureRecordHeader header;
+    header.response_bytes    = record.response_bytes;
+    header.status_code       = record.status_code;
+    header.cache_status      = static_cast<uint8_t>(record.cache_status);
+    header.method_len        = static_cast<uint8_t>(record.method.size());
+    header.url_len           = static_cast<uint16_t>(record.url.size());
+    header.headers_len       = static_cast<uint16_t>(record.headers.size());
+    header.cache_headers_len = static_cast<uint16_t>(record.cache_headers.size());
+    header.reserved          = 0;
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!out_) {
+        return;
+    }
+    header.offset_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+    fwrite(&header, sizeof(header), 1, out_);
+    fwrite(record.method.data(), 1, record.method.size(), out_);
+    fwrite(record.url.data(), 1, record.url.size(), out_);
+    fwrite(record.headers.data(), 1, record.headers.size(), out_);
+    fwrite(record.cache_headers.data(), 1, record.cache_headers.size(), out_);
+}
+
+void Capture::Stop()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (out_) {
+        fclose(out_);
+        out_ = nullptr;
+    }
+}
+
+bool Capture::IsSecretHeader(const std::string& name)
+{
+    for (const char* secret : kSecretHeaders) {
+        if (0 == strcasecmp(name.c_str(), secret)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Capture::FilterCacheHeaders(const std::string& header_block, std::string& cache_headers)
+{
+    size_t begin = 0;
+    while (begin < header_block.size()) {
+        size_t end = header_block.find("\r\n", begin);
+        if (end == std::string::npos) {
+            end = header_block.size();
+        }
+        size_t colon = header_block.find(':', begin);
+        if (colon != std::string::npos && colon < end) {
+            for (const char* name : kCacheHeaders) {
+                if (colon - begin == strlen(name) && 0 == strncasecmp(header_block.c_str() + begin, name, colon - begin)) {
+                    cache_headers.append(header_block, begin, end - begin);
+                    cache_headers.append("\r\n");
+                    break;
+                }
+            }
+        }
+        begin = end + 2;
+    }
+}
+
+bool Capture::Load(const std::string& path, std::vector<CaptureRecord>& records)
+{
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    CaptureFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, in) != 1
+        || file_header.magic != CAPTURE_MAGIC
+        || file_header.version != CAPTURE_VERSION) {
+        fclose(in);
+        return false;
+    }
+    CaptureRecordHeader header;
+    bool ok = true;
+    while (fread(&header, sizeof(header), 1, in) == 1) {
+        CaptureRecord record;
+        record.offset_us      = header.offset_us;
+        record.response_bytes = header.response_bytes;
+        record.status_code    = header.status_code;
+        record.cache_status   = static_cast<CacheStatus>(header.cache_status);
+        if (!readString(in, header.method_len, record.method)
+            || !readString(in, header.url_len, record.url)
+            || !readString(in, header.headers_len, record.headers)
+            || !readString(in, header.cache_headers_len, record.cache_headers)) {
+            // Torn last record of a capture that was killed, keep the rest
+            ok = !records.empty();
+            break;
+        }
+        records.push_back(std::move(record));
+    }
+    fclose(in);
+    return ok;
+}
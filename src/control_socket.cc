@@ -0,0 +1,98 @@
+#include "control_socket.hpp"
+
+int ControlSocket::Listen(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    // Left behind by a crashed server, nobody accepts on it
+    unlink(path);
+    if (-1 == bind(fd, (sockaddr*)&addr, sizeof(addr)) || -1 == listen(fd, 16)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ControlSocket::Connect(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (-1 == connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool ControlSocket::Send(int fd, ControlOp op, ControlStatus status, const std::string& payload)
+{
+    ControlHeader header;
+    header.magic    = CONTROL_MAGIC;
+    header.op       = static_cast<uint8_t>(op);
+    header.status   = static_cast<uint8_t>(status);
+    header.reserved = 0;
+    header.length   = static_cast<uint32_t>(payload.size());
+    return writeFull(fd, (const char*)&header, sizeof(header))
+        && writeFull(fd, payload.data(), payload.size());
+}
+
+bool ControlSocket::Recv(int fd, ControlHeader& header, std::string& payload)
+{
+    if (!readFull(fd, (char*)&header, sizeof(header))) {
+        return false;
+    }
+    if (header.magic != CONTROL_MAGIC || header.length > CONTROL_MAX_PAYLOAD) {
+        return false;
+    }
+    payload.resize(header.length);
+    return readFull(fd, &payload[0], header.length);
+}
+
+bool ControlSocket::Request(ControlOp op, const std::string& payload, ControlHeader& header, std::string& resp)
+{
+    int fd = Connect();
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = Send(fd, op, ControlStatus::kOk, payload) && Recv(fd, header, resp);
+    close(fd);
+    return ok;
+}
+
+bool ControlSocket::readFull(int fd, char* buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t bytes_read = read(fd, buf, n);
+        if (bytes_read <= 0) {
+            return false;
+        }
+        buf += bytes_read;
+        n   -= bytes_read;
+    }
+    return true;
+}
+
+bool ControlSocket::writeFull(int fd, const char* buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t bytes_write = write(fd, buf, n);
+        if (bytes_write <= 0) {
+            return false;
+        }
+        buf += bytes_write;
+        n   -= bytes_write;
+    }
+    return true;
+}
@@ -0,0 +1,401 @@
+#include "io_uring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+
+int sysSetup(unsigned entries, struct io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sysRegister(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// Entries start at the ring base, the tail overlays bufs[0].resv. Not
+// `ring->bufs`: in C++ the empty struct of __DECLARE_FLEX_ARRAY takes a byte
+// and pushes the array 8 bytes off.
+struct io_uring_buf* bufAt(struct io_uring_buf_ring* ring, unsigned index) {
+    return reinterpret_cast<struct io_uring_buf*>(ring) + index;
+}
+
+}
+
+IoUring::IoUring()
+    : fd_(-1)
+    , ring_index_(-1)
+    , features_(0)
+    , sq_ptr_(MAP_FAILED)
+    , sq_size_(0)
+    , cq_ptr_(MAP_FAILED)
+    , cq_size_(0)
+    , sqes_(nullptr)
+    , sqes_size_(0)
+    , sq_head_(nullptr)
+    , sq_tail_(nullptr)
+    , sq_mask_(0)
+    , sq_entries_(0)
+    , sqe_tail_(0)
+    , cq_head_(nullptr)
+    , cq_tail_(nullptr)
+    , cq_mask_(0)
+    , cqes_(nullptr)
+    , buf_ring_(nullptr)
+    , buf_ring_size_(0)
+    , buffers_(nullptr)
+    , buffer_count_(0)
+    , buffer_size_(0) {
+
+}
+
+IoUring::~IoUring() {
+    // Closing the ring cancels whatever is still in flight
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    if (buf_ring_) {
+        munmap(buf_ring_, buf_ring_size_);
+    }
+    free(buffers_);
+    if (sqes_) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_size_);
+    }
+}
+
+bool IoUring::Supported()
+{
+    static int supported = -1;
+    if (supported != -1) {
+        return supported == 1;
+    }
+    supported = 0;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sysSetup(2, &p);
+    if (fd == -1) {
+        return false;
+    }
+    const size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = static_cast<struct io_uring_probe*>(calloc(1, len));
+    if (probe && sysRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        // SEND_ZC came with multishot recv in 6.0, multishot accept and
+        // provided buffer rings are older
+        const unsigned ops[] = {
+            IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CONNECT,
+            IORING_OP_ASYNC_CANCEL, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_POLL_ADD,
+            IORING_OP_SEND_ZC,
+        };
+        bool all = (p.features & IORING_FEAT_EXT_ARG) != 0;
+        for (unsigned op : ops) {
+            all = all && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        }
+        supported = all ? 1 : 0;
+    }
+    free(probe);
+    close(fd);
+    return supported == 1;
+}
+
+bool IoUring::Init(unsigned entries, bool single_issuer)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    p.cq_entries = entries * 2;
+    if (single_issuer) {
+        // Completions are only reaped in Wait(), no interrupts in between
+        p.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    }
+    fd_ = sysSetup(entries, &p);
+    if (fd_ == -1 && single_issuer) {
+        p.flags &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+        fd_ = sysSetup(entries, &p);
+    }
+    if (fd_ == -1) {
+        return false;
+    }
+    features_ = p.features;
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (features_ & IORING_FEAT_SINGLE_MMAP) {
+        sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ptr_ = mmap(0, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        return false;
+    }
+    if (features_ & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(0, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            return false;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(0, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_    = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_    = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_    = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    sqe_tail_   = *sq_tail_;
+    // Slot i always holds sqe i
+    unsigned* array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i) {
+        array[i] = i;
+    }
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_    = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    // Registered ring fd, every io_uring_enter skips the fd table lookup
+    struct io_uring_rsrc_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = static_cast<unsigned>(-1);
+    update.data   = static_cast<uint64_t>(fd_);
+    if (sysRegister(fd_, IORING_REGISTER_RING_FDS, &update, 1) == 1) {
+        ring_index_ = static_cast<int>(update.offset);
+    }
+    return true;
+}
+
+bool IoUring::SetupBuffers(uint16_t group, unsigned count, unsigned size)
+{
+    if (count == 0 || (count & (count - 1)) != 0) {
+        return false;
+    }
+    buf_ring_size_ = count * sizeof(struct io_uring_buf);
+    void* ring = mmap(0, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    buf_ring_ = static_cast<struct io_uring_buf_ring*>(ring);
+    buffers_  = static_cast<char*>(malloc(static_cast<size_t>(count) * size));
+    if (!buffers_) {
+        return false;
+    }
+    buffer_count_ = count;
+    buffer_size_  = size;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = count;
+    reg.bgid         = group;
+    if (sysRegister(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+    for (unsigned bid = 0; bid < count; ++bid) {
+        struct io_uring_buf* buf = bufAt(buf_ring_, bid);
+        buf->addr = reinterpret_cast<uint64_t>(Buffer(bid));
+        buf->len  = size;
+        buf->bid  = static_cast<uint16_t>(bid);
+    }
+    __atomic_store_n(&buf_ring_->tail, static_cast<uint16_t>(count), __ATOMIC_RELEASE);
+    return true;
+}
+
+void IoUring::RecycleBuffer(unsigned bid)
+{
+    uint16_t tail = buf_ring_->tail;
+    struct io_uring_buf* buf = bufAt(buf_ring_, tail & (buffer_count_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(Buffer(bid));
+    buf->len  = buffer_size_;
+    buf->bid  = static_cast<uint16_t>(bid);
+    __atomic_store_n(&buf_ring_->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::GetSqe()
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_) {
+        // Full, the kernel takes everything queued on submit
+        Submit();
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+    }
+    struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+    ++sqe_tail_;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepAcceptMultishot(int fd, int flags, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode       = IORING_OP_ACCEPT;
+        sqe->fd           = fd;
+        sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = static_cast<uint32_t>(flags);
+        sqe->user_data    = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepRecvMultishot(int fd, uint16_t group, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode    = IORING_OP_RECV;
+        sqe->fd        = fd;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepSend(int fd, const void* buf, size_t len, int flags, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode    = IORING_OP_SEND;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<uint64_t>(buf);
+        sqe->len       = static_cast<uint32_t>(std::min(len, static_cast<size_t>(1u << 30)));
+        sqe->msg_flags = static_cast<uint32_t>(flags);
+        sqe->user_data = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepConnect(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode    = IORING_OP_CONNECT;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<uint64_t>(addr);
+        sqe->off       = addrlen;
+        sqe->user_data = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepRead(int fd, void* buf, unsigned len, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode    = IORING_OP_READ;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<uint64_t>(buf);
+        sqe->len       = len;
+        sqe->off       = static_cast<uint64_t>(-1);
+        sqe->user_data = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepPollMultishot(int fd, unsigned events, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = fd;
+        sqe->poll32_events = events;
+        sqe->len           = IORING_POLL_ADD_MULTI;
+        sqe->user_data     = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepCancelFd(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->fd           = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data    = user_data;
+    }
+    return sqe;
+}
+
+struct io_uring_sqe* IoUring::PrepClose(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = GetSqe();
+    if (sqe) {
+        sqe->opcode    = IORING_OP_CLOSE;
+        sqe->fd        = fd;
+        sqe->user_data = user_data;
+    }
+    return sqe;
+}
+
+int IoUring::Submit()
+{
+    unsigned to_submit = pendingSqes();
+    if (to_submit == 0) {
+        return 0;
+    }
+    return enter(to_submit, 0, 0, nullptr, 0);
+}
+
+int IoUring::Wait(unsigned wait_nr, int timeout_ms, const sigset_t* sigmask)
+{
+    unsigned to_submit = pendingSqes();
+    if (to_submit == 0 && readyCqes() >= wait_nr) {
+        return 0;
+    }
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (sigmask) {
+        arg.sigmask    = reinterpret_cast<uint64_t>(sigmask);
+        arg.sigmask_sz = _NSIG / 8;
+    }
+    if (timeout_ms >= 0) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        arg.ts     = reinterpret_cast<uint64_t>(&ts);
+    }
+    int ret = enter(to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return ret < 0 ? ret : 0;
+}
+
+unsigned IoUring::pendingSqes() const
+{
+    return sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+unsigned IoUring::readyCqes() const
+{
+    return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz)
+{
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    int fd = fd_;
+    if (ring_index_ != -1) {
+        fd = ring_index_;
+        flags |= IORING_ENTER_REGISTERED_RING;
+    }
+    int ret = static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+    return ret < 0 ? -errno : ret;
+}
@@ -1,4 +1,6 @@
 #include "getopt.h"
+#include <climits>
+#include <algorithm>
 #include "net_cache_server_util.hpp"
 
 struct option longopts[] = {
@@ -6,16 +8,126 @@ struct option longopts[] = {
     {"origin", required_argument, 0, 1},
     {"keep-alive", required_argument, 0, 2},
     {"clear-cache", no_argument, 0, 3},
+    {"negative-ttl", required_argument, 0, 4},
+    {"sort-query", no_argument, 0, 5},
+    {"strip-params", required_argument, 0, 6},
+    {"lowercase-host", no_argument, 0, 7},
+    {"max-bytes", required_argument, 0, 8},
+    {"purge", required_argument, 0, 9},
+    {"purge-prefix", required_argument, 0, 10},
+    {"purge-tag", required_argument, 0, 11},
+    {"stats", no_argument, 0, 12},
+    {"set-ttl", required_argument, 0, 13},
+    {"set-negative-ttl", required_argument, 0, 14},
+    {"set-max-bytes", required_argument, 0, 15},
+    {"warm", required_argument, 0, 16},
+    {"warm-concurrency", required_argument, 0, 17},
+    {"warm-rate", required_argument, 0, 18},
+    {"metrics-path", required_argument, 0, 19},
+    {"access-log", required_argument, 0, 20},
+    {"access-log-buffer", required_argument, 0, 21},
+    {"access-log-policy", required_argument, 0, 22},
+    {"access-log-sample", required_argument, 0, 23},
+    {"trace-sample", required_argument, 0, 24},
+    {"trace-slow-ms", required_argument, 0, 25},
+    {"trace-file", required_argument, 0, 26},
+    {"capture", required_argument, 0, 27},
+    {"workers", required_argument, 0, 28},
+    {"max-connections", required_argument, 0, 29},
+    {"max-origin-fetches", required_argument, 0, 30},
+    {"rate-limit", required_argument, 0, 31},
+    {"rate-burst", required_argument, 0, 32},
+    {"header-timeout-ms", required_argument, 0, 33},
+    {"body-timeout-ms", required_argument, 0, 34},
+    {"idle-timeout-ms", required_argument, 0, 35},
+    {"write-timeout-ms", required_argument, 0, 36},
+    {"tls-cert", required_argument, 0, 37},
+    {"tls-key", required_argument, 0, 38},
+    {"tls-session-cache", required_argument, 0, 39},
+    {"io-backend", required_argument, 0, 40},
+    {"minify-json", no_argument, 0, 41},
+    {"json-select", no_argument, 0, 42},
     {0, 0, 0, 0}};
 
 void CheckCacheServerStarted() {
-    int pipe_fd = open(NAMED_PIPE, O_RDWR);
-    if (-1 != pipe_fd) {
+    int ctl_fd = ControlSocket::Connect();
+    if (-1 != ctl_fd) {
         fprintf(stderr, "Cache proxy server has started!");
-        close(pipe_fd);
+        close(ctl_fd);
         exit(EXIT_FAILURE);
     }
-    close(pipe_fd);
+}
+
+// Send one control command to the running server and exit.
+void SendControl(ControlOp op, const std::string& payload = "") {
+    ControlHeader header;
+    std::string resp;
+    if (!ControlSocket::Request(op, payload, header, resp)) {
+        fprintf(stderr, "Cache proxy server haven't started!");
+        exit(EXIT_FAILURE);
+    }
+    if (header.status != static_cast<uint8_t>(ControlStatus::kOk)) {
+        fprintf(stderr, "Control command rejected(%d)%s.\n", header.status,
+            header.status == static_cast<uint8_t>(ControlStatus::kBusy) ? ", busy" : "");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t purged = 0;
+    ControlStats stats;
+    switch (op)
+    {
+    case ControlOp::kClearCache:
+        fprintf(stdout, "Cache has been cleared.");
+        break;
+    case ControlOp::kWarm:
+        fprintf(stdout, "Warm-up started, see --stats for progress.\n");
+        break;
+    case ControlOp::kPurgeUrl:
+    case ControlOp::kPurgePrefix:
+    case ControlOp::kPurgeTag:
+        if (resp.size() == sizeof(purged)) {
+            memcpy(&purged, resp.data(), sizeof(purged));
+        }
+        fprintf(stdout, "Purged %llu entries.\n", (unsigned long long)purged);
+        break;
+    case ControlOp::kStats:
+        if (resp.size() != sizeof(stats)) {
+            fprintf(stderr, "Got malformed stats.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&stats, resp.data(), sizeof(stats));
+        fprintf(stdout,
+            "entries: %llu\n"
+            "negative_entries: %llu\n"
+            "bytes: %llu\n"
+            "max_bytes: %llu\n"
+            "ttl: %u\n"
+            "negative_ttl: %u\n"
+            "warm: %llu/%llu done, %llu failed\n",
+            (unsigned long long)stats.entries,
+            (unsigned long long)stats.negative_entries,
+            (unsigned long long)stats.bytes,
+            (unsigned long long)stats.max_bytes,
+            stats.ttl,
+            stats.negative_ttl,
+            (unsigned long long)stats.warm_done,
+            (unsigned long long)stats.warm_total,
+            (unsigned long long)stats.warm_failed);
+        break;
+    default:
+        fprintf(stdout, "Done.\n");
+        break;
+    }
+    exit(EXIT_SUCCESS);
+}
+
+std::string U32Payload(const char* arg) {
+    uint32_t v = static_cast<uint32_t>(strtoul(arg, 0, 10));
+    return std::string((const char*)&v, sizeof(v));
+}
+
+std::string U64Payload(const char* arg) {
+    uint64_t v = static_cast<uint64_t>(strtoull(arg, 0, 10));
+    return std::string((const char*)&v, sizeof(v));
 }
 
 int main(int argc, char *const argv[])
@@ -31,10 +143,38 @@ int main(int argc, char *const argv[])
     int forward_port = 3000;
     const char *forward_origin = "https://dummyjson.com";
     int keep_alive_seconds = 300;
-    PipeMessage msg{
-        .pid = getpid()
-    };
-    int pipe_fd = -1;
+    int negative_ttl_seconds = 0;
+    bool sort_query = false;
+    const char *strip_params = "";
+    bool lowercase_host = false;
+    size_t max_bytes = 0;
+    const char *warm_file = nullptr;
+    int warm_concurrency = 4;
+    int warm_rate = 50;
+    const char *metrics_path = "/__cps/metrics";
+    const char *access_log = "-";
+    size_t access_log_buffer = 1024;
+    AccessLogPolicy access_log_policy = AccessLogPolicy::kDrop;
+    int access_log_sample = 1;
+    int trace_sample = 0;
+    int trace_slow_ms = 100;
+    const char *trace_file = "caching-proxy-trace.json";
+    const char *capture_file = "";
+    int workers = 8;
+    size_t max_connections = 1024;
+    int max_origin_fetches = 0;
+    double rate_limit = 0;
+    double rate_burst = 20;
+    int header_timeout_ms = 10000;
+    int body_timeout_ms = 30000;
+    int idle_timeout_ms = 5000;
+    int write_timeout_ms = 30000;
+    const char *tls_cert = "";
+    const char *tls_key = "";
+    long tls_session_cache = 20480;
+    IoBackend io_backend = IoBackend::kEpoll;
+    bool minify_json = false;
+    bool json_select = false;
     while ((c = getopt_long(argc, argv, "", longopts, &longindex)) != -1)
     {
         switch (c)
@@ -49,21 +189,128 @@ int main(int argc, char *const argv[])
             keep_alive_seconds = atoi(optarg);
             break;
         case 3:
-            // Clear cache
-            pipe_fd = open(NAMED_PIPE, O_WRONLY);
-            if (-1 == pipe_fd) {
-                fprintf(stderr, "Cache proxy server haven't started!");
-                close(pipe_fd);
-                exit(EXIT_FAILURE);
-            }
-            if (write(pipe_fd, &msg, sizeof(msg)) < 0) {
-                fprintf(stderr, "Write into pipe failed\n");
-                close(pipe_fd);
-                exit(EXIT_FAILURE);
-            }
-            fprintf(stdout, "Cache has been cleared.");
-            close(pipe_fd);
-            exit(EXIT_SUCCESS);
+            SendControl(ControlOp::kClearCache);
+            break;
+        case 4:
+            negative_ttl_seconds = atoi(optarg);
+            break;
+        case 5:
+            sort_query = true;
+            break;
+        case 6:
+            strip_params = optarg;
+            break;
+        case 7:
+            lowercase_host = true;
+            break;
+        case 8:
+            max_bytes = static_cast<size_t>(strtoull(optarg, 0, 10));
+            break;
+        case 9:
+            SendControl(ControlOp::kPurgeUrl, optarg);
+            break;
+        case 10:
+            SendControl(ControlOp::kPurgePrefix, optarg);
+            break;
+        case 11:
+            SendControl(ControlOp::kPurgeTag, optarg);
+            break;
+        case 12:
+            SendControl(ControlOp::kStats);
+            break;
+        case 13:
+            SendControl(ControlOp::kSetTtl, U32Payload(optarg));
+            break;
+        case 14:
+            SendControl(ControlOp::kSetNegativeTtl, U32Payload(optarg));
+            break;
+        case 15:
+            SendControl(ControlOp::kSetMaxBytes, U64Payload(optarg));
+            break;
+        case 16:
+            warm_file = optarg;
+            break;
+        case 17:
+            warm_concurrency = atoi(optarg);
+            break;
+        case 18:
+            warm_rate = atoi(optarg);
+            break;
+        case 19:
+            metrics_path = optarg;
+            break;
+        case 20:
+            access_log = 0 == strcmp(optarg, "off") ? "" : optarg;
+            break;
+        case 21:
+            access_log_buffer = static_cast<size_t>(strtoull(optarg, 0, 10));
+            break;
+        case 22:
+            ErrIf(0 != strcmp(optarg, "drop") && 0 != strcmp(optarg, "block"),
+                "--access-log-policy takes drop or block, got [%s].", optarg);
+            access_log_policy = 0 == strcmp(optarg, "block") ? AccessLogPolicy::kBlock : AccessLogPolicy::kDrop;
+            break;
+        case 23:
+            access_log_sample = atoi(optarg);
+            break;
+        case 24:
+            trace_sample = atoi(optarg);
+            break;
+        case 25:
+            trace_slow_ms = atoi(optarg);
+            break;
+        case 26:
+            trace_file = optarg;
+            break;
+        case 27:
+            capture_file = optarg;
+            break;
+        case 28:
+            workers = atoi(optarg);
+            break;
+        case 29:
+            max_connections = static_cast<size_t>(strtoull(optarg, 0, 10));
+            break;
+        case 30:
+            max_origin_fetches = atoi(optarg);
+            break;
+        case 31:
+            rate_limit = atof(optarg);
+            break;
+        case 32:
+            rate_burst = atof(optarg);
+            break;
+        case 33:
+            header_timeout_ms = atoi(optarg);
+            break;
+        case 34:
+            body_timeout_ms = atoi(optarg);
+            break;
+        case 35:
+            idle_timeout_ms = atoi(optarg);
+            break;
+        case 36:
+            write_timeout_ms = atoi(optarg);
+            break;
+        case 37:
+            tls_cert = optarg;
+            break;
+        case 38:
+            tls_key = optarg;
+            break;
+        case 39:
+            tls_session_cache = atol(optarg);
+            break;
+        case 40:
+            ErrIf(0 != strcmp(optarg, "epoll") && 0 != strcmp(optarg, "uring"),
+                "--io-backend takes epoll or uring, got [%s].", optarg);
+            io_backend = 0 == strcmp(optarg, "uring") ? IoBackend::kUring : IoBackend::kEpoll;
+            break;
+        case 41:
+            minify_json = true;
+            break;
+        case 42:
+            json_select = true;
             break;
         case '?':
         default:
@@ -73,12 +320,55 @@ int main(int argc, char *const argv[])
     ErrIf(longindex == -1, "Usage:\r\n%s --port <number> --origin <url> --keep-alive <seconds> or %s --clear-cache", argv[0], argv[0]);
 #ifdef _DEBUG
     fprintf(stdout, "forward_port: %d, forward_origin: %s, keep-alive: %d.\n", forward_port, forward_origin, keep_alive_seconds);
-    fprintf(stdout, "pipe_path: %s.\n", NAMED_PIPE);
+    fprintf(stdout, "control_socket: %s.\n", CONTROL_SOCKET);
     fflush(stdout);
 #endif // _DEBUG
+    if (warm_file) {
+        char warm_path[PATH_MAX];
+        ErrIf(!realpath(warm_file, warm_path), "Warm-up file [%s] not found.", warm_file);
+        // Running server warms up, otherwise warm up after start
+        int ctl_fd = ControlSocket::Connect();
+        if (-1 != ctl_fd) {
+            close(ctl_fd);
+            SendControl(ControlOp::kWarm, warm_path);
+        }
+        NetCacheServerUtil::GetInstance().SetWarmFile(warm_path);
+    }
     CheckCacheServerStarted();
-    NetCacheServerUtil::GetInstance().Init(forward_port, keep_alive_seconds);
+    CacheWarmer::GetInstance().Init(warm_concurrency, warm_rate);
+    ErrIf(
+        !AccessLog::GetInstance().Init(access_log, access_log_buffer, access_log_policy, access_log_sample),
+        "Open access log [%s] failed.",
+        access_log
+    );
+    AccessLog::GetInstance().Start();
+    ErrIf(
+        !Tracer::GetInstance().Init(trace_sample, trace_slow_ms, trace_file),
+        "Open trace file [%s] failed.",
+        trace_file
+    );
+    ErrIf(!Capture::GetInstance().Init(capture_file), "Open capture file [%s] failed.", capture_file);
+    CacheKey::GetInstance().Init(sort_query, strip_params, lowercase_host);
+    ErrIf(!*tls_cert != !*tls_key, "--tls-cert and --tls-key go together.");
+    NetCacheServerUtil::GetInstance().Init(forward_port, keep_alive_seconds, "127.0.0.1", *tls_cert != '\0');
+    NetCacheServerUtil::GetInstance().SetTls(tls_cert, tls_key, tls_session_cache);
+    NetCacheServerUtil::GetInstance().SetIoBackend(io_backend);
+    NetCacheServerUtil::GetInstance().SetNegativeCache(negative_ttl_seconds);
+    NetCacheServerUtil::GetInstance().SetMinifyJson(minify_json);
+    NetCacheServerUtil::GetInstance().SetJsonSelect(json_select);
+    NetCacheServerUtil::GetInstance().SetMetricsPath(metrics_path);
+    // Leave a worker for cache hits while origin is slow, unset picks workers - 1
+    ErrIf(max_origin_fetches < 0 || max_origin_fetches > std::max(1, workers - 1),
+        "--max-origin-fetches %d must stay below --workers %d.", max_origin_fetches, workers);
+    NetCacheServerUtil::GetInstance().SetWorkers(workers);
+    NetCacheServerUtil::GetInstance().SetOverload(max_connections, max_origin_fetches);
+    NetCacheServerUtil::GetInstance().SetRateLimit(rate_limit, rate_burst);
+    NetCacheServerUtil::GetInstance().SetTimeouts(header_timeout_ms, body_timeout_ms, idle_timeout_ms, write_timeout_ms);
+    CacheTimer::GetInstance().SetMaxBytes(max_bytes);
     NetCacheServerUtil::GetInstance().Start(forward_origin);
-    unlink(NAMED_PIPE);
+    CacheWarmer::GetInstance().Stop();
+    AccessLog::GetInstance().Stop();
+    Capture::GetInstance().Stop();
+    unlink(CONTROL_SOCKET);
     exit(EXIT_SUCCESS);
 }
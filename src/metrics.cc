@@ -0,0 +1,260 @@
+#include "metrics.hpp"
+#include "trace.hpp"
+
+namespace {
+
+struct CounterInfo {
+    const char* name;
+    const char* help;
+};
+
+const CounterInfo kCounterInfo[] = {
+    {"cps_requests_total", "Client requests handled."},
+    {"cps_cache_hits_total", "Requests served from cache."},
+    {"cps_cache_misses_total", "Requests forwarded to origin."},
+    {"cps_cache_negative_hits_total", "Requests served from a negative entry."},
+    {"cps_cache_stale_total", "Lookups that found an expired entry."},
+    {"cps_cache_evictions_total", "Entries evicted over the byte budget."},
+    {"cps_cache_expirations_total", "Entries dropped after inactivity or ttl."},
+    {"cps_origin_errors_total", "Origin fetches that failed."},
+    {"cps_client_bytes_in_total", "Bytes read from clients."},
+    {"cps_client_bytes_out_total", "Bytes written to clients."},
+    {"cps_origin_bytes_in_total", "Bytes read from origin."},
+    {"cps_access_log_dropped_total", "Access log records dropped on a full ring."},
+    {"cps_shed_connections_total", "Connections refused with 503 over the connection cap."},
+    {"cps_shed_origin_total", "Misses answered 503 over the in-flight origin fetch cap."},
+    {"cps_rate_limited_total", "Connections refused with 429 by the per-client rate limit."},
+    {"cps_accept_errors_total", "Failed accept() calls."},
+    {"cps_header_timeouts_total", "Connections closed before sending full request headers in time."},
+    {"cps_body_timeouts_total", "Connections closed before sending the full request body in time."},
+    {"cps_idle_timeouts_total", "Connections closed after going quiet for the idle timeout."},
+    {"cps_write_timeouts_total", "Connections closed before reading the whole response in time."},
+    {"cps_tls_handshakes_total", "Client TLS handshakes completed."},
+    {"cps_tls_resumed_total", "Client TLS handshakes resumed from a session id or ticket."},
+    {"cps_tls_handshake_errors_total", "Client TLS handshakes that failed."},
+    {"cps_tls_ktls_total", "Client TLS connections sending through kernel TLS."},
+    {"cps_passthrough_requests_total", "Non-GET requests streamed to origin uncached."},
+    {"cps_cache_invalidations_total", "Entries purged by unsafe requests to their url."},
+    {"cps_json_minified_total", "JSON replies cached re-serialized without whitespace."},
+    {"cps_json_minify_saved_bytes_total", "Bytes JSON minification took off cached replies."},
+    {"cps_json_minify_failed_total", "JSON replies cached as sent, they could not be minified exactly."},
+    {"cps_json_select_total", "Select requests answered from a cached JSON document."},
+};
+
+thread_local RequestStages* tls_stages = nullptr;
+
+const char* kStageNames[] = {
+    "accept_parse",
+    "cache_lookup",
+    "origin_connect",
+    "tls_handshake",
+    "origin_ttfb",
+    "body_transfer",
+    "client_write",
+};
+
+const TraceEvent kStageEvents[] = {
+    TraceEvent::kAcceptParse,
+    TraceEvent::kCacheLookup,
+    TraceEvent::kOriginConnect,
+    TraceEvent::kTlsHandshake,
+    TraceEvent::kOriginTtfb,
+    TraceEvent::kBodyTransfer,
+    TraceEvent::kClientWrite,
+};
+
+// Exported bucket bounds(s), fine buckets are folded into these
+const double kExportBounds[] = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+    0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+}
+
+uint64_t HistogramSnapshot::Quantile(double q) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen > rank) {
+            return Metrics::BucketUpper(i);
+        }
+    }
+    return Metrics::BucketUpper(buckets.size() - 1);
+}
+
+Metrics::Metrics() {
+
+}
+
+Metrics::~Metrics() {
+    // Slabs may still be written by detached threads at exit
+}
+
+Metrics& Metrics::GetInstance() {
+    static Metrics ins;
+    return ins;
+}
+
+void Metrics::Add(Counter counter, uint64_t n)
+{
+    std::atomic<uint64_t>& c = slab()->counters[static_cast<int>(counter)];
+    // Single writer, a plain load/store pair is enough
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Metrics::Observe(Stage stage, SteadyClock::time_point begin, SteadyClock::time_point end)
+{
+    ObserveUs(stage, std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count());
+    if (Tracer::Active()) {
+        Tracer::GetInstance().Record(kStageEvents[static_cast<int>(stage)], begin, end);
+    }
+}
+
+void Metrics::ObserveUs(Stage stage, uint64_t us)
+{
+    MetricsSlab* s = slab();
+    int st = static_cast<int>(stage);
+    std::atomic<uint64_t>& b = s->buckets[st][BucketIndex(us)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic<uint64_t>& sum = s->sum_us[st];
+    sum.store(sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    if (tls_stages) {
+        tls_stages->us[st] += static_cast<uint32_t>(us);
+    }
+}
+
+void Metrics::BindRequest(RequestStages* stages)
+{
+    tls_stages = stages;
+}
+
+uint64_t Metrics::GetCounter(Counter counter)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t total = 0;
+    for (auto s : slabs_) {
+        total += s->counters[static_cast<int>(counter)].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+HistogramSnapshot Metrics::GetHistogram(Stage stage)
+{
+    HistogramSnapshot snapshot;
+    snapshot.buckets.assign(METRICS_BUCKETS, 0);
+    snapshot.count  = 0;
+    snapshot.sum_us = 0;
+    int st = static_cast<int>(stage);
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto s : slabs_) {
+        for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+            uint64_t n = s->buckets[st][i].load(std::memory_order_relaxed);
+            snapshot.buckets[i] += n;
+            snapshot.count += n;
+        }
+        snapshot.sum_us += s->sum_us[st].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void Metrics::Render(std::string& out)
+{
+    char buffer[256];
+    for (int i = 0; i < static_cast<int>(Counter::kCounterCount); ++i) {
+        snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+            kCounterInfo[i].name, kCounterInfo[i].help, kCounterInfo[i].name, kCounterInfo[i].name,
+            (unsigned long long)GetCounter(static_cast<Counter>(i)));
+        out.append(buffer);
+    }
+
+    out.append("# HELP cps_stage_latency_seconds Per-stage request latency.\n");
+    out.append("# TYPE cps_stage_latency_seconds histogram\n");
+    std::vector<HistogramSnapshot> snapshots;
+    for (int st = 0; st < static_cast<int>(Stage::kStageCount); ++st) {
+        snapshots.push_back(GetHistogram(static_cast<Stage>(st)));
+        const HistogramSnapshot& h = snapshots.back();
+        const char* name = kStageNames[st];
+        size_t fine = 0;
+        uint64_t cumulative = 0;
+        for (double bound : kExportBounds) {
+            uint64_t bound_us = static_cast<uint64_t>(bound * 1e6);
+            while (fine < h.buckets.size() && BucketUpper(fine) <= bound_us) {
+                cumulative += h.buckets[fine++];
+            }
+            snprintf(buffer, sizeof(buffer), "cps_stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                name, bound, (unsigned long long)cumulative);
+            out.append(buffer);
+        }
+        snprintf(buffer, sizeof(buffer),
+            "cps_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+            "cps_stage_latency_seconds_sum{stage=\"%s\"} %.6f\n"
+            "cps_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+            name, (unsigned long long)h.count,
+            name, h.sum_us / 1e6,
+            name, (unsigned long long)h.count);
+        out.append(buffer);
+    }
+
+    out.append("# HELP cps_stage_latency_quantile_seconds Per-stage latency quantiles.\n");
+    out.append("# TYPE cps_stage_latency_quantile_seconds gauge\n");
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    for (int st = 0; st < static_cast<int>(Stage::kStageCount); ++st) {
+        for (double q : quantiles) {
+            snprintf(buffer, sizeof(buffer), "cps_stage_latency_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+                kStageNames[st], q, snapshots[st].Quantile(q) / 1e6);
+            out.append(buffer);
+        }
+    }
+}
+
+size_t Metrics::BucketIndex(uint64_t us)
+{
+    if (us < METRICS_SUB_BUCKETS) {
+        return static_cast<size_t>(us);
+    }
+    int exp = 63 - __builtin_clzll(us);
+    if (exp > METRICS_MAX_EXP) {
+        return METRICS_BUCKETS - 1;
+    }
+    size_t sub = (us >> (exp - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return METRICS_SUB_BUCKETS + (exp - METRICS_SUB_BITS) * METRICS_SUB_BUCKETS + sub;
+}
+
+uint64_t Metrics::BucketUpper(size_t idx)
+{
+    if (idx < METRICS_SUB_BUCKETS) {
+        return idx;
+    }
+    size_t exp = METRICS_SUB_BITS + (idx - METRICS_SUB_BUCKETS) / METRICS_SUB_BUCKETS;
+    uint64_t sub = (idx - METRICS_SUB_BUCKETS) % METRICS_SUB_BUCKETS;
+    return ((METRICS_SUB_BUCKETS + sub + 1) << (exp - METRICS_SUB_BITS)) - 1;
+}
+
+const char* Metrics::StageName(Stage stage)
+{
+    return kStageNames[static_cast<int>(stage)];
+}
+
+MetricsSlab* Metrics::slab()
+{
+    static thread_local MetricsSlab* local = nullptr;
+    if (!local) {
+        local = new MetricsSlab();
+        for (auto& c : local->counters) c.store(0, std::memory_order_relaxed);
+        for (auto& stage : local->buckets) {
+            for (auto& b : stage) b.store(0, std::memory_order_relaxed);
+        }
+        for (auto& s : local->sum_us) s.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mtx_);
+        slabs_.push_back(local);
+    }
+    return local;
+}
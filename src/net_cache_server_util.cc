@@ -1,18 +1,380 @@
 #include "net_cache_server_util.hpp"
 
+namespace {
+
+const char kResp503[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char kResp429[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char kResp408[] =
+    "HTTP/1.1 408 Request Timeout\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char kResp413[] =
+    "HTTP/1.1 413 Content Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char kResp502[] =
+    "HTTP/1.1 502 Bad Gateway\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+const char kResp431[] =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+// Request size caps, a client may not make the proxy buffer more
+const size_t kMaxHeaderBytes = 64 << 10;
+const size_t kMaxBodyBytes   = 8 << 20;
+
+// Largest splice() of a streamed body, one pipe's worth
+const size_t kRelayChunk = 64 << 10;
+
+// epoll tags for the fds that are not client connections
+char kListenTag, kControlTag, kWakeTag;
+
+// io_uring user_data of the same fds, connections use their address
+const uint64_t kUringAccept  = 1;
+const uint64_t kUringControl = 2;
+const uint64_t kUringWake    = 3;
+const uint64_t kUringOpMask  = 7;
+
+// Set by SIGINT. io_uring_enter reports what it submitted rather than EINTR
+// when a signal cuts the wait short, so the loop checks this too
+volatile sig_atomic_t interrupted = 0;
+
+// Provided buffers for the multishot recvs of every connection
+const uint16_t kUringBufGroup = 0;
+const unsigned kUringBufCount = 1024;
+const unsigned kUringBufSize  = 4096;
+
+SteadyClock::time_point deadlineAfter(SteadyClock::time_point now, std::chrono::milliseconds timeout) {
+    return timeout.count() > 0 ? now + timeout : SteadyClock::time_point::max();
+}
+
+// Content-Length of the request whose headers are in[0, header_len)
+size_t contentLength(const std::string& in, size_t header_len) {
+    static const char kName[] = "\r\ncontent-length:";
+    const size_t name_len = sizeof(kName) - 1;
+    for (size_t i = 0; i + name_len <= header_len; ++i) {
+        if (strncasecmp(in.data() + i, kName, name_len) == 0) {
+            return static_cast<size_t>(strtoull(in.c_str() + i + name_len, 0, 10));
+        }
+    }
+    return 0;
+}
+
+// GET and HEAD go through the cache, everything else is proxied as is
+bool passThrough(const std::string& in) {
+    return in.compare(0, 4, "GET ") != 0 && in.compare(0, 5, "HEAD ") != 0;
+}
+
+// Headers of the hop to the proxy, Host is set again for origin
+bool hopByHop(const char* name, size_t len) {
+    static const char* kNames[] = {"Host", "Connection", "Keep-Alive", "Proxy-Connection",
+        "Proxy-Authorization", "TE", "Trailer", "Upgrade"};
+    for (const char* hop : kNames) {
+        if (strlen(hop) == len && strncasecmp(name, hop, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Headers a cache fill leaves out: it sends no body and wants the whole
+// representation, not a 304 or a range of it
+bool fillSkips(const char* name, size_t len) {
+    static const char* kNames[] = {"Content-Length", "Transfer-Encoding", "Expect", "Range", "If-Range",
+        "If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since"};
+    for (const char* skip : kNames) {
+        if (strlen(skip) == len && strncasecmp(name, skip, len) == 0) {
+            return true;
+        }
+    }
+    return hopByHop(name, len);
+}
+
+// Header lines of in[0, header_len) to send on to origin, CRLF between them
+void forwardHeaders(const std::string& in, size_t header_len, std::string& header) {
+    size_t pos = in.find("\r\n") + 2;
+    while (pos + 2 < header_len) {
+        size_t eol = in.find("\r\n", pos);
+        size_t colon = in.find(':', pos);
+        if (colon != std::string::npos && colon < eol && !hopByHop(in.data() + pos, colon - pos)) {
+            if (!header.empty()) {
+                header.append("\r\n");
+            }
+            header.append(in, pos, eol - pos);
+        }
+        pos = eol + 2;
+    }
+}
+
+// Body of `resp` is plain application/json, Content-Type parameters aside
+bool isJsonBody(const HttpResponse& resp)
+{
+    static const char kJson[] = "application/json";
+    const std::string* type = CacheKey::FindHeader(resp.header, "Content-Type");
+    if (!type) {
+        return false;
+    }
+    size_t pos = type->find_first_not_of(" \t");
+    if (pos == std::string::npos || 0 != strncasecmp(type->c_str() + pos, kJson, sizeof(kJson) - 1)) {
+        return false;
+    }
+    char next = type->c_str()[pos + sizeof(kJson) - 1];
+    if (next != '\0' && next != ';' && next != ' ' && next != '\t') {
+        return false;
+    }
+    const std::string* encoding = CacheKey::FindHeader(resp.header, "Content-Encoding");
+    return !encoding || 0 == strcasecmp(encoding->c_str(), "identity");
+}
+
+// Integers past int64 come back as doubles, written rounded and in exponent
+// form, and so do infinities. -0 is kept out too, readers disagree on it.
+bool lossyNumbers(const HJson* node)
+{
+    for (; node; node = node->next) {
+        if (node->type == ValueType::kNumber && !node->integral
+            && ((std::fabs(node->dv) >= 9007199254740992.0 && node->dv == std::floor(node->dv))
+                || (node->dv == 0 && std::signbit(node->dv)))) {
+            return true;
+        }
+        if (node->child && lossyNumbers(node->child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse `body` into an arena of its own, indexed so threads can share it.
+// @param bytes memory the document holds
+// @return the document, owning the arena, or null unless HJson writes it
+//         back without losing anything
+std::shared_ptr<HJson> parseJson(const std::string& body, size_t& bytes)
+{
+    // HJson strings end at their first NUL, an escaped one would cut them short
+    if (body.find("\\u0000") != std::string::npos) {
+        return nullptr;
+    }
+    std::shared_ptr<HJson_arena> arena(HJson_arenaNew(), HJson_arenaDelete);
+    if (!arena) {
+        return nullptr;
+    }
+    HJson_reader ctx{};
+    ctx.arena = arena.get();
+    HJson* root = HJson_parseContext(body.data(), body.size(), &ctx);
+    if (!root || lossyNumbers(root)) {
+        return nullptr;
+    }
+    HJson_buildIndex(root);
+    bytes = HJson_arenaBytes(arena.get());
+    return std::shared_ptr<HJson>(arena, root);
+}
+
+// Compact text of `node`. @return false on allocation failure
+bool writeJson(HJson* node, std::string& out)
+{
+    out.resize(HJson_measure(node) + 1);
+    int length = HJson_writeTo(node, &out[0], out.size());
+    out.resize(length > 0 ? length : 0);
+    return length > 0;
+}
+
+// Copy of `node` from `arena`, sharing its children
+HJson* shallowCopy(const HJson* node, HJson_arena* arena)
+{
+    HJson* copy = HJson_new(arena);
+    if (copy) {
+        *copy = *node;
+        copy->next = nullptr;
+    }
+    return copy;
+}
+
+// Object `node` with only the members named in `fields`, in that order
+HJson* projectObject(HJson* node, const std::vector<std::string>& fields, HJson_arena* arena)
+{
+    HJson* out = shallowCopy(node, arena);
+    if (!out) {
+        return nullptr;
+    }
+    out->child = nullptr;
+    out->index = nullptr;
+    HJson** tail = &out->child;
+    for (auto& field : fields) {
+        HJson* member = node->get(field.c_str());
+        if (!member) {
+            continue;
+        }
+        if (!(*tail = shallowCopy(member, arena))) {
+            return nullptr;
+        }
+        tail = &(*tail)->next;
+    }
+    return out;
+}
+
+// Array of objects only, empty or not
+bool isRecords(const HJson* node)
+{
+    if (node->type != ValueType::kArray) {
+        return false;
+    }
+    for (HJson* p = node->child; p; p = p->next) {
+        if (p->type != ValueType::kObject) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Container `node` with its records projected: the objects of an array, or
+// the one array of records of an envelope. Everything else is kept.
+HJson* projectRecords(HJson* node, const std::vector<std::string>& fields, HJson_arena* arena)
+{
+    HJson* out = shallowCopy(node, arena);
+    if (!out) {
+        return nullptr;
+    }
+    out->child = nullptr;
+    out->index = nullptr;
+    HJson** tail = &out->child;
+    for (HJson* p = node->child; p; p = p->next) {
+        if (node->type == ValueType::kArray && p->type == ValueType::kObject) {
+            *tail = projectObject(p, fields, arena);
+        } else if (node->type == ValueType::kObject && isRecords(p)) {
+            *tail = projectRecords(p, fields, arena);
+        } else {
+            *tail = shallowCopy(p, arena);
+        }
+        if (!*tail) {
+            return nullptr;
+        }
+        tail = &(*tail)->next;
+    }
+    return out;
+}
+
+// A page of a list as dummyjson sends it: total, skip and limit next to
+// exactly one array of records, {"products":[...],"total":100,...}
+bool isEnvelope(HJson* node)
+{
+    if (node->type != ValueType::kObject
+        || !node->get("total") || !node->get("skip") || !node->get("limit")) {
+        return false;
+    }
+    int records = 0;
+    for (HJson* p = node->child; p; p = p->next) {
+        records += isRecords(p) ? 1 : 0;
+    }
+    return records == 1;
+}
+
+// `fields` of the records in `root`: the elements of a top level array, those
+// of an envelope's array, or else the document itself
+HJson* projectJson(HJson* root, const std::vector<std::string>& fields, HJson_arena* arena)
+{
+    if (root->type == ValueType::kArray || isEnvelope(root)) {
+        return projectRecords(root, fields, arena);
+    }
+    if (root->type != ValueType::kObject) {
+        return nullptr;
+    }
+    return projectObject(root, fields, arena);
+}
+
+// Header block of a projection `length` bytes long out of the one cached
+// with the document, whose length and validator no longer hold
+std::string projectHeader(const std::string& header, size_t length)
+{
+    std::string out;
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t eol = header.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            eol = header.size();
+        }
+        size_t colon = header.find(':', pos);
+        std::string name = colon < eol ? header.substr(pos, colon - pos) : "";
+        if (eol > pos && 0 != strcasecmp(name.c_str(), "Content-Length") && 0 != strcasecmp(name.c_str(), "ETag")) {
+            out.append(header, pos, eol - pos);
+            out.append("\r\n");
+        }
+        pos = eol + 2;
+    }
+    out.append("Content-Length: ").append(std::to_string(length)).append("\r\n");
+    return out;
+}
+
+// Set field `name` of `header`, whatever case origin spelled it in
+void setHeader(std::unordered_map<std::string, std::string>& header, const char* name, const std::string& value)
+{
+    for (auto it = header.begin(); it != header.end(); ++it) {
+        if (0 == strcasecmp(it->first.c_str(), name)) {
+            it->second = value;
+            return;
+        }
+    }
+    header[name] = value;
+}
+
+// Holds one in-flight origin fetch slot until the fetch returns
+struct OriginSlot {
+    explicit OriginSlot(std::atomic<int>& n) : n_(n) {}
+    ~OriginSlot() { n_--; }
+    std::atomic<int>& n_;
+};
+
+}
+
 NetCacheServerUtil::NetCacheServerUtil()
     : ip_("")
     , port_(0)
     , keep_alive_seconds_(300)
+    , negative_ttl_seconds_(0)
+    , minify_json_(false)
+    , json_select_(false)
     , is_ssl_(false)
-    , http_req_()
-    , status_(HttpReqParseStatus::kParseRequestLine)
-    , pipe_fd_(-1) {
+    , ctl_fd_(-1)
+    , metrics_path_("/__cps/metrics")
+    , workers_(8)
+    , max_connections_(1024)
+    , max_origin_fetches_(0)
+    , connections_(0)
+    , origin_fetches_(0)
+    , stopping_(false)
+    , epoll_fd_(-1)
+    , wake_fd_(-1)
+    , header_timeout_(10000)
+    , body_timeout_(30000)
+    , idle_timeout_(5000)
+    , write_timeout_(30000)
+    , tls_session_cache_(20480)
+    , ssl_ctx_(nullptr)
+    , io_backend_(IoBackend::kEpoll)
+    , listen_fd_(-1)
+    , wake_count_(0) {
 
 }
 
 NetCacheServerUtil::~NetCacheServerUtil() {
     CacheTimer::GetInstance().Stop();
+    if (ssl_ctx_) {
+        SSL_CTX_free(ssl_ctx_);
+        ssl_ctx_ = nullptr;
+    }
 }
 
 NetCacheServerUtil& NetCacheServerUtil::GetInstance() {
@@ -22,6 +384,7 @@ NetCacheServerUtil& NetCacheServerUtil::GetInstance() {
 
 void NetCacheServerUtil::SignalHandler(int sig)
 {
+    interrupted = 1;
     fprintf(stdout, "Exiting...\n");
 }
 
@@ -42,106 +405,185 @@ void NetCacheServerUtil::Init(int port, int keep_alive_seconds, const char *ip,
     sigemptyset(&sigmask_);
     sigaddset(&sigmask_, SIGINT);
     sigprocmask(SIG_BLOCK, &sigmask_, &origmask_);
+    // A client gone before its reply must not take the process down
+    signal(SIGPIPE, SIG_IGN);
 
-    // Create named pipe
-    ErrIf(0 != mkfifo(NAMED_PIPE, 0666), "Create pipe failed.");
-    ErrIf(
-        (pipe_fd_ = open(NAMED_PIPE, O_RDWR)) == -1, 
-        [&](){unlink(NAMED_PIPE);}, 
-        "Open pipe failed."
-    );
+    // Create control socket
+    ErrIf((ctl_fd_ = ControlSocket::Listen()) == -1, "Create control socket failed.");
 
     // Cache timer init
     CacheTimer::GetInstance().Init(5, std::max(300, keep_alive_seconds_));
 }
 
-void NetCacheServerUtil::readMsg(int clisock, std::string &req)
+void NetCacheServerUtil::SetNegativeCache(int ttl_seconds)
 {
-    char buffer[1024] = {0};
-    int bytes_read = 0;
-    bytes_read = read(clisock, buffer, sizeof(buffer));
-    if (bytes_read < 0) {
-        return;
-    }
-    req.append(buffer);
-#ifdef _DEBUG
-    fprintf(stderr, "%s\n", req.c_str());
-#endif // _DEBUG
+    negative_ttl_seconds_ = std::max(0, ttl_seconds);
+}
+
+void NetCacheServerUtil::SetMinifyJson(bool minify)
+{
+    minify_json_ = minify;
+}
+
+void NetCacheServerUtil::SetJsonSelect(bool select)
+{
+    json_select_ = select;
+}
+
+void NetCacheServerUtil::SetMetricsPath(const std::string &path)
+{
+    metrics_path_ = path;
+}
+
+void NetCacheServerUtil::SetWarmFile(const std::string &path)
+{
+    warm_file_ = path;
+}
+
+void NetCacheServerUtil::SetWorkers(int workers)
+{
+    workers_ = std::max(1, workers);
+}
+
+void NetCacheServerUtil::SetOverload(size_t max_connections, int max_origin_fetches)
+{
+    max_connections_    = max_connections;
+    max_origin_fetches_ = std::max(0, max_origin_fetches);
+}
+
+void NetCacheServerUtil::SetRateLimit(double rate, double burst)
+{
+    rate_limiter_.Init(rate, burst);
+}
+
+void NetCacheServerUtil::SetTimeouts(int header_ms, int body_ms, int idle_ms, int write_ms)
+{
+    header_timeout_ = std::chrono::milliseconds(std::max(0, header_ms));
+    body_timeout_   = std::chrono::milliseconds(std::max(0, body_ms));
+    idle_timeout_   = std::chrono::milliseconds(std::max(0, idle_ms));
+    write_timeout_  = std::chrono::milliseconds(std::max(0, write_ms));
+}
+
+void NetCacheServerUtil::SetIoBackend(IoBackend backend)
+{
+    io_backend_ = backend;
+}
+
+void NetCacheServerUtil::SetTls(const std::string& cert_file, const std::string& key_file, long session_cache_size)
+{
+    tls_cert_          = cert_file;
+    tls_key_           = key_file;
+    tls_session_cache_ = std::max(0L, session_cache_size);
 }
 
-void NetCacheServerUtil::writeMsg(int clisock, const std::string& resp)
+void NetCacheServerUtil::initTls()
 {
-    int bytes_write = write(clisock, resp.c_str(), resp.size());
-    if (bytes_write < 0) {
-        fprintf(stderr, "Write operation failed.");
+    ssl_ctx_ = SSL_CTX_new(TLS_server_method());
+    ErrIf(!ssl_ctx_, [&](){unlink(CONTROL_SOCKET);}, "Create TLS context failed.");
+    SSL_CTX_set_min_proto_version(ssl_ctx_, TLS1_2_VERSION);
+    ErrIf(
+        SSL_CTX_use_certificate_chain_file(ssl_ctx_, tls_cert_.c_str()) != 1,
+        [&](){unlink(CONTROL_SOCKET);},
+        "Load certificate [%s] failed.",
+        tls_cert_.c_str()
+    );
+    ErrIf(
+        SSL_CTX_use_PrivateKey_file(ssl_ctx_, tls_key_.c_str(), SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(ssl_ctx_) != 1,
+        [&](){unlink(CONTROL_SOCKET);},
+        "Load private key [%s] failed.",
+        tls_key_.c_str()
+    );
+    // Every request is a new connection, resumption skips the full handshake:
+    // session ids against the cache for TLS 1.2, tickets(on by default, keys
+    // generated per context) for both
+    SSL_CTX_set_session_id_context(ssl_ctx_, reinterpret_cast<const unsigned char*>("cps"), 3);
+    if (tls_session_cache_ > 0) {
+        SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ssl_ctx_, tls_session_cache_);
+    } else {
+        SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_OFF);
     }
+    SSL_CTX_clear_options(ssl_ctx_, SSL_OP_NO_TICKET);
+    // Record encryption moves into the kernel where the tls ULP is available,
+    // OpenSSL silently stays in userspace otherwise
+    SSL_CTX_set_options(ssl_ctx_, SSL_OP_ENABLE_KTLS);
+    // Replies are written in pieces as the socket drains
+    SSL_CTX_set_mode(ssl_ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 }
 
-void NetCacheServerUtil::parseHttpRequest(const std::string &req)
+void NetCacheServerUtil::parseHttpRequest(const std::string &req, HttpRequest &http_req)
 {
     if (req.empty()) return;
+    TraceScope scope(TraceEvent::kParse);
+    HttpReqParseStatus status = HttpReqParseStatus::kParseRequestLine;
     size_t resp_len = req.size();
     const char* p = req.c_str();
     int parsed_bytes = 0;
     const char CRLF[] = "\r\n";
-    while (status_ != HttpReqParseStatus::kParseFinish) {
+    while (status != HttpReqParseStatus::kParseFinish) {
         const char* line_end = std::search(p + parsed_bytes, p + resp_len, CRLF, CRLF + 2);
         std::string line(p + parsed_bytes, line_end);
-        switch (status_)
+        switch (status)
         {
         case HttpReqParseStatus::kParseRequestLine:
-            parseRequestLine(line);
+            parseRequestLine(line, http_req, status);
             break;
         case HttpReqParseStatus::kParseHeaderField:
-            parseHeaderField(line);
+            parseHeaderField(line, http_req, status);
             if (resp_len - parsed_bytes <= 2) {
-                status_ = HttpReqParseStatus::kParseFinish;
+                status = HttpReqParseStatus::kParseFinish;
             }
             break;
         case HttpReqParseStatus::kParseMessageBody:
-            parseMessageBody(line);
+            parseMessageBody(line, http_req, status);
             break;
         default:
             break;
         }
         parsed_bytes += (line_end + 2 - (p + parsed_bytes));
     }
-    status_ = HttpReqParseStatus::kParseRequestLine;
 }
 
-void NetCacheServerUtil::parseRequestLine(const std::string &line)
+void NetCacheServerUtil::parseRequestLine(const std::string &line, HttpRequest &http_req, HttpReqParseStatus &status)
 {
     std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$", std::regex_constants::optimize);
     std::smatch match;
     if (std::regex_match(line, match, pattern)) {
-        http_req_.request_method = match[1];
-        http_req_.request_url    = match[2];
-        http_req_.http_version   = match[3];
-        status_ = HttpReqParseStatus::kParseHeaderField;
+        http_req.request_method = match[1];
+        http_req.request_url    = match[2];
+        http_req.http_version   = match[3];
+        status = HttpReqParseStatus::kParseHeaderField;
     } else {
-        status_ = HttpReqParseStatus::kParseFinish;
+        status = HttpReqParseStatus::kParseFinish;
 #ifdef _DEBUG
         fprintf(stderr, "Failed to parse status line: [%s].\n", line.c_str());
 #endif // _DEBUG
     }
 }
 
-void NetCacheServerUtil::parseHeaderField(const std::string &line)
+void NetCacheServerUtil::parseHeaderField(const std::string &line, HttpRequest &http_req, HttpReqParseStatus &status)
 {
     std::regex pattern("^([^ ]*): ?(.*)$", std::regex_constants::optimize);
     std::smatch match;
     if (std::regex_match(line, match, pattern)) {
-        http_req_.header[match[1]] = match[2];
-        http_req_.header_origin = line;
+        http_req.header[match[1]] = match[2];
+        // A miss sends these on, so each Vary variant is what origin returns for it
+        if (!fillSkips(line.data(), match.length(1))) {
+            if (!http_req.header_origin.empty()) {
+                http_req.header_origin.append("\r\n");
+            }
+            http_req.header_origin.append(line);
+        }
     } else {
-        status_ = HttpReqParseStatus::kParseMessageBody;
+        status = HttpReqParseStatus::kParseMessageBody;
     }
 }
 
-void NetCacheServerUtil::parseMessageBody(const std::string &line)
+void NetCacheServerUtil::parseMessageBody(const std::string &line, HttpRequest &http_req, HttpReqParseStatus &status)
 {
-    http_req_.body = line;
-    status_ = HttpReqParseStatus::kParseFinish;
+    http_req.body = line;
+    status = HttpReqParseStatus::kParseFinish;
 }
 
 void NetCacheServerUtil::constructHttpResponse(const HttpResponse &resp_origin, std::string &resp)
@@ -169,142 +611,1577 @@ void NetCacheServerUtil::constructHttpResponse(const HttpResponse &resp_origin,
 #endif // _DEBUG
 }
 
-void NetCacheServerUtil::handleConnect(int clisock)
+void NetCacheServerUtil::handleRequest(ClientConn* conn)
 {
-    // Read from client
-    std::string req = "";
-    readMsg(clisock, req);
-    parseHttpRequest(req);
-    // Judge cache hit or miss
-    std::string cache = CacheTimer::GetInstance().GetCache(http_req_.request_url);
-    HttpResponse resp_origin{};
-    if (cache.empty()) {
-        // Cache miss
-        fprintf(stdout, "Cache miss for [%s].\n", http_req_.request_url.c_str());
-        fflush(stdout);
-        int ret = NetClientUtil::GetInstance()
-                    .Get(http_req_.request_url.c_str(), http_req_.header_origin, resp_origin);
-        if (0 != ret) {
-            // Get failed
-            resp_origin.http_version = "1.1";
-            resp_origin.status_code = "502";
-            resp_origin.status_msg = "Bad Gateway";
-            resp_origin.header_origin = "X-Cache: MISS\r\n";
-            resp_origin.body = "";
-        } else {
-            extendHeader(resp_origin, "X-Cache: MISS");
-            CacheTimer::GetInstance().KeepCacheAlive(http_req_.request_url, resp_origin.body);
+    Metrics::GetInstance().BindRequest(&conn->stages);
+    Tracer::GetInstance().Bind(&conn->trace);
+    HttpRequest& http_req = conn->req;
+    // Only the head of a streamed request, its body goes by unparsed
+    parseHttpRequest(conn->stream ? conn->in.substr(0, conn->header_len) : conn->in, http_req);
+    auto parsed = SteadyClock::now();
+    Metrics::GetInstance().Observe(Stage::kAcceptParse, conn->accepted, parsed);
+    Metrics::GetInstance().Add(Counter::kRequests);
+    HttpResponse& resp_origin = conn->resp;
+    CacheStatus cache_status = CacheStatus::kAdmin;
+    if (conn->stream) {
+        cache_status = CacheStatus::kBypass;
+        if (streamRequest(conn)) {
+            conn->cache_status = cache_status;
+            Metrics::GetInstance().BindRequest(nullptr);
+            Tracer::GetInstance().Bind(nullptr);
+            finishConnect(conn);
+            close(conn->fd);
+            delete conn;
+            connections_--;
+            return;
         }
+    } else if (!metrics_path_.empty() && http_req.request_url == metrics_path_) {
+        handleMetrics(resp_origin);
+    } else if (json_select_ && selectJson(http_req, parsed, resp_origin, cache_status)) {
+        // Projected from the cached document of the url without select
     } else {
-        // Cache Hit
-        fprintf(stdout, "Cache hit for [%s].\n", http_req_.request_url.c_str());
-        fflush(stdout);
-        resp_origin.http_version = "1.1";
-        resp_origin.status_code = "200";
-        resp_origin.status_msg = "OK";
-        resp_origin.header_origin = "X-Cache: HIT\r\n";
-        resp_origin.body = cache;
-        CacheTimer::GetInstance().KeepCacheAlive(http_req_.request_url);
+        // Judge cache hit or miss
+        std::string cache_key = CacheKey::GetInstance().Normalize(http_req.request_url);
+        TMDBCache cache{};
+        bool hit = lookupCache(http_req, cache_key, cache);
+        Metrics::GetInstance().Observe(Stage::kCacheLookup, parsed, SteadyClock::now());
+        if (!hit) {
+            // Cache miss
+            cache_status = CacheStatus::kMiss;
+            Metrics::GetInstance().Add(Counter::kMiss);
+            fetchOrigin(http_req, cache_key, resp_origin);
+        } else {
+            // Cache Hit
+            replyCache(cache, resp_origin, cache_status);
+        }
+    }
+    if (http_req.request_method == "HEAD") {
+        // Same head as the GET it was served from, Content-Length included,
+        // but no body or the client reads it as the next reply
+        resp_origin.body.clear();
+    }
+    Metrics::GetInstance().Add(Counter::kBytesIn, conn->in.size());
+    std::string().swap(conn->in);
+    conn->cache_status = cache_status;
+    constructHttpResponse(resp_origin, conn->out);
+    Metrics::GetInstance().BindRequest(nullptr);
+    Tracer::GetInstance().Bind(nullptr);
+    // Most replies fit the socket buffer, the rest are finished by the event
+    // loop so a slow reader never holds a worker
+    // With io_uring the loop sends, the worker makes no socket calls
+    conn->write_begin = SteadyClock::now();
+    if (!uring_ && sendReply(conn)) {
+        finishConnect(conn);
+        close(conn->fd);
+        delete conn;
+        connections_--;
+        return;
+    }
+    bool wake = false;
+    {
+        // One wakeup per batch, the loop takes every reply queued by then
+        std::lock_guard<std::mutex> lock(done_mtx_);
+        wake = done_.empty();
+        done_.push_back(conn);
+    }
+    uint64_t one = 1;
+    if (wake && write(wake_fd_, &one, sizeof(one)) < 0) {
+        fprintf(stderr, "Wake event loop failed.\n");
     }
-    std::string resp;
-    constructHttpResponse(resp_origin, resp);
-    writeMsg(clisock, resp);
-    http_req_ = {};
-    close(clisock);
 }
 
-void NetCacheServerUtil::extendHeader(HttpResponse &resp, const char *extend)
+bool NetCacheServerUtil::streamRequest(ClientConn* conn)
 {
-    std::string header_origin;
-    char buffer[1024];
-    for (auto it = resp.header.begin(); it != resp.header.end(); ++it) {
-        memset(buffer, 0, sizeof(buffer));
-        snprintf(buffer, sizeof(buffer), "%s: %s\r\n", it->first.c_str(), it->second.c_str());
-        header_origin.append(buffer);
+    HttpRequest& http_req = conn->req;
+    HttpResponse& resp = conn->resp;
+    Metrics::GetInstance().Add(Counter::kPassThrough);
+    resp.http_version  = "1.1";
+    resp.header_origin = "X-Cache: BYPASS\r\n";
+    const std::string* encoding = CacheKey::FindHeader(http_req.header, "Transfer-Encoding");
+    if (encoding && strcasecmp(encoding->c_str(), "identity") != 0) {
+        // Only a Content-Length tells where a streamed body ends
+        resp.status_code = "411";
+        resp.status_msg  = "Length Required";
+        return false;
     }
-    header_origin.append(extend);
-    header_origin.append("\r\n");
-    resp.header_origin = header_origin;
-}
-
-void NetCacheServerUtil::Start(const std::string& forward_origin) {
-    // Init net_client
-    std::regex  pattern("^([^ ]*)://([^ ]*)$", std::regex_constants::optimize);
-    std::smatch match;
-    if (!std::regex_match(forward_origin, match, pattern)) {
-        fprintf(stderr, "Got error forward origin format.\n");
-        return;
+    if (origin_fetches_.fetch_add(1) >= max_origin_fetches_) {
+        origin_fetches_--;
+        Metrics::GetInstance().Add(Counter::kShedOrigin);
+        resp.status_code   = "503";
+        resp.status_msg    = "Service Unavailable";
+        resp.header_origin = "Retry-After: 1\r\nX-Cache: BYPASS\r\n";
+        return false;
     }
-    std::string protocol_type  = match[1];
-    std::string forward_domain = match[2];
-    uint16_t forward_domain_port = 80;
-    bool forward_origin_ssl = false;
-    if (0 == protocol_type.compare("https")) {
-        forward_domain_port = 443;
-        forward_origin_ssl = true;
+    OriginSlot slot(origin_fetches_);
+    std::string header;
+    forwardHeaders(conn->in, conn->header_len, header);
+    NetClientUtil& client = NetClientUtil::GetInstance();
+    OriginStream origin;
+    if (client.Open(http_req.request_method.c_str(), http_req.request_url.c_str(), header, origin) != 0) {
+        resp.status_code = "502";
+        resp.status_msg  = "Bad Gateway";
+        return false;
     }
-    NetClientUtil::GetInstance()
-        .Init(forward_domain.c_str(), forward_domain_port, 3, 3, forward_origin_ssl);
-    // Start cache timer
-    CacheTimer::GetInstance().Start();
-    // Create socket
-    int sock = -1;
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    ErrIf(sock == -1, [&](){unlink(NAMED_PIPE);}, "Create socket failed.");
-    
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_);
-    inet_pton(AF_INET, ip_.c_str(), &addr.sin_addr);
-
-    ErrIf(-1 == bind(sock, (sockaddr*)&addr, sizeof(addr)), [&](){close(sock);unlink(NAMED_PIPE);}, "Bind failed.");
-    ErrIf(-1 == listen(sock, SOMAXCONN), [&](){close(sock);unlink(NAMED_PIPE);}, "Listen failed.");
-
-    fprintf(stdout, "Start successfully.\n");
-    fflush(stdout);
+    // Plain sockets on both ends relay through a pipe and never copy the body
+    // to userspace, TLS goes through a bounded buffer
+    int pipefd[2] = {-1, -1};
+    if (!conn->ssl && !origin.ssl && pipe2(pipefd, O_CLOEXEC) == -1) {
+        pipefd[0] = pipefd[1] = -1;
+    }
+    // Waits go through poll() with the client deadlines
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
 
-    fd_set rfds;
-    struct timespec tp;
-    int ret = -1;
-    int max_fd = std::max(sock, pipe_fd_);
-    while (true) {
-        tp.tv_sec  = 3;
-        tp.tv_nsec = 0;
-        FD_ZERO(&rfds);
-        FD_SET(pipe_fd_, &rfds);
-        FD_SET(sock, &rfds);
+    // Request body: what came with the head, then the rest off the socket
+    size_t early = std::min(conn->in.size() - conn->header_len, conn->body_len);
+    size_t moved = 0;
+    RelayResult result = RelayResult::kDone;
+    if (early > 0 && client.Write(origin, conn->in.data() + conn->header_len, early) < 0) {
+        result = RelayResult::kOriginFailed;
+    }
+    Metrics::GetInstance().Add(Counter::kBytesIn, conn->header_len + early);
+    std::string().swap(conn->in);
+    if (result == RelayResult::kDone && conn->body_len > early) {
+        result = relay(conn, origin, pipefd, true, conn->body_len - early, conn->phase_deadline, moved);
+        Metrics::GetInstance().Add(Counter::kBytesIn, moved);
+    }
 
-        ret = pselect(max_fd + 1, &rfds, 0, 0, &tp, &origmask_);
-        if (ret == -1 && errno == EINTR) {
-            // Interrupted by signal
-            close(pipe_fd_);
-            close(sock);
+    // Response head, then the rest until origin closes
+    std::string head;
+    size_t head_end = std::string::npos;
+    char buffer[16 << 10];
+    auto request_sent = SteadyClock::now();
+    while (result == RelayResult::kDone && head_end == std::string::npos) {
+        ssize_t n = client.Read(origin, buffer, sizeof(buffer));
+        if (n <= 0 || head.size() + n > kMaxHeaderBytes) {
+            result = RelayResult::kOriginFailed;
             break;
-        } else if (ret == -1) {
-            // Error occurs
-            fprintf(stderr, "Error occurs\n");
-            fflush(stderr);
-        } else if (ret == 0) {
-            // Timeout
-        } else {
-            // Clear cache
-            if (FD_ISSET(pipe_fd_, &rfds)) {
-                PipeMessage msg;
-                int bytes_read = read(pipe_fd_, &msg, sizeof(msg));
-                if (bytes_read < 0) {
-                    fprintf(stderr, "Read from pipe failed\n");
+        }
+        if (head.empty()) {
+            Metrics::GetInstance().Observe(Stage::kOriginTtfb, request_sent, SteadyClock::now());
+        }
+        head.append(buffer, n);
+        head_end = head.find("\r\n\r\n");
+    }
+    conn->write_begin = SteadyClock::now();
+    auto write_deadline = deadlineAfter(conn->write_begin, write_timeout_);
+    switch (result)
+    {
+    case RelayResult::kDone:
+        break;
+    case RelayResult::kClientTimeout:
+        sendConnect(conn, kResp408, strlen(kResp408));
+        resp.status_code = "408";
+        break;
+    case RelayResult::kOriginFailed:
+        Metrics::GetInstance().Add(Counter::kOriginError);
+        sendClient(conn, kResp502, strlen(kResp502), write_deadline);
+        resp.status_code = "502";
+        break;
+    default:
+        break;
+    }
+    if (result == RelayResult::kDone) {
+        Metrics::GetInstance().Add(Counter::kOriginBytesIn, head.size());
+        size_t line_end = head.find("\r\n");
+        std::istringstream status_line(head.substr(0, line_end));
+        std::string version;
+        status_line >> version >> resp.status_code;
+        std::getline(status_line >> std::ws, resp.status_msg);
+        resp.http_version = version.compare(0, 5, "HTTP/") == 0 ? version.substr(5) : version;
+        int status_code = atoi(resp.status_code.c_str());
+        if (status_code >= 200 && status_code < 400) {
+            // Whatever is cached for the url is now out of date
+            Metrics::GetInstance().Add(Counter::kInvalidation,
+                CacheTimer::GetInstance().PurgeUrl(CacheKey::GetInstance().Normalize(http_req.request_url)));
+        }
+        head.insert(line_end + 2, "X-Cache: BYPASS\r\n");
+        auto body_begin = SteadyClock::now();
+        result = sendClient(conn, head.data(), head.size(), write_deadline);
+        if (result == RelayResult::kDone) {
+            result = relay(conn, origin, pipefd, false, SIZE_MAX, write_deadline, moved);
+            Metrics::GetInstance().Add(Counter::kOriginBytesIn, moved);
+            Metrics::GetInstance().Observe(Stage::kBodyTransfer, body_begin, SteadyClock::now());
+        }
+    }
+    if (pipefd[0] != -1) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    client.Close(origin);
+    return true;
+}
+
+NetCacheServerUtil::RelayResult NetCacheServerUtil::relay(ClientConn* conn, OriginStream& origin, const int pipefd[2],
+    bool upload, size_t len, SteadyClock::time_point deadline, size_t& moved)
+{
+    // The origin socket blocks with timeouts, a failed call there is final.
+    // The client socket is nonblocking and waited for within `deadline`
+    NetClientUtil& client = NetClientUtil::GetInstance();
+    Counter expired = upload ? Counter::kBodyTimeout : Counter::kWriteTimeout;
+    RelayResult in_failed = upload ? RelayResult::kClientGone : RelayResult::kOriginFailed;
+    moved = 0;
+    if (pipefd[0] != -1) {
+        int in  = upload ? conn->fd : origin.fd;
+        int out = upload ? origin.fd : conn->fd;
+        while (moved < len) {
+            ssize_t n = splice(in, nullptr, pipefd[1], nullptr, std::min(len - moved, kRelayChunk), SPLICE_F_MOVE);
+            if (n == 0) {
+                return len == SIZE_MAX ? RelayResult::kDone : in_failed;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (upload && errno == EAGAIN) {
+                    if (!waitClient(conn, POLLIN, deadline, expired)) {
+                        return RelayResult::kClientTimeout;
+                    }
+                    continue;
+                }
+                return in_failed;
+            }
+            // The pipe is emptied before the next read, it never holds more
+            // than one chunk
+            for (ssize_t left = n; left > 0;) {
+                ssize_t m = splice(pipefd[0], nullptr, out, nullptr, left, SPLICE_F_MOVE);
+                if (m > 0) {
+                    left -= m;
+                    continue;
+                }
+                if (m < 0 && errno == EINTR) {
                     continue;
                 }
-                CacheTimer::GetInstance().ClearCache();
+                if (m < 0 && errno == EAGAIN && !upload) {
+                    if (!waitClient(conn, POLLOUT, deadline, expired)) {
+                        return RelayResult::kClientTimeout;
+                    }
+                    continue;
+                }
+                return upload ? RelayResult::kOriginFailed : RelayResult::kClientGone;
+            }
+            moved += n;
+            conn->last_active = SteadyClock::now();
+        }
+        return RelayResult::kDone;
+    }
+    char buffer[16 << 10];
+    while (moved < len) {
+        size_t want = std::min(len - moved, sizeof(buffer));
+        ssize_t n = upload ? recvConnect(conn, buffer, want) : client.Read(origin, buffer, want);
+        if (n == 0) {
+            return len == SIZE_MAX ? RelayResult::kDone : in_failed;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (upload && errno == EAGAIN) {
+                if (!waitClient(conn, POLLIN, deadline, expired)) {
+                    return RelayResult::kClientTimeout;
+                }
+                continue;
             }
-            // Cache proxy
-            if (FD_ISSET(sock, &rfds)) {
-                struct sockaddr_in cliaddr;
-                socklen_t clilen;
-                int clisock = ::accept(sock, (sockaddr*)&cliaddr, &clilen);
-                ErrIf(-1 == clisock, [&](){close(sock);unlink(NAMED_PIPE);}, "Accept operation failed.");
-                handleConnect(clisock);   
+            return in_failed;
+        }
+        if (upload) {
+            if (client.Write(origin, buffer, n) < 0) {
+                return RelayResult::kOriginFailed;
+            }
+        } else {
+            RelayResult result = sendClient(conn, buffer, n, deadline);
+            if (result != RelayResult::kDone) {
+                return result;
+            }
+        }
+        moved += n;
+        conn->last_active = SteadyClock::now();
+    }
+    return RelayResult::kDone;
+}
+
+NetCacheServerUtil::RelayResult NetCacheServerUtil::sendClient(ClientConn* conn, const char* buf, size_t n, SteadyClock::time_point deadline)
+{
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t m = sendConnect(conn, buf + sent, n - sent);
+        if (m > 0) {
+            sent += m;
+            conn->written += m;
+            conn->last_active = SteadyClock::now();
+            continue;
+        }
+        if (m == -1 && errno == EINTR) {
+            continue;
+        }
+        if (m == -1 && errno == EAGAIN) {
+            if (!waitClient(conn, POLLOUT, deadline, Counter::kWriteTimeout)) {
+                return RelayResult::kClientTimeout;
             }
+            continue;
         }
+        return RelayResult::kClientGone;
+    }
+    return RelayResult::kDone;
+}
+
+bool NetCacheServerUtil::waitClient(ClientConn* conn, short events, SteadyClock::time_point deadline, Counter expired)
+{
+    auto now = SteadyClock::now();
+    auto idle = idle_timeout_.count() > 0 ? conn->last_active + idle_timeout_ : SteadyClock::time_point::max();
+    auto when = std::min(deadline, idle);
+    int timeout_ms = -1;
+    if (when != SteadyClock::time_point::max()) {
+        timeout_ms = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(when - now).count() + 1);
+    }
+    struct pollfd pfd;
+    pfd.fd      = conn->fd;
+    pfd.events  = events;
+    pfd.revents = 0;
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret == -1 && errno == EINTR);
+    if (ret > 0) {
+        // Errors and hangups show up on the next call
+        return true;
+    }
+    Metrics::GetInstance().Add(SteadyClock::now() >= deadline ? expired : Counter::kIdleTimeout);
+    return false;
+}
+
+void NetCacheServerUtil::dispatch(int clisock, const struct sockaddr_in &cliaddr)
+{
+    auto now = SteadyClock::now();
+    if (!rate_limiter_.Allow(cliaddr.sin_addr.s_addr, now)) {
+        Metrics::GetInstance().Add(Counter::kRateLimited);
+        rejectConnect(clisock, 429);
+        return;
+    }
+    if (max_connections_ > 0 && connections_ >= max_connections_) {
+        Metrics::GetInstance().Add(Counter::kShedConnection);
+        rejectConnect(clisock, 503);
+        return;
+    }
+    connections_++;
+    ClientConn* conn = new ClientConn;
+    conn->fd             = clisock;
+    conn->accepted       = now;
+    conn->last_active    = now;
+    conn->phase_deadline = deadlineAfter(now, header_timeout_);
+    conn->timer.owner    = conn;
+    Tracer::GetInstance().Begin(conn->trace);
+    conns_.insert(conn);
+    if (ssl_ctx_) {
+        conn->ssl = SSL_new(ssl_ctx_);
+        if (!conn->ssl || SSL_set_fd(conn->ssl, clisock) != 1) {
+            Metrics::GetInstance().Add(Counter::kTlsHandshakeError);
+            closeConnect(conn);
+            return;
+        }
+        SSL_set_accept_state(conn->ssl);
+        conn->state = ConnState::kHandshake;
+        handshakeConnect(conn);
+        return;
+    }
+    if (uring_) {
+        uringRecv(conn);
+        armTimer(conn, now);
+        return;
+    }
+    // The request usually arrives with the handshake, the connection is only
+    // polled if it did not
+    readConnect(conn);
+}
+
+void NetCacheServerUtil::handshakeConnect(ClientConn* conn)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(conn->ssl);
+    auto now = SteadyClock::now();
+    if (ret == 1) {
+        Metrics::GetInstance().Add(Counter::kTlsHandshake);
+        if (SSL_session_reused(conn->ssl)) {
+            Metrics::GetInstance().Add(Counter::kTlsResumed);
+        }
+        if (BIO_get_ktls_send(SSL_get_wbio(conn->ssl))) {
+            Metrics::GetInstance().Add(Counter::kTlsKtls);
+        }
+        Tracer::GetInstance().Record(conn->trace, TraceEvent::kTlsHandshake, conn->accepted, now);
+        conn->state       = ConnState::kReadHeader;
+        conn->last_active = now;
+        readConnect(conn);
+        return;
+    }
+    switch (SSL_get_error(conn->ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        pollConnect(conn, EPOLLIN, now);
+        break;
+    case SSL_ERROR_WANT_WRITE:
+        pollConnect(conn, EPOLLOUT, now);
+        break;
+    default:
+        Metrics::GetInstance().Add(Counter::kTlsHandshakeError);
+        closeConnect(conn);
+        break;
+    }
+}
+
+ssize_t NetCacheServerUtil::recvConnect(ClientConn* conn, char* buf, size_t n)
+{
+    if (!conn->ssl) {
+        return recv(conn->fd, buf, n, 0);
+    }
+    ERR_clear_error();
+    int ret = SSL_read(conn->ssl, buf, static_cast<int>(n));
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(conn->ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        errno = ECONNRESET;
+        return -1;
+    }
+}
+
+ssize_t NetCacheServerUtil::sendConnect(ClientConn* conn, const char* buf, size_t n)
+{
+    if (!conn->ssl) {
+        return send(conn->fd, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    ERR_clear_error();
+    int ret = SSL_write(conn->ssl, buf, static_cast<int>(std::min(n, static_cast<size_t>(INT_MAX))));
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(conn->ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    default:
+        errno = EPIPE;
+        return -1;
+    }
+}
+
+void NetCacheServerUtil::readConnect(ClientConn* conn)
+{
+    char buffer[16 << 10];
+    size_t scanned = conn->in.size();
+    bool eof = false;
+    while (true) {
+        ssize_t n = recvConnect(conn, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn->in.append(buffer, n);
+            conn->last_active = SteadyClock::now();
+            if (conn->state == ConnState::kReadHeader && conn->in.size() > kMaxHeaderBytes + 4) {
+                break;
+            }
+            if (conn->state == ConnState::kReadBody && conn->in.size() > conn->header_len + conn->body_len) {
+                break;
+            }
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // Half-closed after a whole request is still served
+        eof = true;
+        break;
+    }
+    consumeRequest(conn, scanned, eof);
+}
+
+void NetCacheServerUtil::consumeRequest(ClientConn* conn, size_t scanned, bool eof)
+{
+    auto now = SteadyClock::now();
+    if (conn->state == ConnState::kReadHeader) {
+        // Resume the search where the last read stopped, byte-at-a-time
+        // clients must not make it quadratic
+        size_t from = scanned > 3 ? scanned - 3 : 0;
+        size_t end = conn->in.find("\r\n\r\n", from);
+        if (end == std::string::npos || end + 4 > kMaxHeaderBytes) {
+            if (eof) {
+                closeConnect(conn);
+            } else if (conn->in.size() > kMaxHeaderBytes) {
+                abortConnect(conn, kResp431);
+            } else {
+                waitRequest(conn, now);
+            }
+            return;
+        }
+        conn->header_len = end + 4;
+        conn->body_len   = contentLength(conn->in, conn->header_len);
+        if (passThrough(conn->in)) {
+            // The worker streams the body to origin, no size cap and no
+            // waiting for it here
+            conn->stream         = true;
+            conn->phase_deadline = deadlineAfter(now, body_timeout_);
+            queueRequest(conn, now);
+            return;
+        }
+        if (conn->body_len > kMaxBodyBytes) {
+            abortConnect(conn, kResp413);
+            return;
+        }
+        conn->state          = ConnState::kReadBody;
+        conn->phase_deadline = deadlineAfter(now, body_timeout_);
+    }
+    if (conn->in.size() < conn->header_len + conn->body_len) {
+        if (eof) {
+            closeConnect(conn);
+        } else {
+            waitRequest(conn, now);
+        }
+        return;
+    }
+    queueRequest(conn, now);
+}
+
+void NetCacheServerUtil::queueRequest(ClientConn* conn, SteadyClock::time_point now)
+{
+    if (conn->stream && conn->receiving) {
+        // The worker reads the body from the socket itself. Bytes still land in conn->in until the cancelled recv completes,
+        // the last completion queues it
+        conn->state = ConnState::kHandoff;
+        uring_->PrepCancelFd(conn->fd, uringData(conn, UringOp::kCancel));
+        conn->inflight++;
+        return;
+    }
+    Tracer::GetInstance().Record(conn->trace, TraceEvent::kReadMsg, conn->accepted, now);
+    // The worker owns it until the reply is built
+    timers_.Cancel(&conn->timer);
+    if (conn->polled) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, 0);
+        conn->polled = false;
+    }
+    conns_.erase(conn);
+    conn->state = ConnState::kProcessing;
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        queue_.push_back(conn);
+    }
+    queue_cv_.notify_one();
+}
+
+void NetCacheServerUtil::waitRequest(ClientConn* conn, SteadyClock::time_point now)
+{
+    if (uring_) {
+        // The multishot recv stays armed
+        armTimer(conn, now);
+    } else {
+        pollConnect(conn, EPOLLIN, now);
+    }
+}
+
+void NetCacheServerUtil::writeConnect(ClientConn* conn)
+{
+    if (!sendReply(conn)) {
+        pollConnect(conn, EPOLLOUT, SteadyClock::now());
+        return;
+    }
+    finishConnect(conn);
+    closeConnect(conn);
+}
+
+bool NetCacheServerUtil::sendReply(ClientConn* conn)
+{
+    while (conn->written < conn->out.size()) {
+        ssize_t n = sendConnect(conn, conn->out.data() + conn->written, conn->out.size() - conn->written);
+        if (n > 0) {
+            conn->written += n;
+            conn->last_active = SteadyClock::now();
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        // Client went away, log what it got
+        break;
+    }
+    return true;
+}
+
+void NetCacheServerUtil::pollConnect(ClientConn* conn, uint32_t events, SteadyClock::time_point now)
+{
+    struct epoll_event ev;
+    ev.events   = events;
+    ev.data.ptr = conn;
+    if (-1 == epoll_ctl(epoll_fd_, conn->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &ev)) {
+        closeConnect(conn);
+        return;
+    }
+    conn->polled = true;
+    armTimer(conn, now);
+}
+
+void NetCacheServerUtil::finishConnect(ClientConn* conn)
+{
+    Metrics::GetInstance().BindRequest(&conn->stages);
+    Tracer::GetInstance().Bind(&conn->trace);
+    Metrics::GetInstance().Observe(Stage::kClientWrite, conn->write_begin, SteadyClock::now());
+    Metrics::GetInstance().Add(Counter::kBytesOut, conn->written);
+    Metrics::GetInstance().BindRequest(nullptr);
+    Tracer::GetInstance().End(conn->trace, conn->req.request_method, conn->req.request_url, atoi(conn->resp.status_code.c_str()));
+    logAccess(conn->cache_status, conn->req, conn->resp, conn->written, conn->stages);
+    captureRequest(conn->cache_status, conn->req, conn->resp);
+    if (conn->ssl) {
+        // close_notify, best effort, the socket is closed right after
+        SSL_shutdown(conn->ssl);
+    }
+}
+
+void NetCacheServerUtil::abortConnect(ClientConn* conn, const char* resp)
+{
+    sendConnect(conn, resp, strlen(resp));
+    shutdown(conn->fd, SHUT_WR);
+    closeConnect(conn);
+}
+
+void NetCacheServerUtil::closeConnect(ClientConn* conn)
+{
+    // Freed once nothing in flight refers to it, after the current batch
+    timers_.Cancel(&conn->timer);
+    if (uring_) {
+        // A pending multishot recv holds the socket open, cancel it first;
+        // the close runs whether or not there was anything to cancel
+        struct io_uring_sqe* sqe = uring_->PrepCancelFd(conn->fd, uringData(conn, UringOp::kCancel));
+        if (sqe) {
+            sqe->flags |= IOSQE_IO_HARDLINK;
+        }
+        uring_->PrepClose(conn->fd, uringData(conn, UringOp::kClose));
+        conn->inflight += 2;
+    } else {
+        close(conn->fd);
+    }
+    conn->fd = -1;
+    conns_.erase(conn);
+    closed_.push_back(conn);
+    connections_--;
+}
+
+void NetCacheServerUtil::reapClosed()
+{
+    size_t kept = 0;
+    for (ClientConn* conn : closed_) {
+        if (conn->inflight == 0) {
+            delete conn;
+        } else {
+            closed_[kept++] = conn;
+        }
+    }
+    closed_.resize(kept);
+}
+
+void NetCacheServerUtil::flushReplies()
+{
+    std::vector<ClientConn*> done;
+    {
+        std::lock_guard<std::mutex> lock(done_mtx_);
+        done.swap(done_);
+    }
+    auto now = SteadyClock::now();
+    for (ClientConn* conn : done) {
+        conn->state          = ConnState::kWrite;
+        conn->last_active    = now;
+        conn->phase_deadline = deadlineAfter(conn->write_begin, write_timeout_);
+        conns_.insert(conn);
+        if (uring_) {
+            uringSend(conn);
+        } else {
+            writeConnect(conn);
+        }
+    }
+}
+
+uint64_t NetCacheServerUtil::uringData(ClientConn* conn, UringOp op)
+{
+    return reinterpret_cast<uint64_t>(conn) | static_cast<uint64_t>(op);
+}
+
+void NetCacheServerUtil::uringRecv(ClientConn* conn)
+{
+    uring_->PrepRecvMultishot(conn->fd, kUringBufGroup, uringData(conn, UringOp::kRecv));
+    conn->inflight++;
+    conn->receiving = true;
+}
+
+void NetCacheServerUtil::uringSend(ClientConn* conn)
+{
+    uring_->PrepSend(conn->fd, conn->out.data() + conn->written, conn->out.size() - conn->written,
+        MSG_NOSIGNAL, uringData(conn, UringOp::kSend));
+    conn->inflight++;
+    armTimer(conn, SteadyClock::now());
+}
+
+void NetCacheServerUtil::uringComplete(const struct io_uring_cqe& cqe)
+{
+    if (cqe.user_data == kUringAccept) {
+        if (cqe.res >= 0) {
+            struct sockaddr_in cliaddr;
+            memset(&cliaddr, 0, sizeof(cliaddr));
+            if (rate_limiter_.Enabled()) {
+                socklen_t clilen = sizeof(cliaddr);
+                getpeername(cqe.res, (sockaddr*)&cliaddr, &clilen);
+            }
+            dispatch(cqe.res, cliaddr);
+        } else {
+            Metrics::GetInstance().Add(Counter::kAcceptError);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            // Multishot accept stops on errors such as EMFILE
+            if (cqe.res == -EMFILE || cqe.res == -ENFILE || cqe.res == -ENOBUFS || cqe.res == -ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            uring_->PrepAcceptMultishot(listen_fd_, SOCK_CLOEXEC, kUringAccept);
+        }
+        return;
+    }
+    if (cqe.user_data == kUringWake) {
+        flushReplies();
+        uring_->PrepRead(wake_fd_, &wake_count_, sizeof(wake_count_), kUringWake);
+        return;
+    }
+    if (cqe.user_data == kUringControl) {
+        int ctlsock = ::accept(ctl_fd_, 0, 0);
+        if (ctlsock == -1) {
+            fprintf(stderr, "Accept control connection failed\n");
+        } else {
+            handleControl(ctlsock);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            uring_->PrepPollMultishot(ctl_fd_, POLLIN, kUringControl);
+        }
+        return;
+    }
+    ClientConn* conn = reinterpret_cast<ClientConn*>(cqe.user_data & ~kUringOpMask);
+    UringOp op = static_cast<UringOp>(cqe.user_data & kUringOpMask);
+    if (op != UringOp::kRecv || !(cqe.flags & IORING_CQE_F_MORE)) {
+        conn->inflight--;
+        conn->receiving = conn->receiving && op != UringOp::kRecv;
+    }
+    if (conn->state == ConnState::kHandoff) {
+        if (op == UringOp::kRecv && (cqe.flags & IORING_CQE_F_BUFFER)) {
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (cqe.res > 0) {
+                conn->in.append(uring_->Buffer(bid), cqe.res);
+            }
+            uring_->RecycleBuffer(bid);
+        }
+        if (conn->inflight == 0) {
+            queueRequest(conn, SteadyClock::now());
+        }
+        return;
+    }
+    bool reading = conn->fd != -1 && (conn->state == ConnState::kReadHeader || conn->state == ConnState::kReadBody);
+    if (op == UringOp::kRecv) {
+        // A worker may hold the connection, only touch its buffer while reading
+        size_t scanned = reading ? conn->in.size() : 0;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            // Bytes after a whole request are not served, there is no keep-alive
+            if (reading && cqe.res > 0) {
+                conn->in.append(uring_->Buffer(bid), cqe.res);
+            }
+            uring_->RecycleBuffer(bid);
+        }
+        if (!reading) {
+            return;
+        }
+        if (cqe.res > 0) {
+            conn->last_active = SteadyClock::now();
+            consumeRequest(conn, scanned, false);
+            if (!(cqe.flags & IORING_CQE_F_MORE) && conn->fd != -1
+                && (conn->state == ConnState::kReadHeader || conn->state == ConnState::kReadBody)) {
+                uringRecv(conn);
+            }
+        } else if (cqe.res == -ENOBUFS) {
+            // Every buffer was taken by this batch, the re-arm goes out with
+            // the next submit, after the batch recycled them
+            uringRecv(conn);
+        } else {
+            // Half-closed after a whole request is still served
+            consumeRequest(conn, scanned, true);
+        }
+        return;
+    }
+    if (op != UringOp::kSend || conn->fd == -1) {
+        return;
+    }
+    if (cqe.res > 0) {
+        conn->written += cqe.res;
+        conn->last_active = SteadyClock::now();
+    }
+    if ((cqe.res > 0 || cqe.res == -EAGAIN || cqe.res == -EINTR) && conn->written < conn->out.size()) {
+        uringSend(conn);
+        return;
+    }
+    // Done, or the client went away, log what it got
+    finishConnect(conn);
+    closeConnect(conn);
+}
+
+void NetCacheServerUtil::armTimer(ClientConn* conn, SteadyClock::time_point now)
+{
+    auto when = conn->phase_deadline;
+    if (idle_timeout_.count() > 0) {
+        when = std::min(when, conn->last_active + idle_timeout_);
+    }
+    if (when == SteadyClock::time_point::max()) {
+        timers_.Cancel(&conn->timer);
+        return;
+    }
+    timers_.Schedule(&conn->timer, when);
+}
+
+void NetCacheServerUtil::expireConnect(ClientConn* conn)
+{
+    bool phase = SteadyClock::now() >= conn->phase_deadline;
+    switch (conn->state)
+    {
+    case ConnState::kHandshake:
+        // No plaintext reply fits a half-done handshake
+        Metrics::GetInstance().Add(phase ? Counter::kHeaderTimeout : Counter::kIdleTimeout);
+        closeConnect(conn);
+        break;
+    case ConnState::kReadHeader:
+        Metrics::GetInstance().Add(phase ? Counter::kHeaderTimeout : Counter::kIdleTimeout);
+        abortConnect(conn, kResp408);
+        break;
+    case ConnState::kReadBody:
+        Metrics::GetInstance().Add(phase ? Counter::kBodyTimeout : Counter::kIdleTimeout);
+        abortConnect(conn, kResp408);
+        break;
+    case ConnState::kWrite:
+        // The reply is half sent, nothing else can go on the wire
+        Metrics::GetInstance().Add(phase ? Counter::kWriteTimeout : Counter::kIdleTimeout);
+        closeConnect(conn);
+        break;
+    default:
+        break;
+    }
+}
+
+void NetCacheServerUtil::rejectConnect(int clisock, int status_code)
+{
+    // Take in what the client already sent, closing on unread data resets
+    // the connection before the reply is read
+    char buffer[4096];
+    while (recv(clisock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+    }
+    // A plaintext reply means nothing to a TLS client, just close
+    const char* resp = status_code == 429 ? kResp429 : kResp503;
+    if (!ssl_ctx_) {
+        send(clisock, resp, strlen(resp), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    shutdown(clisock, SHUT_WR);
+    close(clisock);
+}
+
+void NetCacheServerUtil::startWorkers()
+{
+    stopping_ = false;
+    for (int i = 0; i < workers_; ++i) {
+        pool_.emplace_back([this](){
+            while (true) {
+                ClientConn* conn = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(queue_mtx_);
+                    queue_cv_.wait(lock, [this](){ return stopping_ || !queue_.empty(); });
+                    if (queue_.empty()) {
+                        return;
+                    }
+                    conn = queue_.front();
+                    queue_.pop_front();
+                }
+                handleRequest(conn);
+            }
+        });
+    }
+}
+
+void NetCacheServerUtil::stopWorkers()
+{
+    {
+        // Connections already queued are still served
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    for (auto& t : pool_) {
+        t.join();
+    }
+    pool_.clear();
+}
+
+void NetCacheServerUtil::logAccess(CacheStatus cache_status, const HttpRequest &req, const HttpResponse &resp, size_t bytes, const RequestStages &stages)
+{
+    if (!AccessLog::GetInstance().Enabled()) {
+        return;
+    }
+    AccessRecord record;
+    record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    snprintf(record.method, sizeof(record.method), "%s", req.request_method.c_str());
+    snprintf(record.url, sizeof(record.url), "%s", req.request_url.c_str());
+    record.cache_status = cache_status;
+    record.status_code  = static_cast<uint16_t>(atoi(resp.status_code.c_str()));
+    record.bytes        = bytes;
+    memcpy(record.stage_us, stages.us, sizeof(record.stage_us));
+    AccessLog::GetInstance().Log(record);
+}
+
+void NetCacheServerUtil::captureRequest(CacheStatus cache_status, const HttpRequest &req, const HttpResponse &resp)
+{
+    if (!Capture::GetInstance().Enabled() || cache_status == CacheStatus::kAdmin) {
+        return;
+    }
+    CaptureRecord record;
+    record.response_bytes = static_cast<uint32_t>(resp.body.size());
+    record.status_code    = static_cast<uint16_t>(atoi(resp.status_code.c_str()));
+    record.cache_status   = cache_status;
+    record.method         = req.request_method;
+    record.url            = req.request_url;
+    for (auto it = req.header.begin(); it != req.header.end(); ++it) {
+        record.headers.append(it->first).append(": ")
+            .append(Capture::IsSecretHeader(it->first) ? CAPTURE_REDACTED : it->second).append("\r\n");
+    }
+    Capture::FilterCacheHeaders(resp.header_origin, record.cache_headers);
+    Capture::GetInstance().Record(record);
+}
+
+void NetCacheServerUtil::handleMetrics(HttpResponse &resp_metrics)
+{
+    std::string body;
+    Metrics::GetInstance().Render(body);
+    CacheStats stats = CacheTimer::GetInstance().GetStats();
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+        "# HELP cps_cache_entries Entries in cache.\n"
+        "# TYPE cps_cache_entries gauge\n"
+        "cps_cache_entries %zu\n"
+        "# HELP cps_cache_bytes Bytes held by cache.\n"
+        "# TYPE cps_cache_bytes gauge\n"
+        "cps_cache_bytes %zu\n"
+        "# HELP cps_connections Connections queued or in service.\n"
+        "# TYPE cps_connections gauge\n"
+        "cps_connections %zu\n"
+        "# HELP cps_origin_fetches Origin fetches in flight.\n"
+        "# TYPE cps_origin_fetches gauge\n"
+        "cps_origin_fetches %d\n",
+        stats.entries, stats.bytes, connections_.load(), origin_fetches_.load());
+    body.append(buffer);
+
+    resp_metrics.http_version = "1.1";
+    resp_metrics.status_code = "200";
+    resp_metrics.status_msg = "OK";
+    snprintf(buffer, sizeof(buffer),
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n",
+        body.size());
+    resp_metrics.header_origin = buffer;
+    resp_metrics.body = body;
+}
+
+void NetCacheServerUtil::handleControl(int ctlsock)
+{
+    // Never let a stuck client stall the proxy loop
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(ctlsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(ctlsock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    ControlHeader header;
+    std::string payload;
+    if (!ControlSocket::Recv(ctlsock, header, payload)) {
+        // Also hit by CheckCacheServerStarted probing without a request
+#ifdef _DEBUG
+        fprintf(stderr, "Read from control socket failed\n");
+#endif // _DEBUG
+        close(ctlsock);
+        return;
+    }
+    ControlOp op = static_cast<ControlOp>(header.op);
+    ControlStatus status = ControlStatus::kOk;
+    std::string resp;
+    uint64_t purged = 0;
+    uint32_t seconds = 0;
+    uint64_t bytes = 0;
+    switch (op)
+    {
+    case ControlOp::kClearCache:
+        CacheTimer::GetInstance().ClearCache();
+        break;
+    case ControlOp::kPurgeUrl:
+        purged = CacheTimer::GetInstance().PurgeUrl(CacheKey::GetInstance().Normalize(payload));
+        resp.assign((const char*)&purged, sizeof(purged));
+        break;
+    case ControlOp::kPurgePrefix:
+        purged = CacheTimer::GetInstance().PurgePrefix(payload);
+        resp.assign((const char*)&purged, sizeof(purged));
+        break;
+    case ControlOp::kPurgeTag:
+        purged = CacheTimer::GetInstance().PurgeTag(payload);
+        resp.assign((const char*)&purged, sizeof(purged));
+        break;
+    case ControlOp::kStats: {
+        CacheStats cache_stats = CacheTimer::GetInstance().GetStats();
+        ControlStats stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.entries          = cache_stats.entries;
+        stats.negative_entries = cache_stats.negative_entries;
+        stats.bytes            = cache_stats.bytes;
+        stats.max_bytes        = cache_stats.max_bytes;
+        stats.ttl              = static_cast<uint32_t>(cache_stats.expires);
+        stats.negative_ttl     = static_cast<uint32_t>(negative_ttl_seconds_);
+        WarmProgress progress  = CacheWarmer::GetInstance().GetProgress();
+        stats.warm_total       = progress.total;
+        stats.warm_done        = progress.done;
+        stats.warm_failed      = progress.failed;
+        resp.assign((const char*)&stats, sizeof(stats));
+        break;
+    }
+    case ControlOp::kSetTtl:
+        if (payload.size() != sizeof(seconds)) {
+            status = ControlStatus::kBadRequest;
+            break;
+        }
+        memcpy(&seconds, payload.data(), sizeof(seconds));
+        keep_alive_seconds_ = static_cast<int>(seconds);
+        CacheTimer::GetInstance().SetExpires(keep_alive_seconds_);
+        break;
+    case ControlOp::kSetNegativeTtl:
+        if (payload.size() != sizeof(seconds)) {
+            status = ControlStatus::kBadRequest;
+            break;
+        }
+        memcpy(&seconds, payload.data(), sizeof(seconds));
+        SetNegativeCache(static_cast<int>(seconds));
+        break;
+    case ControlOp::kSetMaxBytes:
+        if (payload.size() != sizeof(bytes)) {
+            status = ControlStatus::kBadRequest;
+            break;
+        }
+        memcpy(&bytes, payload.data(), sizeof(bytes));
+        CacheTimer::GetInstance().SetMaxBytes(static_cast<size_t>(bytes));
+        break;
+    case ControlOp::kWarm:
+        if (!CacheWarmer::GetInstance().Start(payload)) {
+            status = ControlStatus::kBusy;
+        }
+        break;
+    default:
+        status = ControlStatus::kBadRequest;
+        break;
+    }
+    if (!ControlSocket::Send(ctlsock, op, status, resp)) {
+        fprintf(stderr, "Write into control socket failed\n");
+    }
+    close(ctlsock);
+}
+
+void NetCacheServerUtil::extendHeader(HttpResponse &resp, const char *extend)
+{
+    std::string header_origin;
+    joinHeader(resp, header_origin);
+    header_origin.append(extend);
+    header_origin.append("\r\n");
+    resp.header_origin = header_origin;
+}
+
+void NetCacheServerUtil::minifyJson(HttpResponse &resp, HJson* json)
+{
+    std::string minified;
+    if (!writeJson(json, minified)) {
+        Metrics::GetInstance().Add(Counter::kJsonMinifyFailed);
+        return;
+    }
+    if (minified.size() >= resp.body.size()) {
+        // Already compact
+        return;
+    }
+    Metrics::GetInstance().Add(Counter::kJsonMinified);
+    Metrics::GetInstance().Add(Counter::kJsonMinifySaved, resp.body.size() - minified.size());
+    resp.body.swap(minified);
+    setHeader(resp.header, "Content-Length", std::to_string(resp.body.size()));
+    // Other bytes than origin sent, a strong validator no longer holds
+    const std::string* etag = CacheKey::FindHeader(resp.header, "ETag");
+    if (etag && etag->compare(0, 2, "W/") != 0) {
+        setHeader(resp.header, "ETag", "W/" + *etag);
+    }
+}
+
+bool NetCacheServerUtil::selectJson(const HttpRequest &req, SteadyClock::time_point parsed, HttpResponse &resp, CacheStatus &cache_status)
+{
+    HttpRequest base = req;
+    std::string select;
+    if (!CacheKey::TakeParam(base.request_url, "select", select)) {
+        return false;
+    }
+    // Origin always sends the id, first
+    std::vector<std::string> fields = {"id"};
+    std::istringstream names(select);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+        if (!name.empty() && std::find(fields.begin(), fields.end(), name) == fields.end()) {
+            fields.push_back(name);
+        }
+    }
+    if (fields.size() == 1 && select.find_first_not_of(", ") == std::string::npos) {
+        return false;
+    }
+    // Every select of a url shares the cache entry of the url without it,
+    // from here on the answer comes from that entry alone
+    std::string base_key = CacheKey::GetInstance().Normalize(base.request_url);
+    TMDBCache cache{};
+    bool hit = lookupCache(base, base_key, cache);
+    Metrics::GetInstance().Observe(Stage::kCacheLookup, parsed, SteadyClock::now());
+    if (hit) {
+        replyCache(cache, resp, cache_status);
+    } else {
+        cache_status = CacheStatus::kMiss;
+        Metrics::GetInstance().Add(Counter::kMiss);
+        // Failures, error replies and non-JSON go out as origin sent them
+        if (!fetchOrigin(base, base_key, resp) || !lookupCache(base, base_key, cache)) {
+            return true;
+        }
+    }
+    if (cache.negative || !cache.json) {
+        return true;
+    }
+    HJson_arena* arena = HJson_arenaNew();
+    HJson* projected = arena ? projectJson(cache.json.get(), fields, arena) : nullptr;
+    std::string body;
+    bool written = projected && writeJson(projected, body);
+    HJson_arenaDelete(arena);
+    if (!written) {
+        // A scalar document, nothing to pick from
+        return true;
+    }
+    Metrics::GetInstance().Add(Counter::kJsonSelect);
+    resp.http_version  = "1.1";
+    resp.status_code   = cache.status_code.empty() ? "200" : cache.status_code;
+    resp.status_msg    = cache.status_msg.empty() ? "OK" : cache.status_msg;
+    resp.header_origin = projectHeader(cache.header_origin, body.size()) + (hit ? "X-Cache: HIT\r\n" : "X-Cache: MISS\r\n");
+    resp.body.swap(body);
+    return true;
+}
+
+void NetCacheServerUtil::replyCache(const TMDBCache &cache, HttpResponse &resp, CacheStatus &cache_status)
+{
+    cache_status = cache.negative ? CacheStatus::kNegativeHit : CacheStatus::kHit;
+    Metrics::GetInstance().Add(cache.negative ? Counter::kNegativeHit : Counter::kHit);
+    resp.http_version = "1.1";
+    resp.status_code = cache.status_code.empty() ? "200" : cache.status_code;
+    resp.status_msg = cache.status_msg.empty() ? "OK" : cache.status_msg;
+    resp.header_origin = cache.header_origin + "X-Cache: HIT\r\n";
+    resp.body = cache.cache_content;
+    if (!cache.negative) {
+        CacheTimer::GetInstance().TouchCache(cache.dest_url);
+    }
+}
+
+void NetCacheServerUtil::joinHeader(const HttpResponse &resp, std::string &header_origin)
+{
+    char buffer[1024];
+    for (auto it = resp.header.begin(); it != resp.header.end(); ++it) {
+        memset(buffer, 0, sizeof(buffer));
+        snprintf(buffer, sizeof(buffer), "%s: %s\r\n", it->first.c_str(), it->second.c_str());
+        header_origin.append(buffer);
+    }
+}
+
+bool NetCacheServerUtil::Prefetch(const std::string &url)
+{
+    HttpRequest req{};
+    req.request_method = "GET";
+    req.request_url    = url;
+    req.http_version   = "1.1";
+    std::string cache_key = CacheKey::GetInstance().Normalize(url);
+    TMDBCache cache{};
+    if (lookupCache(req, cache_key, cache)) {
+        return true;
+    }
+    // Warm-up waits instead of being shed and only starts while less than
+    // half the origin cap is in flight, the rest is kept for client misses.
+    // A cap of 1 has no half to spare, warm-up then runs outside it, bounded
+    // by its own concurrency and rate.
+    HttpResponse resp_origin{};
+    int cap = max_origin_fetches_ / 2;
+    if (cap == 0) {
+        return loadOrigin(req, cache_key, resp_origin);
+    }
+    while (origin_fetches_.fetch_add(1) >= cap) {
+        origin_fetches_--;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    OriginSlot slot(origin_fetches_);
+    return loadOrigin(req, cache_key, resp_origin);
+}
+
+bool NetCacheServerUtil::fetchOrigin(const HttpRequest &req, const std::string &cache_key, HttpResponse &resp_origin)
+{
+    // Past the cap a miss is refused at once instead of tying up a worker,
+    // so hits keep flowing while origin is slow.
+    if (origin_fetches_.fetch_add(1) >= max_origin_fetches_) {
+        origin_fetches_--;
+        Metrics::GetInstance().Add(Counter::kShedOrigin);
+        resp_origin.http_version  = "1.1";
+        resp_origin.status_code   = "503";
+        resp_origin.status_msg    = "Service Unavailable";
+        resp_origin.header_origin = "Retry-After: 1\r\nX-Cache: MISS\r\n";
+        resp_origin.body          = "";
+        return false;
+    }
+    OriginSlot slot(origin_fetches_);
+    return loadOrigin(req, cache_key, resp_origin);
+}
+
+bool NetCacheServerUtil::loadOrigin(const HttpRequest &req, const std::string &cache_key, HttpResponse &resp_origin)
+{
+    TMDBCache cache{};
+    int negative_ttl = negative_ttl_seconds_;
+    int ret = NetClientUtil::GetInstance()
+                .Get(req.request_url.c_str(), req.header_origin, resp_origin);
+    if (0 != ret) {
+        // Get failed
+        resp_origin.http_version = "1.1";
+        resp_origin.status_code = "502";
+        resp_origin.status_msg = "Bad Gateway";
+        resp_origin.header_origin = "X-Cache: MISS\r\n";
+        resp_origin.body = "";
+        if (negative_ttl > 0) {
+            cache.status_code = resp_origin.status_code;
+            cache.status_msg  = resp_origin.status_msg;
+            storeCache(req, cache_key, resp_origin, cache, negative_ttl);
+        }
+        return false;
+    }
+    // Once here, so hits and this miss alike get the compact body
+    if ((minify_json_ || json_select_) && resp_origin.status_code == "200" && isJsonBody(resp_origin)) {
+        size_t json_bytes = 0;
+        std::shared_ptr<HJson> json = parseJson(resp_origin.body, json_bytes);
+        if (!json) {
+            // Chunked or truncated bodies land here too
+            if (minify_json_) {
+                Metrics::GetInstance().Add(Counter::kJsonMinifyFailed);
+            }
+        } else {
+            if (minify_json_) {
+                minifyJson(resp_origin, json.get());
+            }
+            if (json_select_) {
+                cache.json       = json;
+                cache.json_bytes = json_bytes;
+            }
+        }
+    }
+    cache.cache_content = resp_origin.body;
+    cache.status_code   = resp_origin.status_code;
+    cache.status_msg    = resp_origin.status_msg;
+    joinHeader(resp_origin, cache.header_origin);
+    const std::string* surrogate_key = CacheKey::FindHeader(resp_origin.header, "Surrogate-Key");
+    if (surrogate_key) {
+        std::istringstream tags(*surrogate_key);
+        std::string tag;
+        while (tags >> tag) {
+            cache.tags.push_back(tag);
+        }
+    }
+    extendHeader(resp_origin, "X-Cache: MISS");
+    if (resp_origin.status_code == "200") {
+        storeCache(req, cache_key, resp_origin, cache);
+    } else if (negative_ttl > 0
+        && (resp_origin.status_code == "404" || resp_origin.status_code == "410")) {
+        storeCache(req, cache_key, resp_origin, cache, negative_ttl);
+    }
+    return true;
+}
+
+bool NetCacheServerUtil::lookupCache(const HttpRequest &req, const std::string &primary, TMDBCache &cache)
+{
+    if (!CacheTimer::GetInstance().GetCache(primary, cache)) {
+        return false;
+    }
+    if (cache.vary.empty()) {
+        return true;
+    }
+    // Primary key only records what the response varies on
+    std::string secondary = CacheKey::GetInstance().Secondary(primary, cache.vary, req.header);
+    if (!CacheTimer::GetInstance().GetCache(secondary, cache)) {
+        return false;
+    }
+    CacheTimer::GetInstance().TouchCache(primary);
+    return true;
+}
+
+void NetCacheServerUtil::storeCache(const HttpRequest &req, const std::string &primary, const HttpResponse &resp, const TMDBCache &cache, int negative_ttl)
+{
+    TraceScope scope(TraceEvent::kCacheStore);
+    std::string key = primary;
+    const std::string* vary = CacheKey::FindHeader(resp.header, "Vary");
+    if (vary) {
+        TMDBCache marker{};
+        marker.vary = CacheKey::NormalizeVary(*vary);
+        if (marker.vary == "*") {
+            // Varies on everything, never reusable
+            return;
+        }
+        if (!marker.vary.empty()) {
+            CacheTimer::GetInstance().KeepCacheAlive(primary, marker);
+            key = CacheKey::GetInstance().Secondary(primary, marker.vary, req.header);
+        }
+    }
+    if (negative_ttl > 0) {
+        CacheTimer::GetInstance().KeepNegativeCache(key, cache, negative_ttl);
+    } else {
+        CacheTimer::GetInstance().KeepCacheAlive(key, cache);
+    }
+}
+
+void NetCacheServerUtil::Start(const std::string& forward_origin) {
+    // Init net_client
+    std::regex  pattern("^([^ ]*)://([^ ]*)$", std::regex_constants::optimize);
+    std::smatch match;
+    if (!std::regex_match(forward_origin, match, pattern)) {
+        fprintf(stderr, "Got error forward origin format.\n");
+        return;
+    }
+    std::string protocol_type  = match[1];
+    std::string forward_domain = match[2];
+    uint16_t forward_domain_port = 80;
+    bool forward_origin_ssl = false;
+    if (0 == protocol_type.compare("https")) {
+        forward_domain_port = 443;
+        forward_origin_ssl = true;
+    }
+    // Explicit port, e.g. http://127.0.0.1:8080
+    size_t colon = forward_domain.rfind(':');
+    if (colon != std::string::npos && colon + 1 < forward_domain.size()
+        && forward_domain.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+        forward_domain_port = static_cast<uint16_t>(atoi(forward_domain.c_str() + colon + 1));
+        forward_domain.erase(colon);
+    }
+    NetClientUtil::GetInstance()
+        .Init(forward_domain.c_str(), forward_domain_port, 3, 3, forward_origin_ssl);
+    NetClientUtil::GetInstance().SetIoBackend(io_backend_);
+    // Start cache timer
+    CacheTimer::GetInstance().Start();
+    // Set before the warmer or any worker reads it, never written after
+    if (max_origin_fetches_ == 0) {
+        max_origin_fetches_ = std::max(1, workers_ - 1);
+    }
+    // Warm up alongside normal traffic
+    if (!warm_file_.empty()) {
+        CacheWarmer::GetInstance().Start(warm_file_);
+    }
+    if (is_ssl_) {
+        initTls();
+    }
+    // Create socket
+    int sock = -1;
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ErrIf(sock == -1, [&](){unlink(CONTROL_SOCKET);}, "Create socket failed.");
+    
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    inet_pton(AF_INET, ip_.c_str(), &addr.sin_addr);
+
+    ErrIf(-1 == bind(sock, (sockaddr*)&addr, sizeof(addr)), [&](){close(sock);unlink(CONTROL_SOCKET);}, "Bind failed.");
+    ErrIf(-1 == listen(sock, SOMAXCONN), [&](){close(sock);unlink(CONTROL_SOCKET);}, "Listen failed.");
+
+    listen_fd_ = sock;
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ErrIf(wake_fd_ == -1, [&](){close(sock);unlink(CONTROL_SOCKET);}, "Create eventfd failed.");
+    if (io_backend_ == IoBackend::kUring && is_ssl_) {
+        fprintf(stderr, "TLS needs the epoll backend, io_uring is off.\n");
+    } else if (io_backend_ == IoBackend::kUring) {
+        uring_.reset(new IoUring);
+        if (!IoUring::Supported() || !uring_->Init(4096, true)
+            || !uring_->SetupBuffers(kUringBufGroup, kUringBufCount, kUringBufSize)) {
+            fprintf(stderr, "io_uring is not available, falling back to epoll.\n");
+            uring_.reset();
+        }
+    }
+
+    startWorkers();
+
+    fprintf(stdout, "Start successfully.\n");
+    fflush(stdout);
+
+    if (uring_) {
+        runUring();
+    } else {
+        runEpoll();
+    }
+    close(ctl_fd_);
+    close(sock);
+    close(wake_fd_);
+}
+
+void NetCacheServerUtil::runEpoll()
+{
+    // Event loop: accepts, client reads and writes, deadlines
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    ErrIf(epoll_fd_ == -1, [&](){close(listen_fd_);unlink(CONTROL_SOCKET);}, "Create epoll failed.");
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &kListenTag;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+    ev.data.ptr = &kControlTag;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, ctl_fd_, &ev);
+    ev.data.ptr = &kWakeTag;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    struct epoll_event events[256];
+    int ret = -1;
+    while (true) {
+        // Wake up for the next armed tick, otherwise every 3s as before
+        int timeout = timers_.NextTimeoutMs(SteadyClock::now());
+        if (timeout < 0 || timeout > 3000) {
+            timeout = 3000;
+        }
+        ret = epoll_pwait(epoll_fd_, events, sizeof(events) / sizeof(events[0]), timeout, &origmask_);
+        if (ret == -1 && errno == EINTR) {
+            // Interrupted by signal
+            break;
+        } else if (ret == -1) {
+            // Error occurs
+            fprintf(stderr, "Error occurs\n");
+            fflush(stderr);
+            continue;
+        }
+        for (int i = 0; i < ret; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &kControlTag) {
+                // Control command
+                int ctlsock = ::accept(ctl_fd_, 0, 0);
+                if (ctlsock == -1) {
+                    fprintf(stderr, "Accept control connection failed\n");
+                } else {
+                    handleControl(ctlsock);
+                }
+            } else if (tag == &kListenTag) {
+                // Cache proxy
+                while (true) {
+                    struct sockaddr_in cliaddr;
+                    socklen_t clilen = sizeof(cliaddr);
+                    int clisock = ::accept4(listen_fd_, (sockaddr*)&cliaddr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (-1 == clisock) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            break;
+                        }
+                        // Out of fds or an aborted handshake, keep serving
+                        Metrics::GetInstance().Add(Counter::kAcceptError);
+                        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                        }
+                        break;
+                    }
+                    dispatch(clisock, cliaddr);
+                }
+            } else if (tag == &kWakeTag) {
+                uint64_t n = 0;
+                if (read(wake_fd_, &n, sizeof(n)) > 0) {
+                    flushReplies();
+                }
+            } else {
+                ClientConn* conn = static_cast<ClientConn*>(tag);
+                if (conn->fd == -1) {
+                    // Closed earlier in this batch
+                    continue;
+                }
+                if (conn->state == ConnState::kHandshake) {
+                    handshakeConnect(conn);
+                } else if (conn->state == ConnState::kWrite) {
+                    writeConnect(conn);
+                } else if (conn->state != ConnState::kProcessing) {
+                    readConnect(conn);
+                }
+            }
+        }
+        timers_.Advance(SteadyClock::now(), [this](TimerNode* node){
+            expireConnect(static_cast<ClientConn*>(node->owner));
+        });
+        reapClosed();
+    }
+    // Requests already with a worker get their reply if the socket takes it
+    // at once, everything else is dropped
+    stopWorkers();
+    flushReplies();
+    while (!conns_.empty()) {
+        closeConnect(*conns_.begin());
+    }
+    reapClosed();
+    close(epoll_fd_);
+}
+
+void NetCacheServerUtil::runUring()
+{
+    // Same loop on completions: one io_uring_enter submits every accept,
+    // recv, send and close queued since the last one and waits for more
+    uring_->PrepAcceptMultishot(listen_fd_, SOCK_CLOEXEC, kUringAccept);
+    uring_->PrepPollMultishot(ctl_fd_, POLLIN, kUringControl);
+    uring_->PrepRead(wake_fd_, &wake_count_, sizeof(wake_count_), kUringWake);
+    while (true) {
+        int timeout = timers_.NextTimeoutMs(SteadyClock::now());
+        if (timeout < 0 || timeout > 3000) {
+            timeout = 3000;
+        }
+        int ret = uring_->Wait(1, timeout, &origmask_);
+        if (ret == -EINTR || interrupted) {
+            // Interrupted by signal
+            break;
+        } else if (ret < 0 && ret != -ETIME) {
+            fprintf(stderr, "Error occurs\n");
+            fflush(stderr);
+        }
+        uring_->ForEachCqe([this](const struct io_uring_cqe& cqe){
+            uringComplete(cqe);
+        });
+        timers_.Advance(SteadyClock::now(), [this](TimerNode* node){
+            expireConnect(static_cast<ClientConn*>(node->owner));
+        });
+        reapClosed();
+    }
+    stopWorkers();
+    flushReplies();
+    // Give the last replies a moment to leave, then drop everything
+    auto deadline = SteadyClock::now() + std::chrono::seconds(1);
+    while (!conns_.empty() && SteadyClock::now() < deadline) {
+        uring_->Wait(1, 100);
+        uring_->ForEachCqe([this](const struct io_uring_cqe& cqe){
+            uringComplete(cqe);
+        });
+    }
+    while (!conns_.empty()) {
+        closeConnect(*conns_.begin());
+    }
+    uring_->Submit();
+    uring_.reset();
+    // The ring is gone, nothing is in flight any more
+    for (ClientConn* conn : closed_) {
+        delete conn;
     }
+    closed_.clear();
 }
@@ -1,6 +1,61 @@
 #include "net_client_util.hpp"
 
-NetClientUtil::NetClientUtil() : domain_(""), port_(0), timeout_(0), max_retry_(0), ssl_ctx_(nullptr), status_(HttpRespParseStatus::kParseStatusLine)
+namespace {
+
+// Origin fetches run on the worker threads, each gets its own ring, made on
+// its first fetch
+struct OriginRing {
+    IoUring ring;
+    bool tried = false;
+    bool ready = false;
+};
+
+thread_local OriginRing tls_ring;
+
+const uint64_t kOpConnect = 1;
+const uint64_t kOpSend    = 2;
+const uint64_t kOpRecv    = 3;
+const uint64_t kOpCancel  = 4;
+
+const uint16_t kBufGroup = 0;
+const unsigned kBufCount = 16;
+const unsigned kBufSize  = 16384;
+
+// Whether the header block(lines, CRLF between them) has field `name`
+bool hasField(const std::string& header, const char* name) {
+    size_t len = strlen(name);
+    for (size_t pos = 0; pos < header.size(); ) {
+        if (0 == strncasecmp(header.c_str() + pos, name, len) && header.c_str()[pos + len] == ':') {
+            return true;
+        }
+        size_t eol = header.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            break;
+        }
+        pos = eol + 2;
+    }
+    return false;
+}
+
+IoUring* originRing() {
+    if (!tls_ring.tried) {
+        tls_ring.tried = true;
+        tls_ring.ready = tls_ring.ring.Init(64, true)
+            && tls_ring.ring.SetupBuffers(kBufGroup, kBufCount, kBufSize);
+    }
+    return tls_ring.ready ? &tls_ring.ring : nullptr;
+}
+
+}
+
+NetClientUtil::NetClientUtil()
+    : domain_("")
+    , port_(0)
+    , timeout_(0)
+    , max_retry_(0)
+    , is_ssl_(false)
+    , ssl_ctx_(nullptr)
+    , io_backend_(IoBackend::kEpoll)
 {
 }
 
@@ -38,101 +93,108 @@ void NetClientUtil::Init(const char *domain, uint16_t port, int timeout, int max
     }
 }
 
-void NetClientUtil::constructGetRequest(const char* endpoint, const std::string& header, std::string &req)
+void NetClientUtil::SetIoBackend(IoBackend backend)
+{
+    io_backend_ = backend == IoBackend::kUring && IoUring::Supported() ? IoBackend::kUring : IoBackend::kEpoll;
+}
+
+void NetClientUtil::constructRequest(const char* method, const char* endpoint, const std::string& header, std::string &req)
 {
-    char buffer[1024] = {0};
-    snprintf(buffer, 1024, "GET %s HTTP/1.1\r\n", endpoint);
-    req.append(buffer);
-    memset(buffer, 0, 1024);
-    snprintf(
-        buffer, 
-        1024, 
-        "Host: %s\r\n"
-        "%s\r\n"
-        "Accept: */*\r\n"
-        "User-Agent: net_util\r\n"
-        "Connection: close\r\n"
-        "\r\n", 
-        domain_.c_str(), 
-        header.c_str()
-    );
-    req.append(buffer);
+    // Appended piecewise, a long url or forwarded header block must not be cut
+    req.append(method).append(" ").append(endpoint).append(" HTTP/1.1\r\n");
+    req.append("Host: ").append(domain_).append("\r\n");
+    if (!header.empty()) {
+        req.append(header).append("\r\n");
+    }
+    if (strcmp(method, "GET") == 0) {
+        // Cache fills carry the client's headers, warm-up has none
+        if (!hasField(header, "Accept")) {
+            req.append("Accept: */*\r\n");
+        }
+        if (!hasField(header, "User-Agent")) {
+            req.append("User-Agent: net_util\r\n");
+        }
+    }
+    req.append("Connection: close\r\n\r\n");
 #ifdef _DEBUG
-    fprintf(stdout, req.c_str());
+    fprintf(stdout, "%s", req.c_str());
 #endif
 }
 
-void NetClientUtil::parseHttpResponse(const std::string& resp)
+void NetClientUtil::parseHttpResponse(const std::string& resp, HttpResponse& http_resp)
 {
+    http_resp = {};
+    HttpRespParseStatus status = HttpRespParseStatus::kParseStatusLine;
     size_t resp_len = resp.size();
     const char* p = resp.c_str();
     int parsed_bytes = 0;
     const char CRLF[] = "\r\n";
-    while (status_ != HttpRespParseStatus::kParseFinish) {
+    while (status != HttpRespParseStatus::kParseFinish && static_cast<size_t>(parsed_bytes) <= resp_len) {
         const char* line_end = std::search(p + parsed_bytes, p + resp_len, CRLF, CRLF + 2);
         std::string line(p + parsed_bytes, line_end);
-        switch (status_)
+        switch (status)
         {
         case HttpRespParseStatus::kParseStatusLine:
-            parseStatusLine(line);
+            parseStatusLine(line, http_resp, status);
             break;
         case HttpRespParseStatus::kParseHeaderField:
-            parseHeaderField(line);
+            parseHeaderField(line, http_resp, status);
             if (resp_len - parsed_bytes <= 2) {
-                status_ = HttpRespParseStatus::kParseFinish;
+                status = HttpRespParseStatus::kParseFinish;
             }
             break;
         case HttpRespParseStatus::kParseMessageBody:
-            parseMessageBody(line);
+            // Body runs to EOF(Connection: close), CRLF in it is payload
+            parseMessageBody(std::string(p + parsed_bytes, p + resp_len), http_resp, status);
             break;
         default:
             break;
         }
         parsed_bytes += (line_end + 2 - (p + parsed_bytes));
     }
-    status_ = HttpRespParseStatus::kParseStatusLine;
-    if (http_resp_.status_code == "200") {
 #ifdef _DEBUG
-        fprintf(stderr, "Response body: [%s].\n", http_resp_.body.c_str());
-#endif // _DEBUG
+    // Status codes go to the access log, keep stdio off the hot path
+    if (http_resp.status_code == "200") {
+        fprintf(stderr, "Response body: [%s].\n", http_resp.body.c_str());
     } else {
-        fprintf(stderr, "Got error response, status code: [%s], msg: [%s].\n", http_resp_.status_code.c_str(), http_resp_.status_msg.c_str());
+        fprintf(stderr, "Got error response, status code: [%s], msg: [%s].\n", http_resp.status_code.c_str(), http_resp.status_msg.c_str());
     }
+#endif // _DEBUG
 }
 
-void NetClientUtil::parseStatusLine(const std::string &line)
+void NetClientUtil::parseStatusLine(const std::string &line, HttpResponse& http_resp, HttpRespParseStatus& status)
 {
-    std::regex pattern("^HTTP/([^ ]*) ([^ ]*) ([^ ]*)$", std::regex_constants::optimize);
+    std::regex pattern("^HTTP/([^ ]*) ([^ ]*) ?(.*)$", std::regex_constants::optimize);
     std::smatch match;
     if (std::regex_match(line, match, pattern)) {
-        http_resp_.http_version = match[1];
-        http_resp_.status_code  = match[2];
-        http_resp_.status_msg   = match[3];
-        status_ = HttpRespParseStatus::kParseHeaderField;
+        http_resp.http_version = match[1];
+        http_resp.status_code  = match[2];
+        http_resp.status_msg   = match[3];
+        status = HttpRespParseStatus::kParseHeaderField;
     } else {
-        status_ = HttpRespParseStatus::kParseFinish;
+        status = HttpRespParseStatus::kParseFinish;
 #ifdef _DEBUG
         fprintf(stderr, "Failed to parse status line: [%s].\n", line.c_str());
 #endif // _DEBUG
     }
 }
 
-void NetClientUtil::parseHeaderField(const std::string &line)
+void NetClientUtil::parseHeaderField(const std::string &line, HttpResponse& http_resp, HttpRespParseStatus& status)
 {
     std::regex pattern("^([^ ]*): ?(.*)$", std::regex_constants::optimize);
     std::smatch match;
     if (std::regex_match(line, match, pattern)) {
-        http_resp_.header[match[1]] = match[2];
-        http_resp_.header_origin = line;
+        http_resp.header[match[1]] = match[2];
+        http_resp.header_origin = line;
     } else {
-        status_ = HttpRespParseStatus::kParseMessageBody;
+        status = HttpRespParseStatus::kParseMessageBody;
     }
 }
 
-void NetClientUtil::parseMessageBody(const std::string &line)
+void NetClientUtil::parseMessageBody(const std::string &line, HttpResponse& http_resp, HttpRespParseStatus& status)
 {
-    http_resp_.body = line;
-    status_ = HttpRespParseStatus::kParseFinish;
+    http_resp.body = line;
+    status = HttpRespParseStatus::kParseFinish;
 }
 
 int NetClientUtil::netRead(int sock, char *buf, size_t n, SSL *ssl)
@@ -151,6 +213,158 @@ int NetClientUtil::netWrite(int sock, const char *buf, size_t n, SSL *ssl)
     return SSL_write(ssl, buf, static_cast<int>(n));
 }
 
+void NetClientUtil::uringGet(IoUring& ring, int sock, const struct sockaddr_in& addr, const std::string& request, std::string& resp)
+{
+    // Connect, send and the first recv go out in one io_uring_enter, each
+    // waits for the one before it
+    auto connect_begin = SteadyClock::now();
+    SteadyClock::time_point send_begin, request_sent, first_byte;
+    ring.PrepConnect(sock, (const sockaddr*)&addr, sizeof(addr), kOpConnect)->flags |= IOSQE_IO_LINK;
+    ring.PrepSend(sock, request.data(), request.size(), MSG_NOSIGNAL, kOpSend)->flags |= IOSQE_IO_LINK;
+    ring.PrepRecvMultishot(sock, kBufGroup, kOpRecv);
+    int inflight = 3;
+    bool connected = false;
+    bool cancelled = false;
+    size_t sent = 0;
+    // Nothing may be left in flight on return, the ops point at `addr`,
+    // `request` and the socket
+    while (inflight > 0) {
+        int ret = ring.Wait(1, cancelled ? -1 : timeout_ * 1000);
+        if (ret == -ETIME && !cancelled) {
+            // Origin went quiet, same as SO_RCVTIMEO on the blocking path
+            ring.PrepCancelFd(sock, kOpCancel);
+            inflight++;
+            cancelled = true;
+            continue;
+        }
+        ring.ForEachCqe([&](const struct io_uring_cqe& cqe){
+            switch (cqe.user_data)
+            {
+            case kOpConnect:
+                inflight--;
+                if (cqe.res == 0) {
+                    connected  = true;
+                    send_begin = SteadyClock::now();
+                    Metrics::GetInstance().Observe(Stage::kOriginConnect, connect_begin, send_begin);
+                }
+                break;
+            case kOpSend:
+                inflight--;
+                if (cqe.res <= 0) {
+                    break;
+                }
+                sent += cqe.res;
+                if (sent < request.size()) {
+                    // A short send breaks the link, the recv comes back
+                    // cancelled and is armed again below
+                    ring.PrepSend(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL, kOpSend);
+                    inflight++;
+                } else {
+                    request_sent = SteadyClock::now();
+                    Tracer::GetInstance().Record(TraceEvent::kOriginSend, send_begin, request_sent);
+                }
+                break;
+            case kOpRecv:
+                if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                    inflight--;
+                }
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (cqe.res > 0) {
+                        if (resp.empty()) {
+                            first_byte = SteadyClock::now();
+                            Metrics::GetInstance().Observe(Stage::kOriginTtfb, request_sent, first_byte);
+                        }
+                        resp.append(ring.Buffer(bid), cqe.res);
+                    }
+                    ring.RecycleBuffer(bid);
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE) && !cancelled && connected
+                    && (cqe.res == -ENOBUFS || cqe.res == -ECANCELED || cqe.res > 0)) {
+                    ring.PrepRecvMultishot(sock, kBufGroup, kOpRecv);
+                    inflight++;
+                }
+                break;
+            default:
+                inflight--;
+                break;
+            }
+        });
+    }
+    if (!connected) {
+        throw std::runtime_error("Connection failed");
+    }
+    if (sent < request.size()) {
+        throw std::runtime_error("write failed");
+    }
+    if (!resp.empty()) {
+        Metrics::GetInstance().Observe(Stage::kBodyTransfer, first_byte, SteadyClock::now());
+    }
+}
+
+void NetClientUtil::resolve(struct sockaddr_in& addr)
+{
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+
+    // DNS resolve, getaddrinfo is reentrant unlike gethostbyname
+    struct addrinfo hints;
+    struct addrinfo *ai = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    auto resolve_begin = SteadyClock::now();
+    if (0 != getaddrinfo(domain_.c_str(), nullptr, &hints, &ai) || !ai) {
+        throw std::runtime_error("DNS resolution failed");
+    }
+    Tracer::GetInstance().Record(TraceEvent::kDnsResolve, resolve_begin, SteadyClock::now());
+    addr.sin_addr = ((struct sockaddr_in*)ai->ai_addr)->sin_addr;
+    freeaddrinfo(ai);
+}
+
+void NetClientUtil::setTimeouts(int sock)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+void NetClientUtil::connectOrigin(int sock, const struct sockaddr_in& addr, SSL*& ssl)
+{
+    // Connect
+    auto connect_begin = SteadyClock::now();
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr))) {
+        throw std::runtime_error("Connection failed");
+    }
+    Metrics::GetInstance().Observe(Stage::kOriginConnect, connect_begin, SteadyClock::now());
+
+    if (is_ssl_) {
+        // SSL connect
+        ssl = SSL_new(ssl_ctx_);
+        SSL_set_fd(ssl, sock);
+        /*
+        * Error: sslv3 Alert Handshake Failure (alert number 40) 
+        *
+        * Cause:
+        * For certain web servers which have more than 1 hostname, 
+        * the client has to tell the server the exact hostname the client is trying to connect to, 
+        * so that the web server can present the right SSL certificate having the hostname the client is expecting. 
+        * https://github.com/openssl/openssl/issues/7147#issuecomment-419633974
+        */
+        SSL_set_tlsext_host_name(ssl, domain_.c_str());
+
+        auto handshake_begin = SteadyClock::now();
+        if (SSL_connect(ssl) != 1) {
+            ERR_print_errors_fp(stderr);
+            throw std::runtime_error("SSL handshake failed");
+        }
+        Metrics::GetInstance().Observe(Stage::kTlsHandshake, handshake_begin, SteadyClock::now());
+    }
+}
+
 int NetClientUtil::Get(const char *endpoint, const std::string& header, HttpResponse& resp) {
     int sock = -1;
     SSL* ssl = nullptr;
@@ -159,78 +373,129 @@ int NetClientUtil::Get(const char *endpoint, const std::string& header, HttpResp
         if (sock == -1) {
             throw std::runtime_error("Create socket failed");
         }
-        
-        struct timeval tv;
-        tv.tv_sec = timeout_;
-        tv.tv_usec = 0;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-        
-        struct sockaddr_in addr = {0};
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port_);
-        
-        // DNS resolve
-        struct hostent *he = gethostbyname(domain_.c_str());
-        if (!he) {
-            close(sock);
-            throw std::runtime_error("DNS resolution failed");
+
+        // TLS stays on blocking sockets, OpenSSL does its own reads
+        IoUring* ring = io_backend_ == IoBackend::kUring && !is_ssl_ ? originRing() : nullptr;
+        if (!ring) {
+            setTimeouts(sock);
         }
-        memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
-        
-        // Connect
-        if (connect(sock, (sockaddr*)&addr, sizeof(addr))) {
+        struct sockaddr_in addr;
+        resolve(addr);
+
+        std::string request;
+        constructRequest("GET", endpoint, header, request);
+        std::string tmp;
+        if (ring) {
+            uringGet(*ring, sock, addr, request, tmp);
+            Metrics::GetInstance().Add(Counter::kOriginBytesIn, tmp.size());
+            parseHttpResponse(tmp, resp);
             close(sock);
-            throw std::runtime_error("Connection failed");
-        }
-
-        if (is_ssl_) {
-            // SSL connect
-            ssl = SSL_new(ssl_ctx_);
-            SSL_set_fd(ssl, sock);
-            /*
-            * Error: sslv3 Alert Handshake Failure (alert number 40) 
-            *
-            * Cause:
-            * For certain web servers which have more than 1 hostname, 
-            * the client has to tell the server the exact hostname the client is trying to connect to, 
-            * so that the web server can present the right SSL certificate having the hostname the client is expecting. 
-            * https://github.com/openssl/openssl/issues/7147#issuecomment-419633974
-            */
-            SSL_set_tlsext_host_name(ssl, domain_.c_str());
-
-            if (SSL_connect(ssl) != 1) {
-                ERR_print_errors_fp(stderr);
-                throw std::runtime_error("SSL handshake failed");
-            }
+            return 0;
         }
 
-        std::string request;
-        constructGetRequest(endpoint, header, request);
-        
+        connectOrigin(sock, addr, ssl);
+
+        auto send_begin = SteadyClock::now();
         int written = netWrite(sock, request.c_str(), request.size(), ssl);
         if (written <= 0) {
             throw std::runtime_error("write failed");
         }
 
+        auto request_sent = SteadyClock::now();
+        Tracer::GetInstance().Record(TraceEvent::kOriginSend, send_begin, request_sent);
+        SteadyClock::time_point first_byte;
         char buffer[4096] = {0};
-        std::string tmp;
         int bytesRead;
         while ((bytesRead = netRead(sock, buffer, sizeof(buffer), ssl)) > 0) {
+            if (tmp.empty()) {
+                first_byte = SteadyClock::now();
+                Metrics::GetInstance().Observe(Stage::kOriginTtfb, request_sent, first_byte);
+            }
             tmp.append(buffer, bytesRead);
         }
+        if (!tmp.empty()) {
+            Metrics::GetInstance().Observe(Stage::kBodyTransfer, first_byte, SteadyClock::now());
+        }
+        Metrics::GetInstance().Add(Counter::kOriginBytesIn, tmp.size());
 #ifdef _DEBUG
         fprintf(stderr, "%s\n", tmp.c_str());
 #endif // _DEBUG
-        parseHttpResponse(tmp);
-        resp = http_resp_;
+        parseHttpResponse(tmp, resp);
         if (is_ssl_) SSL_shutdown(ssl);
         close(sock);
         if (is_ssl_) SSL_free(ssl);
         return 0;
     } catch (std::exception& e) {
+        // Closed exactly once here, a second close() could hit an fd
+        // another thread has just been handed
+        if (ssl) SSL_free(ssl);
         if (sock != -1) close(sock);
+        Metrics::GetInstance().Add(Counter::kOriginError);
+        fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+}
+
+int NetClientUtil::Open(const char* method, const char* endpoint, const std::string& header, OriginStream& stream)
+{
+    stream = {};
+    try {
+        stream.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (stream.fd == -1) {
+            throw std::runtime_error("Create socket failed");
+        }
+        // Blocking with timeouts on either backend, the body is relayed by the
+        // calling worker
+        setTimeouts(stream.fd);
+        struct sockaddr_in addr;
+        resolve(addr);
+        connectOrigin(stream.fd, addr, stream.ssl);
+
+        std::string request;
+        constructRequest(method, endpoint, header, request);
+        auto send_begin = SteadyClock::now();
+        if (Write(stream, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+            throw std::runtime_error("write failed");
+        }
+        Tracer::GetInstance().Record(TraceEvent::kOriginSend, send_begin, SteadyClock::now());
+        return 0;
+    } catch (std::exception& e) {
+        Close(stream);
+        Metrics::GetInstance().Add(Counter::kOriginError);
         fprintf(stderr, "%s\n", e.what());
         return -1;
     }
 }
+
+ssize_t NetClientUtil::Read(OriginStream& stream, char* buf, size_t n)
+{
+    return netRead(stream.fd, buf, n, stream.ssl);
+}
+
+ssize_t NetClientUtil::Write(OriginStream& stream, const char* buf, size_t n)
+{
+    size_t sent = 0;
+    while (sent < n) {
+        int written = netWrite(stream.fd, buf + sent, n - sent, stream.ssl);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR && !stream.ssl) {
+                continue;
+            }
+            return -1;
+        }
+        sent += written;
+    }
+    return sent;
+}
+
+void NetClientUtil::Close(OriginStream& stream)
+{
+    if (stream.ssl) {
+        SSL_shutdown(stream.ssl);
+        SSL_free(stream.ssl);
+    }
+    if (stream.fd != -1) {
+        close(stream.fd);
+    }
+    stream = {};
+}
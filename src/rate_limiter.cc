@@ -0,0 +1,55 @@
+#include "rate_limiter.hpp"
+#include <algorithm>
+
+RateLimiter::RateLimiter()
+    : rate_(0)
+    , burst_(1) {
+
+}
+
+void RateLimiter::Init(double rate, double burst)
+{
+    rate_  = std::max(0.0, rate);
+    burst_ = std::max(1.0, burst);
+    buckets_.clear();
+}
+
+bool RateLimiter::Allow(uint32_t ip, std::chrono::steady_clock::time_point now)
+{
+    if (rate_ <= 0) {
+        return true;
+    }
+    auto it = buckets_.find(ip);
+    if (it == buckets_.end()) {
+        if (buckets_.size() >= RATE_LIMITER_MAX_CLIENTS) {
+            prune(now);
+        }
+        buckets_[ip] = Bucket{burst_ - 1, now};
+        return true;
+    }
+    Bucket& bucket = it->second;
+    double elapsed = std::chrono::duration<double>(now - bucket.last).count();
+    bucket.tokens = std::min(burst_, bucket.tokens + elapsed * rate_);
+    bucket.last   = now;
+    if (bucket.tokens < 1) {
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
+void RateLimiter::prune(std::chrono::steady_clock::time_point now)
+{
+    auto full = std::chrono::duration<double>(burst_ / rate_);
+    for (auto it = buckets_.begin(); it != buckets_.end();) {
+        if (now - it->second.last >= full) {
+            it = buckets_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Flooded by distinct addresses, fail open rather than grow unbounded
+    if (buckets_.size() >= RATE_LIMITER_MAX_CLIENTS) {
+        buckets_.clear();
+    }
+}
@@ -0,0 +1,72 @@
+#include "timer_wheel.hpp"
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick, size_t slots)
+    : tick_(tick.count() > 0 ? tick : std::chrono::milliseconds(1))
+    , mask_(0)
+    , origin_(std::chrono::steady_clock::now())
+    , current_(0)
+    , size_(0) {
+    size_t n = 1;
+    while (n < slots) {
+        n <<= 1;
+    }
+    mask_ = n - 1;
+    slots_.resize(n);
+    // Each slot is the sentinel of a circular list
+    for (auto& head : slots_) {
+        head.prev = head.next = &head;
+    }
+}
+
+void TimerWheel::Schedule(TimerNode* node, SteadyTimePoint when)
+{
+    Cancel(node);
+    // Round up so a timer never fires early, and never lands on a slot
+    // Advance has already passed
+    uint64_t tick = tickOf(when) + 1;
+    if (tick <= current_) {
+        tick = current_ + 1;
+    }
+    node->expire_tick = tick;
+    TimerNode& head = slots_[tick & mask_];
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+    ++size_;
+}
+
+void TimerWheel::Cancel(TimerNode* node)
+{
+    if (node->Scheduled()) {
+        unlink(node);
+        --size_;
+    }
+}
+
+int TimerWheel::NextTimeoutMs(SteadyTimePoint now) const
+{
+    if (size_ == 0) {
+        return -1;
+    }
+    // Wake up on the next tick boundary, cheaper than finding the earliest
+    // armed slot and never more than one tick of idle wakeups
+    auto next = origin_ + tick_ * (current_ + 1);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+    return ms < 0 ? 0 : static_cast<int>(ms) + 1;
+}
+
+uint64_t TimerWheel::tickOf(SteadyTimePoint tp) const
+{
+    if (tp <= origin_) {
+        return 0;
+    }
+    return static_cast<uint64_t>((tp - origin_) / tick_);
+}
+
+void TimerWheel::unlink(TimerNode* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
@@ -0,0 +1,174 @@
+#include "trace.hpp"
+
+namespace {
+
+thread_local RequestTrace* tls_trace = nullptr;
+
+const char* kEventNames[] = {
+    "request",
+    "read_msg",
+    "parse",
+    "accept_parse",
+    "cache_lookup",
+    "dns_resolve",
+    "origin_connect",
+    "tls_handshake",
+    "origin_send",
+    "origin_ttfb",
+    "body_transfer",
+    "cache_store",
+    "client_write",
+};
+
+// JSON string body, urls come straight from clients
+void escapeJson(const std::string& in, std::string& out) {
+    char buffer[8];
+    for (unsigned char c : in) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c < 0x20) {
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out.append(buffer);
+        } else {
+            out.push_back(c);
+        }
+    }
+}
+
+}
+
+Tracer::Tracer()
+    : sample_(0)
+    , slow_(0)
+    , seq_(0)
+    , epoch_(SteadyClock::now())
+    , out_(nullptr)
+    , dumped_(0) {
+
+}
+
+Tracer::~Tracer() {
+    if (out_) {
+        fclose(out_);
+    }
+}
+
+Tracer& Tracer::GetInstance() {
+    static Tracer ins;
+    return ins;
+}
+
+bool Tracer::Init(int sample, int slow_ms, const std::string& path)
+{
+    sample_ = std::max(0, sample);
+    slow_   = std::chrono::milliseconds(std::max(0, slow_ms));
+    if (sample_ == 0) {
+        return true;
+    }
+    out_ = fopen(path.c_str(), "w");
+    if (!out_) {
+        sample_ = 0;
+        return false;
+    }
+    // The closing bracket is optional in the array format, so the file stays
+    // loadable however the process ends.
+    fprintf(out_, "[\n");
+    fflush(out_);
+    return true;
+}
+
+void Tracer::Begin(RequestTrace& trace)
+{
+    trace.count   = 0;
+    trace.sampled = sample_ > 0 && (seq_.fetch_add(1, std::memory_order_relaxed) % sample_) == 0;
+    if (trace.sampled) {
+        trace.begin = SteadyClock::now();
+    }
+}
+
+void Tracer::Bind(RequestTrace* trace)
+{
+    tls_trace = trace && trace->sampled ? trace : nullptr;
+}
+
+void Tracer::End(RequestTrace& trace, const std::string& method, const std::string& url, int status_code)
+{
+    if (!trace.sampled) {
+        return;
+    }
+    tls_trace = nullptr;
+    auto end = SteadyClock::now();
+    if (end - trace.begin < slow_) {
+        return;
+    }
+    // Whole request as the outermost span, the rest nest inside it
+    if (trace.count < TRACE_MAX_SPANS) {
+        trace.spans[trace.count++] = TraceSpan{TraceEvent::kRequest, sinceEpoch(trace.begin), sinceEpoch(end)};
+    }
+    dump(trace, method, url, status_code);
+}
+
+void Tracer::Record(TraceEvent event, SteadyClock::time_point begin, SteadyClock::time_point end)
+{
+    if (tls_trace) {
+        Record(*tls_trace, event, begin, end);
+    }
+}
+
+void Tracer::Record(RequestTrace& trace, TraceEvent event, SteadyClock::time_point begin, SteadyClock::time_point end)
+{
+    // A full buffer keeps the first spans, they explain where the time went
+    if (!trace.sampled || trace.count >= TRACE_MAX_SPANS - 1) {
+        return;
+    }
+    trace.spans[trace.count++] = TraceSpan{event, sinceEpoch(begin), sinceEpoch(end)};
+}
+
+bool Tracer::Active()
+{
+    return tls_trace != nullptr;
+}
+
+const char* Tracer::EventName(TraceEvent event)
+{
+    return kEventNames[static_cast<int>(event)];
+}
+
+void Tracer::dump(const RequestTrace& trace, const std::string& method, const std::string& url, int status_code)
+{
+    std::string label;
+    escapeJson(method + " " + url, label);
+    std::string events;
+    char buffer[256];
+    std::lock_guard<std::mutex> lock(mtx_);
+    // One track per dumped request, named after it
+    uint64_t tid = ++dumped_;
+    snprintf(buffer, sizeof(buffer), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%llu,\"args\":{\"name\":\"",
+        getpid(), (unsigned long long)tid);
+    events.append(buffer);
+    events.append(label);
+    events.append("\"}},\n");
+    for (uint32_t i = 0; i < trace.count; ++i) {
+        const TraceSpan& span = trace.spans[i];
+        snprintf(buffer, sizeof(buffer),
+            "{\"name\":\"%s\",\"cat\":\"cps\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%llu",
+            EventName(span.event), span.begin_ns / 1e3, (span.end_ns - span.begin_ns) / 1e3,
+            getpid(), (unsigned long long)tid);
+        events.append(buffer);
+        if (span.event == TraceEvent::kRequest) {
+            snprintf(buffer, sizeof(buffer), ",\"args\":{\"status\":%d,\"request\":\"", status_code);
+            events.append(buffer);
+            events.append(label);
+            events.append("\"}");
+        }
+        events.append("},\n");
+    }
+    fwrite(events.data(), 1, events.size(), out_);
+    fflush(out_);
+}
+
+int64_t Tracer::sinceEpoch(SteadyClock::time_point tp) const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp - epoch_).count();
+}
@@ -0,0 +1,527 @@
+/*
+ * HJson correctness checks: pull parsing across chunk boundaries, error
+ * codes and offsets, parse limits, errors of concurrent parses, number
+ * round trips, in-situ parsing, indexed lookups and the iovec writer.
+ *
+ * make test
+ *
+ * Prints every failed check and exits non-zero if there was any.
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include "hjson.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        if (!((a) == (b))) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #a, #b); \
+            failures++; \
+        } \
+    } while (0)
+
+// Events of a pull parse of `doc` fed `chunk` bytes at a time, one line each
+static std::string PullTrace(const std::string& doc, size_t chunk) {
+    HJson_pull s;
+    HJson_pullInit(&s);
+    std::string trace;
+    size_t pos = 0;
+    char line[64];
+    while (true) {
+        PullEvent ev = HJson_pullNext(&s);
+        switch (ev)
+        {
+        case PullEvent::kNeedMore: {
+            size_t n = std::min(chunk, doc.size() - pos);
+            HJson_pullFeed(&s, doc.data() + pos, n, pos + n == doc.size());
+            pos += n;
+            continue;
+        }
+        case PullEvent::kBeginObject: trace += "{\n"; break;
+        case PullEvent::kEndObject: trace += "}\n"; break;
+        case PullEvent::kBeginArray: trace += "[\n"; break;
+        case PullEvent::kEndArray: trace += "]\n"; break;
+        case PullEvent::kKey:
+            trace += "key " + std::string(s.sv, s.sv_len) + "\n";
+            break;
+        case PullEvent::kValue:
+            if (s.type == ValueType::kString) {
+                trace += "string " + std::string(s.sv, s.sv_len) + "\n";
+            } else if (s.type == ValueType::kNumber) {
+                snprintf(line, sizeof(line), "number %lld %.17g %d\n", (long long)s.lv, s.dv, (int)s.integral);
+                trace += line;
+            } else {
+                snprintf(line, sizeof(line), "literal %d\n", (int)s.type);
+                trace += line;
+            }
+            break;
+        case PullEvent::kEnd:
+            HJson_pullFree(&s);
+            return trace + "end\n";
+        case PullEvent::kError:
+            HJson_pullFree(&s);
+            snprintf(line, sizeof(line), "error %zu\n", s.offset);
+            return trace + line;
+        }
+    }
+}
+
+// Same events at every chunk size as with the whole document at once
+static void CheckPullChunks(const std::string& doc, const std::string& last_line) {
+    std::string whole = PullTrace(doc, doc.size() ? doc.size() : 1);
+    CHECK(whole.size() >= last_line.size()
+        && whole.compare(whole.size() - last_line.size(), last_line.size(), last_line) == 0);
+    for (size_t chunk = 1; chunk < doc.size(); ++chunk) {
+        std::string trace = PullTrace(doc, chunk);
+        if (trace != whole) {
+            fprintf(stderr, "chunk %zu of [%s]:\n%s-- whole:\n%s", chunk, doc.c_str(), trace.c_str(), whole.c_str());
+        }
+        CHECK_EQ(trace, whole);
+    }
+}
+
+static void TestPullChunks() {
+    CheckPullChunks("{\"id\": 1, \"title\": \"caf\\u00e9 \\\"x\\\"\", \"price\": -12.5e-1,\n"
+        " \"tags\": [\"a\", \"b\\ud83d\\ude00\"], \"ok\": true, \"no\": false, \"n\": null,\n"
+        " \"big\": 9223372036854775807, \"neg\": -9223372036854775808, \"e\": 1E+2, \"empty\": {}, \"list\": []}",
+        "end\n");
+    CheckPullChunks("  [1, [2, [3, [\"\\\\\"]]], 0.125]  ", "end\n");
+    CheckPullChunks("\"\"", "end\n");
+    // Errors land on the same offset whatever the chunking
+    CheckPullChunks("[\"\\ud800\"]", "error 1\n");
+    CheckPullChunks("[\"\\udc00x\"]", "error 1\n");
+    CheckPullChunks("{\"a\": 1} x", "error 9\n");
+    CheckPullChunks("[1, 01]", "error 4\n");
+    CheckPullChunks("[1.e5]", "error 1\n");
+    CheckPullChunks("[\"a\tb\"]", "error 3\n");
+    CheckPullChunks("[\"abc", "error 1\n");
+    CheckPullChunks("{\"k\": \"v\\u00", "error 6\n");
+    CheckPullChunks("{\"key", "error 1\n");
+    CheckPullChunks("[tru]", "error 1\n");
+    CheckPullChunks("{\"a\" 1}", "error 5\n");
+}
+
+// Parse `doc` with `ctx` and expect `code` at `offset`
+static void CheckParseError(const std::string& doc, HJson_reader ctx, ParseError code, size_t offset) {
+    HJson_arena* arena = HJson_arenaNew();
+    ctx.arena = arena;
+    HJson* root = HJson_parseContext(doc.data(), doc.size(), &ctx);
+    CHECK(root == nullptr);
+    if (ctx.code != code || ctx.offset != offset) {
+        fprintf(stderr, "[%s]: %s at %zu, wanted %s at %zu\n", doc.c_str(),
+            HJson_errorString(ctx.code), ctx.offset, HJson_errorString(code), offset);
+    }
+    CHECK(ctx.code == code);
+    CHECK_EQ(ctx.offset, offset);
+    CHECK(ctx.error == doc.data() + offset);
+    HJson_arenaDelete(arena);
+}
+
+static void TestParseErrors() {
+    HJson_reader ctx{};
+    CheckParseError("[\"\\ud800\"]", ctx, ParseError::kString, 1);
+    CheckParseError("[\"\\udc00x\"]", ctx, ParseError::kString, 1);
+    CheckParseError("[\"\\ud800\\u0041\"]", ctx, ParseError::kString, 1);
+    CheckParseError("{\"a\": 1} x", ctx, ParseError::kSyntax, 9);
+    CheckParseError("[1] [2]", ctx, ParseError::kSyntax, 4);
+    CheckParseError("[1, 01]", ctx, ParseError::kNumber, 4);
+    CheckParseError("[1e]", ctx, ParseError::kNumber, 1);
+    CheckParseError("[1.]", ctx, ParseError::kNumber, 1);
+    CheckParseError("[1,]", ctx, ParseError::kSyntax, 3);
+    CheckParseError("[\"a\tb\"]", ctx, ParseError::kString, 3);
+    CheckParseError("[\"abc", ctx, ParseError::kSyntax, 1);
+    CheckParseError("{\"k\": \"v\\u00", ctx, ParseError::kSyntax, 6);
+    CheckParseError("{\"key", ctx, ParseError::kSyntax, 1);
+    CheckParseError("", ctx, ParseError::kSyntax, 0);
+
+    // Depth: the limit itself parses, one more fails where it opens
+    ctx.max_depth = 3;
+    HJson_arena* arena = HJson_arenaNew();
+    ctx.arena = arena;
+    CHECK(HJson_parseContext("[[[1]]]", 7, &ctx) != nullptr);
+    HJson_arenaDelete(arena);
+    CheckParseError("[[[[1]]]]", ctx, ParseError::kDepth, 3);
+    CheckParseError("{\"a\":{\"b\":{\"c\":{}}}}", ctx, ParseError::kDepth, 15);
+    ctx.max_depth = 0;
+    std::string deep = std::string(HJSON_MAX_DEPTH + 1, '[') + std::string(HJSON_MAX_DEPTH + 1, ']');
+    CheckParseError(deep, ctx, ParseError::kDepth, HJSON_MAX_DEPTH);
+
+    // Size is checked before anything is read
+    ctx.max_size = 4;
+    CheckParseError("[1,2]", ctx, ParseError::kSize, 0);
+    ctx.max_size = 5;
+    arena = HJson_arenaNew();
+    ctx.arena = arena;
+    CHECK(HJson_parseContext("[1,2]", 5, &ctx) != nullptr);
+    HJson_arenaDelete(arena);
+}
+
+// Threads parse different malformed documents at once, each must see its
+// own error in its context and from HJson_getError
+static void TestParallelErrors() {
+    struct Case {
+        std::string doc;
+        ParseError code;
+        size_t offset;
+    };
+    static const Case cases[] = {
+        {"[\"\\ud800\"]", ParseError::kString, 1},
+        {"{\"a\": 1} x", ParseError::kSyntax, 9},
+        {"[1, 2, 01]", ParseError::kNumber, 7},
+        {"[[[[[[1]]]]]]", ParseError::kDepth, 4},
+        {"{\"k\": [true, fals]}", ParseError::kSyntax, 13},
+        {"[\"x\", 1e+]", ParseError::kNumber, 6},
+        {"[1,2,3,4,5,6,7,8]", ParseError::kSize, 0},
+        {"    [0.5, -]", ParseError::kNumber, 10},
+    };
+    const int kCases = sizeof(cases) / sizeof(cases[0]);
+    const int kThreads = 16;
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            const Case& c = cases[t % kCases];
+            HJson_arena* arena = HJson_arenaNew();
+            for (int i = 0; i < 2000; ++i) {
+                HJson_reader ctx{};
+                ctx.arena = arena;
+                ctx.max_depth = 4;
+                ctx.max_size = c.code == ParseError::kSize ? 8 : 0;
+                HJson* root = HJson_parseContext(c.doc.data(), c.doc.size(), &ctx);
+                // Let the others parse in between, even on one core
+                std::this_thread::yield();
+                if (root || ctx.code != c.code || ctx.offset != c.offset
+                    || ctx.error != c.doc.data() + c.offset || HJson_getError() != ctx.error) {
+                    mismatches++;
+                }
+                HJson_arenaReset(arena);
+            }
+            HJson_arenaDelete(arena);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(mismatches.load(), 0);
+}
+
+static bool SameBits(double a, double b) {
+    return 0 == memcmp(&a, &b, sizeof(a));
+}
+
+// `text` reads as strtod reads it, by the tree and the pull parser, and
+// writing it back reads as the same bits. `written` is the expected output,
+// nullptr to leave it unchecked.
+static void CheckNumber(const char* text, const char* written) {
+    double want = strtod(text, 0);
+    HJson* root = HJson_parseLength(text, strlen(text));
+    CHECK(root && root->type == ValueType::kNumber);
+    if (!root) {
+        return;
+    }
+    if (!SameBits(root->dv, want)) {
+        fprintf(stderr, "[%s]: read %.17g, strtod %.17g\n", text, root->dv, want);
+    }
+    CHECK(SameBits(root->dv, want));
+    HJson_pull s;
+    HJson_pullInit(&s);
+    HJson_pullFeed(&s, text, strlen(text), true);
+    CHECK(HJson_pullNext(&s) == PullEvent::kValue && SameBits(s.dv, want) && s.lv == root->lv);
+    HJson_pullFree(&s);
+    int length = 0;
+    const char* out = HJson_write(root, length);
+    CHECK(out != nullptr);
+    if (out) {
+        HJson* again = HJson_parseLength(out, length);
+        // Same value, not the same spelling: 1.0 is written as 1
+        if (!again || !SameBits(again->dv, root->dv) || again->lv != root->lv) {
+            fprintf(stderr, "[%s]: wrote [%.*s], reads back differently\n", text, length, out);
+        }
+        CHECK(again && SameBits(again->dv, root->dv) && again->lv == root->lv);
+        if (written && std::string(out, length) != written) {
+            fprintf(stderr, "[%s]: wrote [%.*s], wanted [%s]\n", text, length, out, written);
+        }
+        CHECK(!written || std::string(out, length) == written);
+        HJson_delete(again);
+        free((void*)out);
+    }
+    HJson_delete(root);
+}
+
+static void TestNumbers() {
+    // Shortest form that reads back
+    CheckNumber("0.1", "0.1");
+    CheckNumber("1e23", "1e+23");
+    CheckNumber("123.456", "123.456");
+    CheckNumber("-2.5e-22", nullptr);
+    CheckNumber("0.30000000000000004", "0.30000000000000004");
+    // Edges of the fast path: mantissa 2^53, exponent +-22, then just past them
+    CheckNumber("9007199254740992e-22", nullptr);
+    CheckNumber("1e22", nullptr);
+    CheckNumber("8.5e-22", nullptr);
+    CheckNumber("9007199254740993e-22", nullptr);
+    CheckNumber("1e-23", nullptr);
+    CheckNumber("3e23", nullptr);
+    // Integers around 2^53 and at the int64 limits stay exact
+    CheckNumber("9007199254740991", "9007199254740991");
+    CheckNumber("9007199254740992", "9007199254740992");
+    CheckNumber("9007199254740993", "9007199254740993");
+    CheckNumber("9223372036854775807", "9223372036854775807");
+    CheckNumber("-9223372036854775808", "-9223372036854775808");
+    // Doubles past the fast path: long mantissas, 2^53 + 1 as a fraction, extremes
+    CheckNumber("9007199254740993.0", "9007199254740992");
+    CheckNumber("9007199254740991.5", "9007199254740992");
+    CheckNumber("12345678901234567890.5", nullptr);
+    CheckNumber("9223372036854775808", nullptr);
+    CheckNumber("5e-324", "5e-324");
+    CheckNumber("2.2250738585072014e-308", "2.2250738585072014e-308");
+    CheckNumber("1.7976931348623157e308", "1.7976931348623157e+308");
+    CheckNumber("-0.0", "-0");
+    CheckNumber("-0", "-0");
+    CheckNumber("0", "0");
+
+    HJson* root = HJson_parseLength("[9223372036854775807, -9223372036854775808]", 43);
+    CHECK(root && root->child && root->child->next);
+    if (root && root->child && root->child->next) {
+        CHECK(root->child->integral && root->child->lv == INT64_MAX);
+        CHECK(root->child->next->integral && root->child->next->lv == INT64_MIN);
+    }
+    HJson_delete(root);
+}
+
+// Same shape, keys and values
+static bool SameTree(const HJson* a, const HJson* b) {
+    for (; a && b; a = a->next, b = b->next) {
+        if (a->type != b->type || !a->key != !b->key || (a->key && strcmp(a->key, b->key) != 0)) {
+            return false;
+        }
+        if (a->type == ValueType::kString && strcmp(a->sv, b->sv) != 0) {
+            return false;
+        }
+        if (a->type == ValueType::kNumber && (!SameBits(a->dv, b->dv) || a->lv != b->lv)) {
+            return false;
+        }
+        if (!SameTree(a->child, b->child)) {
+            return false;
+        }
+    }
+    return !a && !b;
+}
+
+// In-situ parsing of `doc` reads what HJson_parseLength reads, with every
+// string left inside the buffer
+static void CheckInsitu(const std::string& doc) {
+    HJson* want = HJson_parseLength(doc.data(), doc.size());
+    CHECK(want != nullptr);
+    std::vector<char> buffer(doc.begin(), doc.end());
+    HJson_arena* arena = HJson_arenaNew();
+    HJson* root = HJson_parseInsitu(buffer.data(), buffer.size(), arena);
+    CHECK(root != nullptr);
+    if (want && root) {
+        if (!SameTree(root, want)) {
+            fprintf(stderr, "in-situ [%s] reads differently\n", doc.c_str());
+        }
+        CHECK(SameTree(root, want));
+        std::vector<const HJson*> stack(1, root);
+        while (!stack.empty()) {
+            const HJson* node = stack.back();
+            stack.pop_back();
+            for (const HJson* p = node; p; p = p->next) {
+                if (p->type == ValueType::kString) {
+                    CHECK(p->sv >= buffer.data() && p->sv < buffer.data() + buffer.size());
+                }
+                if (p->child) {
+                    stack.push_back(p->child);
+                }
+            }
+        }
+    }
+    HJson_arenaDelete(arena);
+    HJson_delete(want);
+}
+
+static void TestInsitu() {
+    CheckInsitu("{\"a\\nb\": \"line\\nbreak\", \"e\": \"caf\\u00e9\", \"emoji\": \"\\ud83d\\ude00!\"}");
+    CheckInsitu("[\"\\\"quoted\\\"\", \"back\\\\slash\", \"\\/\\b\\f\\r\\t\", \"plain\", \"\"]");
+    CheckInsitu("\"\\u20ac\\u0041\\ud834\\udd1e\"");
+    // Escapes past the vector width of the string scan
+    CheckInsitu("{\"long\": \"" + std::string(70, 'x') + "\\n" + std::string(40, 'y') + "\\u00e9\", \"n\": [1, -2.5, true, null]}");
+    // And both decode right
+    std::string doc = "{\"a\\nb\": \"caf\\u00e9\", \"emoji\": \"\\ud83d\\ude00\"}";
+    HJson_arena* arena = HJson_arenaNew();
+    HJson* root = HJson_parseInsitu(&doc[0], doc.size(), arena);
+    CHECK(root && root->get("a\nb") && std::string(root->get("a\nb")->sv) == "caf\xc3\xa9");
+    CHECK(root && root->get("emoji") && std::string(root->get("emoji")->sv) == "\xf0\x9f\x98\x80");
+    HJson_arenaReset(arena);
+    // Broken escapes fail the same way
+    std::string bad = "[\"\\ud800\"]";
+    CHECK(HJson_parseLength(bad.data(), bad.size()) == nullptr);
+    CHECK(HJson_parseInsitu(&bad[0], bad.size(), arena) == nullptr);
+    HJson_arenaDelete(arena);
+}
+
+// get() and at() by walking the children, what the index must agree with
+static HJson* LinearGet(HJson* node, const char* k) {
+    HJson* p = node->child;
+    while (p && strcmp(p->key, k) != 0) {
+        p = p->next;
+    }
+    return p;
+}
+
+static HJson* LinearAt(HJson* node, int index) {
+    if (index < 0) {
+        return nullptr;
+    }
+    HJson* p = node->child;
+    while (p && index--) {
+        p = p->next;
+    }
+    return p;
+}
+
+// An object of `n` keys k0.. with k0 and k<n-1> repeated at the end, and an
+// array of `n` numbers, looked up with and without an arena
+static void CheckIndex(int n, HJson_arena* arena) {
+    std::string doc = "{\"o\": {";
+    for (int i = 0; i < n; ++i) {
+        doc += (i ? ",\"k" : "\"k") + std::to_string(i) + "\": " + std::to_string(i);
+    }
+    doc += ", \"k0\": -1, \"k" + std::to_string(n - 1) + "\": -2}, \"a\": [";
+    for (int i = 0; i < n; ++i) {
+        doc += (i ? ", " : "") + std::to_string(i * 10);
+    }
+    doc += "]}";
+    HJson_reader ctx{};
+    ctx.arena = arena;
+    HJson* root = HJson_parseContext(doc.data(), doc.size(), &ctx);
+    CHECK(root != nullptr);
+    if (!root) {
+        return;
+    }
+    HJson* object = root->get("o");
+    HJson* array = root->get("a");
+    CHECK(object && array);
+    if (!object || !array) {
+        return;
+    }
+    CHECK_EQ(object->index != nullptr, n + 2 >= HJSON_INDEX_MIN);
+    CHECK_EQ(array->index != nullptr, n >= HJSON_INDEX_MIN);
+    int mismatches = 0;
+    for (int i = -1; i <= n; ++i) {
+        std::string key = "k" + std::to_string(i);
+        mismatches += object->get(key.c_str()) != LinearGet(object, key.c_str());
+    }
+    for (const char* key : {"", "k", "o", "k00", "K1"}) {
+        mismatches += object->get(key) != nullptr;
+    }
+    // Duplicates answer with the first occurrence
+    mismatches += !object->get("k0") || object->get("k0")->lv != 0;
+    mismatches += !object->get(("k" + std::to_string(n - 1)).c_str())
+        || object->get(("k" + std::to_string(n - 1)).c_str())->lv != n - 1;
+    for (int i : {INT32_MIN, -2, -1, 0, 1, n / 2, n - 1, n, n + 1, n * 2, INT32_MAX}) {
+        mismatches += array->at(i) != LinearAt(array, i);
+    }
+    if (!arena) {
+        // Added keys are found, the index is rebuilt on the next lookup
+        HJson_addItemToObject(object, "added", HJson_createNumber(7));
+        mismatches += object->get("added") != LinearGet(object, "added") || !object->get("added");
+        mismatches += object->get("k1") != LinearGet(object, "k1");
+        HJson_delete(root);
+    }
+    if (mismatches) {
+        fprintf(stderr, "index of %d children: %d mismatches\n", n, mismatches);
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+static void TestIndex() {
+    HJson_arena* arena = HJson_arenaNew();
+    for (int n : {1, 8, 9, HJSON_INDEX_MIN - 2, HJSON_INDEX_MIN - 1, HJSON_INDEX_MIN, 40, 1000}) {
+        CheckIndex(n, nullptr);
+        CheckIndex(n, arena);
+        HJson_arenaReset(arena);
+    }
+    HJson_arenaDelete(arena);
+}
+
+// Bytes of every iovec of `chain` one after the other
+static std::string ChainBytes(const HJson_chain& chain) {
+    std::string out;
+    for (int i = 0; i < chain.count; ++i) {
+        out.append((const char*)chain.iov[i].iov_base, chain.iov[i].iov_len);
+    }
+    return out;
+}
+
+// Same bytes from every writer. @return iovecs the chain took
+static int CheckWriteChain(const std::string& doc) {
+    HJson* root = HJson_parseLength(doc.data(), doc.size());
+    CHECK(root != nullptr);
+    if (!root) {
+        return 0;
+    }
+    int length = 0;
+    const char* text = HJson_write(root, length);
+    CHECK(text != nullptr);
+    HJson_arena* arena = HJson_arenaNew();
+    HJson_chain chain;
+    HJson_chainInit(&chain, arena);
+    CHECK(HJson_writeChain(root, &chain));
+    std::string chained = ChainBytes(chain);
+    CHECK_EQ(chain.length, chained.size());
+    CHECK(text && chained == std::string(text, length));
+    // And the caller's buffer, sized by HJson_measure
+    std::string fixed(HJson_measure(root) + 1, '\0');
+    int written = HJson_writeTo(root, &fixed[0], fixed.size());
+    CHECK(text && written == length && 0 == memcmp(fixed.data(), text, length));
+    CHECK_EQ(HJson_writeTo(root, &fixed[0], length), -1);
+    int count = chain.count;
+    HJson_chainFree(&chain);
+    HJson_arenaDelete(arena);
+    free((void*)text);
+    HJson_delete(root);
+    return count;
+}
+
+static void TestWriteChain() {
+    CheckWriteChain("{\"a\": [1, -2.5, true, false, null, \"x\\ny\"], \"b\": {}}");
+    CheckWriteChain("-0");
+    // Long clean runs go out as iovecs of their own, short ones are copied;
+    // enough of both to span several chunks
+    std::string doc = "[";
+    for (int i = 0; i < 200; ++i) {
+        doc += i ? "," : "";
+        doc += "{\"id\":" + std::to_string(i) + ",\"s\":\"" + std::string(i * 7 % 1500, 'a' + i % 26) + "\\t\"}";
+    }
+    doc += "]";
+    CHECK(CheckWriteChain(doc) > 2);
+}
+
+int main() {
+    TestPullChunks();
+    TestParseErrors();
+    TestParallelErrors();
+    TestNumbers();
+    TestInsitu();
+    TestIndex();
+    TestWriteChain();
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "All HJson checks passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+# End-to-end checks of caching-proxy against bin/mock-origin.
+#
+# make test
+#
+# Prints every failed check and exits non-zero if there was any. Only one
+# caching-proxy runs per machine, none may be running already.
+# Knobs(environment): ORIGIN_PORT, PROXY_PORT
+cd "$(dirname "$0")/.."
+# Ports of a previous run may still be in TIME_WAIT, pick new ones
+ORIGIN_PORT=${ORIGIN_PORT:-$((20000 + $$ % 20000 * 2))}
+PROXY_PORT=${PROXY_PORT:-$((ORIGIN_PORT + 1))}
+FAILURES=0
+
+bin/mock-origin --port $ORIGIN_PORT --body-size 100 > /dev/null &
+ORIGIN_PID=$!
+bin/caching-proxy --port $PROXY_PORT --origin http://127.0.0.1:$ORIGIN_PORT \
+    --access-log off > /dev/null &
+PROXY_PID=$!
+trap 'kill -INT $PROXY_PID 2>/dev/null; kill $ORIGIN_PID 2>/dev/null; wait 2>/dev/null' EXIT INT TERM
+sleep 1
+
+fail() {
+    echo "$1" >&2
+    FAILURES=$((FAILURES + 1))
+}
+
+# Send one raw request, print the reply
+request() {
+    exec 3<>/dev/tcp/127.0.0.1/$PROXY_PORT || return
+    printf "$1" >&3
+    timeout 5 cat <&3 | tr -d '\r'
+    exec 3<&-
+}
+
+# HEAD has the GET's head, Content-Length included, and nothing after the
+# blank line, else a client reusing the connection reads it as the next
+# reply. Miss then hit.
+for round in miss hit; do
+    out=$(request "HEAD /head-$$ HTTP/1.1\r\nHost: test\r\n\r\n")
+    head=$(printf '%s\n' "$out" | awk '$0 == "" { exit } { print }')
+    body=$(printf '%s\n' "$out" | awk 'body { print } $0 == "" { body = 1 }')
+    printf '%s\n' "$head" | head -n 1 | grep -q '^HTTP/1.1 200' || fail "HEAD $round: no 200"
+    printf '%s\n' "$head" | grep -qi '^Content-Length: 100$' || fail "HEAD $round: Content-Length lost"
+    [ -z "$body" ] || fail "HEAD $round: ${#body} body bytes"
+done
+
+if [ $FAILURES -ne 0 ]; then
+    echo "$FAILURES check(s) failed" >&2
+    exit 1
+fi
+echo "All proxy checks passed."